@@ -23,4 +23,21 @@ for ((i=0; i < TEST_RUN; i++));
       done
       echo "[${i}] ${VERSION} runs completed"
     fi
+    if [ $RUN_MPI_OMP_PROGRESS_TESTS == true ]; then
+      VERSION="mpi+omp_progress"
+      echo "[${i}] Running ${VERSION} version"
+
+      for ((j=0; j < INPUT_NUM; j++));
+      do
+        echo "[${VERSION}] Running test ${j}"
+        OUTPUT=$(\
+          KMEANS_MPI_PROGRESS=1 mpirun --bind-to none --np "${MPI_PROCESSES_COMBINED}" --oversubscribe -x KMEANS_MPI_PROGRESS \
+          ./bin/KMEANS_mpi+omp ${INPUT[j]} ${K[j]} ${ITER} ${MIN_CHANGES} ${MAX_DIST} ${OUT_DIR}KMEANS_${VERSION}_${j}.txt \
+        )
+        COMPARISON=$(./bin/compare "${OUT_DIR}KMEANS_seq_${j}.txt" "${OUT_DIR}KMEANS_${VERSION}_${j}.txt")
+
+        printf "%s,%s,%s\n" "${VERSION}" "${OUTPUT}" "${COMPARISON}" >> "${TEST_RESULTS}input_${j}.csv"
+      done
+      echo "[${i}] ${VERSION} runs completed"
+    fi
 done
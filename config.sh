@@ -10,12 +10,21 @@ OMP_NUM_THREADS=32
 MPI_PROCESSES_COMBINED=8
 OMP_NUM_THREADS_COMBINED=32
 SCALING_THREADS=(1 2 4 8 12 16 20 24 28 32)
+# Bounded staleness of the mpi_stale<s> runs, s=0 is the mpi run
+STALENESS=(1 2)
+# Percentage of appended rows of the omp_refit<p> runs, compared with an omp run from the same prior centroids
+REFIT_NEW=(1 10 50)
+# Per-phase timings (KMEANS_TRACE) of the omp and mpi runs, written to ${TEST_RESULTS}trace_<version>_<test>.csv
+TRACE_PHASES=false
 
 RUN_SEQUENTIAL_TESTS=false
 RUN_MPI_TESTS=true
+RUN_MPI_STALENESS_TESTS=true
 RUN_OMP_TESTS=true
+RUN_OMP_REFIT_TESTS=true
 RUN_CUDA_TESTS=true
 RUN_MPI_OMP_TESTS=true
+RUN_MPI_OMP_PROGRESS_TESTS=true
 RUN_MPI_PARALLEL_TESTS=false
 
 TEST_RUN=1
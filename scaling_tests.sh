@@ -31,4 +31,20 @@ do
     done
     printf "\n" >> "${TEST_RESULTS}${VERSION}_${j}_strong.csv"
   done
+
+  # Same runs with first-touch loading, threads spread over the NUMA nodes and per-node centroid replicas
+  VERSION="omp_numa"
+  for ((j = 0; j < INPUT_NUM; j++));
+  do
+    for ((k = 0; k < INPUT_NUM; k++));
+    do
+      export OMP_NUM_THREADS=${THREADS_TO_RUN[k]}
+      OUTPUT=$(\
+        KMEANS_NUMA=1 KMEANS_PIN=spread \
+        ./bin/KMEANS_omp "${INPUT[j]}" ${K} ${ITER} ${MIN_CHANGES} ${MAX_DIST} "${OUT_DIR}KMEANS_${VERSION}_${j}.txt" \
+      )
+      printf "%s," "${OUTPUT}" >> "${TEST_RESULTS}${VERSION}_${j}_strong.csv"
+    done
+    printf "\n" >> "${TEST_RESULTS}${VERSION}_${j}_strong.csv"
+  done
 done
\ No newline at end of file
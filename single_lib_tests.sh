@@ -6,6 +6,13 @@ ulimit -s unlimited
 export OMP_STACKSIZE=512M
 INPUT_NUM=${#INPUT[@]}
 
+# KMEANS_TRACE of a run: empty (no trace) unless TRACE_PHASES is true
+trace_file() {
+  if [ $TRACE_PHASES == true ]; then
+    echo "${TEST_RESULTS}trace_${1}_${2}.csv"
+  fi
+}
+
 for ((i=0; i < TEST_RUN; i++));
   do
     if [ $RUN_SEQUENTIAL_TESTS == true ]; then
@@ -30,7 +37,7 @@ for ((i=0; i < TEST_RUN; i++));
       do
         echo "[${VERSION}] Running test ${j}"
         OUTPUT=$(\
-          mpirun --bind-to none --np "${MPI_PROCESSES}" --oversubscribe \
+          KMEANS_TRACE=$(trace_file ${VERSION} ${j}) mpirun --bind-to none --np "${MPI_PROCESSES}" --oversubscribe -x KMEANS_TRACE \
           ./bin/KMEANS_mpi ${INPUT[j]} ${K[j]} ${ITER} ${MIN_CHANGES} ${MAX_DIST} ${OUT_DIR}KMEANS_${VERSION}_${j}.txt \
         )
         COMPARISON=$(./bin/compare "${OUT_DIR}KMEANS_seq_${j}.txt" "${OUT_DIR}KMEANS_${VERSION}_${j}.txt")
@@ -40,6 +47,27 @@ for ((i=0; i < TEST_RUN; i++));
       echo "[${i}] ${VERSION} runs completed"
     fi
 
+    if [ $RUN_MPI_STALENESS_TESTS == true ]; then
+      for s in "${STALENESS[@]}";
+      do
+        VERSION="mpi_stale${s}"
+        echo "[${i}] Running ${VERSION} version"
+
+        for ((j=0; j < INPUT_NUM; j++));
+        do
+          echo "[${VERSION}] Running test ${j}"
+          OUTPUT=$(\
+            KMEANS_MPI_STALENESS=${s} mpirun --bind-to none --np "${MPI_PROCESSES}" --oversubscribe -x KMEANS_MPI_STALENESS \
+            ./bin/KMEANS_mpi ${INPUT[j]} ${K[j]} ${ITER} ${MIN_CHANGES} ${MAX_DIST} ${OUT_DIR}KMEANS_${VERSION}_${j}.txt \
+          )
+          COMPARISON=$(./bin/compare "${OUT_DIR}KMEANS_seq_${j}.txt" "${OUT_DIR}KMEANS_${VERSION}_${j}.txt")
+
+          printf "%s,%s,%s\n" "${VERSION}" "${OUTPUT}" "${COMPARISON}" >> "${TEST_RESULTS}input_${j}.csv"
+        done
+        echo "[${i}] ${VERSION} runs completed"
+      done
+    fi
+
     if [ $RUN_OMP_TESTS == true ]; then
       VERSION="omp"
       echo "[${i}] Running ${VERSION} version"
@@ -47,7 +75,8 @@ for ((i=0; i < TEST_RUN; i++));
       for ((j=0; j < INPUT_NUM; j++));
       do
         echo "[${VERSION}] Running test ${j}"
-        OUTPUT=$(./bin/KMEANS_omp ${INPUT[j]} ${K[j]} ${ITER} ${MIN_CHANGES} ${MAX_DIST} ${OUT_DIR}KMEANS_${VERSION}_${j}.txt)
+        OUTPUT=$(KMEANS_TRACE=$(trace_file ${VERSION} ${j}) \
+          ./bin/KMEANS_omp ${INPUT[j]} ${K[j]} ${ITER} ${MIN_CHANGES} ${MAX_DIST} ${OUT_DIR}KMEANS_${VERSION}_${j}.txt)
         COMPARISON=$(./bin/compare "${OUT_DIR}KMEANS_seq_${j}.txt" "${OUT_DIR}KMEANS_${VERSION}_${j}.txt")
 
         printf "%s,%s,%s\n" "${VERSION}" "${OUTPUT}" "${COMPARISON}" >> "${TEST_RESULTS}input_${j}.csv"
@@ -55,6 +84,35 @@ for ((i=0; i < TEST_RUN; i++));
       echo "[${i}] ${VERSION} runs completed"
     fi
 
+    if [ $RUN_OMP_REFIT_TESTS == true ]; then
+      for p in "${REFIT_NEW[@]}";
+      do
+        VERSION="omp_refit${p}"
+        echo "[${i}] Running ${VERSION} version"
+
+        for ((j=0; j < INPUT_NUM; j++));
+        do
+          echo "[${VERSION}] Running test ${j}"
+          # The first rows are clustered first, then the rest of the file is taken as appended to them
+          LINES=$(wc -l < "${INPUT[j]}")
+          head -n $((LINES - LINES * p / 100)) "${INPUT[j]}" > "${OUT_DIR}prior_${j}.inp"
+          KMEANS_CENTROIDS="${OUT_DIR}prior_${j}.centroids" \
+            ./bin/KMEANS_omp "${OUT_DIR}prior_${j}.inp" ${K[j]} ${ITER} ${MIN_CHANGES} ${MAX_DIST} "${OUT_DIR}prior_${j}.txt" > /dev/null
+          OUTPUT=$(\
+            KMEANS_PRIOR="${OUT_DIR}prior_${j}.txt" KMEANS_PRIOR_CENTROIDS="${OUT_DIR}prior_${j}.centroids" \
+            ./bin/KMEANS_omp ${INPUT[j]} ${K[j]} ${ITER} ${MIN_CHANGES} ${MAX_DIST} ${OUT_DIR}KMEANS_${VERSION}_${j}.txt \
+          )
+          # Reference: Lloyd's iterations on the whole file from the same centroids, without the prior classes
+          KMEANS_PRIOR_CENTROIDS="${OUT_DIR}prior_${j}.centroids" \
+            ./bin/KMEANS_omp ${INPUT[j]} ${K[j]} ${ITER} ${MIN_CHANGES} ${MAX_DIST} "${OUT_DIR}warm_${j}.txt" > /dev/null
+          COMPARISON=$(./bin/compare "${OUT_DIR}warm_${j}.txt" "${OUT_DIR}KMEANS_${VERSION}_${j}.txt")
+
+          printf "%s,%s,%s\n" "${VERSION}" "${OUTPUT}" "${COMPARISON}" >> "${TEST_RESULTS}input_${j}.csv"
+        done
+        echo "[${i}] ${VERSION} runs completed"
+      done
+    fi
+
     if [ $RUN_CUDA_TESTS == true ]; then
       VERSION="cuda"
       echo "[${i}] Running ${VERSION} version"
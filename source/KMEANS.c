@@ -3,6 +3,9 @@
  *
  * Reference sequential version (Do not modify this code)
  *
+ * The reading and writing of the files and the initial centroids are the ones shared by all the
+ * versions (kmeans_common.c).
+ *
  * Parallel computing (Degree in Computer Engineering)
  * 2022/2023
  *
@@ -22,163 +25,14 @@
 #include <string.h>
 #include <float.h>
 #include <assert.h>
+#include "kmeans_common.h"
 
-#define MAXLINE 2000
 #define MAXCAD 200
 
 //Macros
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 
-/* 
-Function showFileError: It displays the corresponding error during file reading.
-*/
-void showFileError(int error, char* filename)
-{
-    printf("Error\n");
-    switch (error)
-    {
-    case -1:
-        fprintf(stderr, "\tFile %s has too many columns.\n", filename);
-        fprintf(stderr, "\tThe maximum number of columns has been exceeded. MAXLINE: %d.\n", MAXLINE);
-        break;
-    case -2:
-        fprintf(stderr, "Error reading file: %s.\n", filename);
-        break;
-    case -3:
-        fprintf(stderr, "Error writing file: %s.\n", filename);
-        break;
-    }
-    fflush(stderr);
-}
-
-/*
-Function readInput: It reads the file to determine the number of rows and columns.
-*/
-int readInput(char* filename, int* lines, int* samples)
-{
-    FILE* fp;
-    char line[MAXLINE] = "";
-    char* ptr;
-    const char* delim = "\t";
-    int contlines, contsamples = 0;
-
-    contlines = 0;
-
-    if ((fp = fopen(filename, "r")) != NULL)
-    {
-        while (fgets(line, MAXLINE, fp) != NULL)
-        {
-            if (strchr(line, '\n') == NULL)
-            {
-                return -1;
-            }
-            contlines++;
-            ptr = strtok(line, delim);
-            contsamples = 0;
-            while (ptr != NULL)
-            {
-                contsamples++;
-                ptr = strtok(NULL, delim);
-            }
-        }
-        fclose(fp);
-        *lines = contlines;
-        *samples = contsamples;
-        return 0;
-    }
-    else
-    {
-        return -2;
-    }
-}
-
-/*
-Function readInput2: It loads data from file.
-*/
-int readInput2(char* filename, float* data)
-{
-    FILE* fp;
-    char line[MAXLINE] = "";
-    char* ptr;
-    const char* delim = "\t";
-    int i = 0;
-
-    if ((fp = fopen(filename, "rt")) != NULL)
-    {
-        while (fgets(line, MAXLINE, fp) != NULL)
-        {
-            ptr = strtok(line, delim);
-            while (ptr != NULL)
-            {
-                data[i] = atof(ptr);
-                i++;
-                ptr = strtok(NULL, delim);
-            }
-        }
-        fclose(fp);
-        return 0;
-    }
-    else
-    {
-        return -2; //No file found
-    }
-}
-
-/*
-Function writeResult: It writes in the output file the cluster of each sample (point).
-*/
-int writeResult(int* classMap, int lines, const char* filename)
-{
-    FILE* fp;
-
-    if ((fp = fopen(filename, "wt")) != NULL)
-    {
-        for (int i = 0; i < lines; i++)
-        {
-            fprintf(fp, "%d\n", classMap[i]);
-        }
-        fclose(fp);
-
-        return 0;
-    }
-    else
-    {
-        return -3; //No file found
-    }
-}
-
-/*
-
-Function initCentroids: This function copies the values of the initial centroids, using their
-position in the input data structure as a reference map.
-*/
-void initCentroids(const float* data, float* centroids, int* centroidPos, int samples, int K)
-{
-    int i;
-    int idx;
-    for (i = 0; i < K; i++)
-    {
-        idx = centroidPos[i];
-        memcpy(&centroids[i * samples], &data[idx * samples], (samples * sizeof(float)));
-    }
-}
-
-/*
-Function euclideanDistance: Euclidean distance
-This function could be modified
-*/
-float euclideanDistance(float* point, float* center, int samples)
-{
-    float dist = 0.0;
-    for (int i = 0; i < samples; i++)
-    {
-        dist += (point[i] - center[i]) * (point[i] - center[i]);
-    }
-    dist = sqrt(dist);
-    return (dist);
-}
-
 /*
 Function zeroFloatMatriz: Set matrix elements to 0
 This function could be modified
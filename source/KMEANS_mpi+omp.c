@@ -23,9 +23,15 @@
 #include <float.h>
 #include <mpi.h>
 #include <omp.h>
+#include "kmeans_common.h"
+#include "kmeans_tiling.h"
+#include "kmeans_layout.h"
+#include "kmeans_pds.h"
+#include "kmeans_sketch.h"
+#include "kmeans_index.h"
 
-#define MAXLINE 2000
-#define MAXCAD 200
+// Rows (or centroids) handed out at a time when one thread drives the MPI progress
+#define PROGRESS_ROWS 256
 
 //Macros
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
@@ -40,153 +46,58 @@
         MPI_Abort( MPI_COMM_WORLD, EXIT_FAILURE );                              \
     }       \
 }
-/*
-Function showFileError: It displays the corresponding error during file reading.
-*/
-void showFileError(int error, char* filename)
-{
-    printf("Error\n");
-    switch (error)
-    {
-    case -1:
-        fprintf(stderr, "\tFile %s has too many columns.\n", filename);
-        fprintf(stderr, "\tThe maximum number of columns has been exceeded. MAXLINE: %d.\n", MAXLINE);
-        break;
-    case -2:
-        fprintf(stderr, "Error reading file: %s.\n", filename);
-        break;
-    case -3:
-        fprintf(stderr, "Error writing file: %s.\n", filename);
-        break;
-    }
-    fflush(stderr);
-}
 
-/*
-Function readInput: It reads the file to determine the number of rows and columns.
-*/
-int readInput(char* filename, int* lines, int* samples)
-{
-    FILE* fp;
-    char line[MAXLINE] = "";
-    char* ptr;
-    const char* delim = "\t";
-    int contlines, contsamples = 0;
-
-    contlines = 0;
-
-    if ((fp = fopen(filename, "r")) != NULL)
-    {
-        while (fgets(line, MAXLINE, fp) != NULL)
-        {
-            if (strchr(line, '\n') == NULL)
-            {
-                return -1;
-            }
-            contlines++;
-            ptr = strtok(line, delim);
-            contsamples = 0;
-            while (ptr != NULL)
-            {
-                contsamples++;
-                ptr = strtok(NULL, delim);
-            }
-        }
-        fclose(fp);
-        *lines = contlines;
-        *samples = contsamples;
-        return 0;
-    }
-    else
-    {
-        return -2;
-    }
-}
+#include "kmeans_shared.h"
+#include "kmeans_persistent.h"
+#include "kmeans_trace.h"
 
 /*
-Function readInput2: It loads data from file.
+Function driveProgress: Lets the MPI library advance a pending non-blocking operation.
+Open MPI only progresses non-blocking collectives from inside MPI calls.
 */
-int readInput2(char* filename, float* data)
+static inline void driveProgress(MPI_Request* request)
 {
-    FILE* fp;
-    char line[MAXLINE] = "";
-    char* ptr;
-    const char* delim = "\t";
-    int i = 0;
-
-    if ((fp = fopen(filename, "rt")) != NULL)
-    {
-        while (fgets(line, MAXLINE, fp) != NULL)
-        {
-            ptr = strtok(line, delim);
-            while (ptr != NULL)
-            {
-                data[i] = atof(ptr);
-                i++;
-                ptr = strtok(NULL, delim);
-            }
-        }
-        fclose(fp);
-        return 0;
-    }
-    else
-    {
-        return -2; //No file found
-    }
+    int done;
+    MPI_Test(request, &done, MPI_STATUS_IGNORE);
 }
 
 /*
-Function writeResult: It writes in the output file the cluster of each sample (point).
+Function startCounts: Starts the sums over the processes of the points of every class (counts) and
+of the class changes (changesReq), persistent or not.
 */
-int writeResult(int* classMap, int lines, const char* filename)
+static inline void startCounts(int persistent, int* pointsPerClass, int K, int* changes, MPI_Request* counts,
+                               MPI_Request* changesReq)
 {
-    FILE* fp;
-
-    if ((fp = fopen(filename, "wt")) != NULL)
+    if (persistent)
     {
-        for (int i = 0; i < lines; i++)
-        {
-            fprintf(fp, "%d\n", classMap[i]);
-        }
-        fclose(fp);
-
-        return 0;
+        MPI_CHECK_RETURN(MPI_Start(counts));
+        MPI_CHECK_RETURN(MPI_Start(changesReq));
     }
     else
     {
-        return -3; //No file found
+        MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, pointsPerClass, K, MPI_INT, MPI_SUM, MPI_COMM_WORLD, counts));
+        MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, changes, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD, changesReq));
     }
 }
 
 /*
-
-Function initCentroids: This function copies the values of the initial centroids, using their
-position in the input data structure as a reference map.
+Function startGather: Starts the gather of the centroids updated by every process into auxCentroids,
+persistent or not. Nothing is sent with node-shared centroids.
 */
-void initCentroids(const float* data, float* centroids, int* centroidPos, int samples, int K)
+static inline void startGather(int persistent, int sharedMemory, float* auxCentroids, int centroidOffsetPerSamples,
+                               const int* centroidsPerProcess, const int* centroidsDispls, MPI_Request* request)
 {
-    int i;
-    int idx;
-    for (i = 0; i < K; i++)
+    if (persistent)
     {
-        idx = centroidPos[i];
-        memcpy(&centroids[i * samples], &data[idx * samples], (samples * sizeof(float)));
+        MPI_CHECK_RETURN(MPI_Start(request));
     }
-}
-
-/*
-Function euclideanDistance: Euclidean distance
-This function could be modified
-*/
-float_t euclideanDistance(const float* point, const float* center, const int samples)
-{
-    float_t dist = 0.0;
-    for (int i = 0; i < samples; i++)
+    else if (!sharedMemory)
     {
-        dist += (point[i] - center[i]) * (point[i] - center[i]);
+        MPI_CHECK_RETURN(MPI_Iallgatherv(
+            MPI_IN_PLACE, centroidOffsetPerSamples, MPI_FLOAT,
+            auxCentroids, centroidsPerProcess, centroidsDispls,
+            MPI_FLOAT, MPI_COMM_WORLD, request));
     }
-
-    return sqrt(dist);
 }
 
 int main(int argc, char* argv[])
@@ -231,6 +142,7 @@ int main(int argc, char* argv[])
     // Reading the input data
     // lines = number of points; samples = number of dimensions per point
     int lines = 0, samples = 0;
+    double loadStart = MPI_Wtime();
 
     int error = readInput(argv[1], &lines, &samples);
     if (error != 0)
@@ -239,18 +151,40 @@ int main(int argc, char* argv[])
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
 
-    float* data = (float*)calloc(lines * samples, sizeof(float));
+    // KMEANS_MPI_SHARED=1: one copy of the rows, the centroids and their sums per node
+    const int sharedMemory = sharedMemoryRequested();
+    NodeComms nodes = NO_NODE_COMMS;
+    MPI_Win dataWin = MPI_WIN_NULL, centroidsWin = MPI_WIN_NULL;
+    float* data;
+    if (sharedMemory)
+    {
+        splitNodes(MPI_COMM_WORLD, &nodes);
+        data = allocateShared((long)lines * samples * sizeof(float), nodes.node, &dataWin);
+        if (nodes.rank == 0)
+        {
+            memset(data, 0, (long)lines * samples * sizeof(float));
+        }
+    }
+    else
+    {
+        data = (float*)calloc(lines * samples, sizeof(float));
+    }
     if (data == NULL)
     {
         fprintf(stderr, "Memory allocation error.\n");
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
-    error = readInput2(argv[1], data);
+    error = (nodes.rank == 0) ? readInput2(argv[1], data) : 0;
     if (error != 0)
     {
         showFileError(error, argv[1]);
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
+    if (sharedMemory)
+    {
+        nodeSync(dataWin, nodes.node);
+    }
+    const double loadSeconds = MPI_Wtime() - loadStart;
 
     // Parameters
     int K = atoi(argv[2]);
@@ -259,9 +193,21 @@ int main(int argc, char* argv[])
     float maxThreshold = atof(argv[5]);
 
     int* centroidPos = (int*)calloc(K, sizeof(int));
-    float* centroids = (float*)calloc(K * samples, sizeof(float));
+    // Shared: centroids and auxCentroids live in one node window
+    float* centroids;
+    float* auxCentroids;
+    if (sharedMemory)
+    {
+        centroids = allocateShared(2L * K * samples * sizeof(float), nodes.node, &centroidsWin);
+        auxCentroids = centroids + K * samples;
+    }
+    else
+    {
+        centroids = (float*)calloc(K * samples, sizeof(float));
+        auxCentroids = (float*)calloc(K * samples, sizeof(float));
+    }
 
-    if (centroidPos == NULL || centroids == NULL)
+    if (centroidPos == NULL || centroids == NULL || auxCentroids == NULL)
     {
         fprintf(stderr, "Memory allocation error.\n");
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
@@ -275,7 +221,14 @@ int main(int argc, char* argv[])
 
     // Loading the array of initial centroids with the data from the array data
     // The centroids are points stored in the data array.
-    initCentroids(data, centroids, centroidPos, samples, K);
+    if (nodes.rank == 0)
+    {
+        initCentroids(data, centroids, centroidPos, samples, K);
+    }
+    if (sharedMemory)
+    {
+        nodeSync(centroidsWin, nodes.node);
+    }
 
     #ifdef DEBUG
     if (rank == 0)
@@ -304,22 +257,51 @@ int main(int argc, char* argv[])
     start = MPI_Wtime();
     //**************************************************
     #ifdef DEBUG
-    char* outputMsg = NULL;
-    char line[100];
+    KMeansLog outputMsg = { NULL, 0, 0 };
+    #endif
+    // Get the number of threads that will be spawned
+    const char* RAW_OMP_NUM_THREADS = getenv("OMP_NUM_THREADS");
+    const int OMP_NUM_THREADS = (RAW_OMP_NUM_THREADS != NULL) ? (atoi(RAW_OMP_NUM_THREADS)) : omp_get_max_threads();
 
-    if (rank == 0)
+    // KMEANS_TRACE=<file>: time of every phase of every iteration of every thread and process
+    const char* traceFile = tracePath();
+    PhaseTrace trace = { OMP_NUM_THREADS, 0, 0, NULL };
+    if (traceFile != NULL && initTrace(&trace, maxIterations, OMP_NUM_THREADS) != 0)
+    {
+        fprintf(stderr, "Memory allocation error.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    PhaseTrace* const traced = traceFile != NULL ? &trace : NULL;
+
+    // KMEANS_MPI_PROGRESS=1: the master thread starts every non-blocking operation and tests it
+    // between its blocks of the accumulation and update loops, which are handed out dynamically
+    // so that the other threads take over the rows it leaves. Otherwise any thread starts them and
+    // the loops keep their static split.
+    const char* RAW_KMEANS_MPI_PROGRESS = getenv("KMEANS_MPI_PROGRESS");
+    const int progressMode = (RAW_KMEANS_MPI_PROGRESS != NULL) && (atoi(RAW_KMEANS_MPI_PROGRESS) == 1);
+
+    // Assignment kernel: default one centroid at a time, "tiled" for blocks of points x blocks of centroids
+    const char* RAW_KMEANS_ASSIGN = getenv("KMEANS_ASSIGN");
+    const int tiledAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "tiled") == 0);
+    // "pds": partial distance search, optionally over the dimensions sorted by variance
+    const int pdsAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "pds") == 0);
+    const char* RAW_KMEANS_PDS_ORDER = getenv("KMEANS_PDS_ORDER");
+    int* pdsOrder = NULL;
+    long pdsEvaluated = 0;
+    if (pdsAssign && RAW_KMEANS_PDS_ORDER != NULL && strcmp(RAW_KMEANS_PDS_ORDER, "variance") == 0)
     {
-        outputMsg = calloc(10000, sizeof(char));
-        if (outputMsg == NULL)
+        pdsOrder = varianceOrder(data, lines, samples);
+        if (pdsOrder == NULL)
         {
             fprintf(stderr, "Memory allocation error.\n");
             MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
         }
     }
-    #endif
-    // Get the number of threads that will be spawned
-    const char* RAW_OMP_NUM_THREADS = getenv("OMP_NUM_THREADS");
-    const int OMP_NUM_THREADS = (RAW_OMP_NUM_THREADS != NULL) ? (atoi(RAW_OMP_NUM_THREADS)) : omp_get_max_threads();
+
+    // Optional blocked copy of the local rows: groups of points interleaved per dimension
+    const char* RAW_KMEANS_LAYOUT = getenv("KMEANS_LAYOUT");
+    const int aosoaLayout = (RAW_KMEANS_LAYOUT != NULL) && (strcmp(RAW_KMEANS_LAYOUT, "aosoa") == 0);
+    AoSoAData layout = { NULL, 0, 0, 0, 0, 0 };
 
     float_t dist, minDist = FLT_MAX, maxDist = FLT_MIN;
     int it = 1, changes = 0, anotherIteration = 0;
@@ -334,23 +316,24 @@ int main(int argc, char* argv[])
     int* centroidsPerProcess = calloc(size, sizeof(int));
     int* centroidsDispls = calloc(size, sizeof(int));
     int* pointsPerClass = (int*)calloc(K, sizeof(int));
-    float* auxCentroids = (float*)calloc(K * samples, sizeof(float));
     float* localAuxCentroids = (float*)calloc(K * samples, sizeof(float));
-    if (pointsPerClass == NULL || auxCentroids == NULL || localAuxCentroids == NULL || centroidsPerProcess == NULL ||
+    if (pointsPerClass == NULL || localAuxCentroids == NULL || centroidsPerProcess == NULL ||
         centroidsDispls == NULL)
     {
         fprintf(stderr, "Memory allocation error.\n");
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
 
-    MPI_Request reqs[3], req, workSplit[2];
+    MPI_Request reqs[3], req, workSplit[2], sumsReq;
     int *linesPerProcess = NULL, *displacementPerProcess = NULL;
     int workPerProcess = (lines / size), workReminder = (lines % size);
-    int processCentroids = (K / size), centroidsReminder = (K % size);
+    // Shared: the centroids are split among the processes of the node instead
+    const int splitRank = sharedMemory ? nodes.rank : rank, splitSize = sharedMemory ? nodes.size : size;
+    int processCentroids = (K / splitSize), centroidsReminder = (K % splitSize);
     int startCentroidPerSamples, centroidOffsetPerSamples;
     int startLine = rank * workPerProcess;
     int lineOffset = workPerProcess;
-    int startCentroid = rank * processCentroids;
+    int startCentroid = splitRank * processCentroids;
     int centroidOffset = processCentroids;
 
     // Data to split lines between ranks
@@ -365,9 +348,9 @@ int main(int argc, char* argv[])
     }
 
     // Data to split centroids between ranks
-    if (rank < centroidsReminder)
+    if (splitRank < centroidsReminder)
     {
-        startCentroid += rank;
+        startCentroid += splitRank;
         centroidOffset++;
     }
     else
@@ -413,62 +396,329 @@ int main(int argc, char* argv[])
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
 
+    if (aosoaLayout && buildAoSoA(&layout, &data[startLine * samples], lineOffset, samples, layoutWidth()) != 0)
+    {
+        fprintf(stderr, "Memory allocation error.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    // "sketch": random-projection lower bounds shortlist the centroids compared exactly
+    const int sketchAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "sketch") == 0);
+    const int sketchDim = sketchDims(samples);
+    float *sketchRows = NULL, *dataSketch = NULL, *centroidSketch = NULL, *prevCentroids = NULL;
+    long sketchEvaluated = 0;
+    int sketchMismatches = 0;
+    if (sketchAssign)
+    {
+        // The sketch of the local rows is computed once and kept next to data
+        sketchRows = sketchBasis(samples, sketchDim);
+        dataSketch = malloc((long)lineOffset * sketchDim * sizeof(float));
+        centroidSketch = malloc((long)K * sketchDim * sizeof(float));
+        prevCentroids = malloc((long)K * samples * sizeof(float));
+        if (sketchRows == NULL || dataSketch == NULL || centroidSketch == NULL || prevCentroids == NULL)
+        {
+            fprintf(stderr, "Memory allocation error.\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        projectRows(&data[startLine * samples], lineOffset, sketchRows, samples, sketchDim, dataSketch);
+    }
+    // "index": search the nearest centroid in inverted lists of centroids rebuilt every iteration
+    const int indexAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "index") == 0);
+    CentroidIndex centroidIndex = { 0, 0, 0, 0.0f, NULL, NULL, NULL, NULL, NULL };
+    if (indexAssign && (initCentroidIndex(&centroidIndex, lineOffset, samples, K) != 0 ||
+                        (prevCentroids = malloc((long)K * samples * sizeof(float))) == NULL))
+    {
+        fprintf(stderr, "Memory allocation error.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
     MPI_CHECK_RETURN(MPI_Waitall(2, reqs, MPI_STATUS_IGNORE));
 
+    // KMEANS_MPI_PERSISTENT=1: collectives built once, only started and waited on in every iteration
+    const int persistentAsked = persistentRequested() && !sharedMemory;
+    const int persistent = persistentAsked &&
+                           initIterationCollectives(pointsPerClass, K, &changes, &maxDist, localAuxCentroids,
+                                                    auxCentroids, centroidsPerProcess, centroidsDispls,
+                                                    MPI_COMM_WORLD, &req, &reqs[0], &reqs[1], &reqs[2], &sumsReq);
+
+    const TileSizes tiles = chooseTileSizes(lineOffset, samples, K, OMP_NUM_THREADS);
+    const double initSeconds = MPI_Wtime() - start;
+
     # pragma omp parallel num_threads(OMP_NUM_THREADS) private(i, j, cluster, dist, minDist)
     {
+        const int thread = omp_get_thread_num();
+        int iteration;
+        double mark;
+
+        // Per-thread partial minimum of the points in the current block
+        float* tileMinDist = NULL;
+        int* tileCluster = NULL;
+        if (tiledAssign)
+        {
+            tileMinDist = malloc(tiles.pointTile * sizeof(float));
+            tileCluster = malloc(tiles.pointTile * sizeof(int));
+            if (tileMinDist == NULL || tileCluster == NULL)
+            {
+                fprintf(stderr, "Memory allocation error.\n");
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+        }
+
+        int groupCluster[AOSOA_MAX_WIDTH];
+        float* sketchBound = NULL;
+        float* indexListDist = NULL;
+        int* indexOrder = NULL;
+        if (indexAssign)
+        {
+            indexListDist = malloc(centroidIndex.lists * sizeof(float));
+            indexOrder = malloc(centroidIndex.lists * sizeof(int));
+            if (indexListDist == NULL || indexOrder == NULL)
+            {
+                fprintf(stderr, "Memory allocation error.\n");
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+        }
+        if (sketchAssign)
+        {
+            sketchBound = malloc(K * sizeof(float));
+            if (sketchBound == NULL)
+            {
+                fprintf(stderr, "Memory allocation error.\n");
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+        }
+
         do
         {
+            iteration = it;
+            mark = omp_get_wtime();
+            if (sketchAssign)
+            {
+                #pragma omp for
+                for (i = 0; i < K; i++)
+                {
+                    projectRow(&centroids[i * samples], sketchRows, samples, sketchDim, &centroidSketch[i * sketchDim]);
+                }
+            }
+
+            if (indexAssign)
+            {
+                buildCentroidIndex(&centroidIndex, centroids, K, samples);
+                calibrateCentroidIndex(&centroidIndex, &data[startLine * samples], lineOffset, centroids, K, samples, indexListDist);
+            }
+
             // 1. Assign each point to a class and count the elements in each class
-            #pragma omp for reduction(+:changes, pointsPerClass[:K])
-            for (i = 0; i < lineOffset; i++)
+            if (aosoaLayout)
+            {
+                #pragma omp for reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < layout.groups; i++)
+                {
+                    int count = groupSize(&layout, i);
+                    assignAoSoA(&layout, i, centroids, K, groupCluster);
+
+                    for (j = 0; j < count; j++)
+                    {
+                        cluster = groupCluster[j];
+                        if (localClassMap[i * layout.width + j] != cluster)
+                        {
+                            changes++;
+                            localClassMap[i * layout.width + j] = cluster;
+                        }
+                        pointsPerClass[cluster - 1]++;
+                    }
+                }
+            }
+            else if (sketchAssign)
+            {
+                #pragma omp for reduction(+:changes, pointsPerClass[:K], sketchEvaluated)
+                for (i = 0; i < lineOffset; i++)
+                {
+                    cluster = assignSketch(&data[(startLine + i) * samples], &dataSketch[i * sketchDim], centroids,
+                                           centroidSketch, K, samples, sketchDim, localClassMap[i], sketchBound,
+                                           &sketchEvaluated);
+                    if (localClassMap[i] != cluster)
+                    {
+                        changes++;
+                        localClassMap[i] = cluster;
+                    }
+
+                    pointsPerClass[cluster - 1]++;
+                }
+            }
+            else if (indexAssign)
             {
-                cluster = 1, minDist = FLT_MAX;
-                for (j = 0; j < K; j++)
+                #pragma omp for reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < lineOffset; i++)
                 {
-                    dist = euclideanDistance(&data[(startLine + i) * samples], &centroids[j * samples], samples);
+                    cluster = searchCentroidIndex(&centroidIndex, &data[(startLine + i) * samples], centroids, K,
+                                                  samples, localClassMap[i], indexListDist, indexOrder);
+                    if (localClassMap[i] != cluster)
+                    {
+                        changes++;
+                        localClassMap[i] = cluster;
+                    }
 
-                    if (dist < minDist)
+                    pointsPerClass[cluster - 1]++;
+                }
+            }
+            else if (pdsAssign)
+            {
+                #pragma omp for reduction(+:changes, pointsPerClass[:K], pdsEvaluated)
+                for (i = 0; i < lineOffset; i++)
+                {
+                    cluster = assignPDS(&data[(startLine + i) * samples], centroids, K, samples, localClassMap[i],
+                                        pdsOrder, &pdsEvaluated);
+                    if (localClassMap[i] != cluster)
                     {
-                        minDist = dist;
-                        cluster = j + 1;
+                        changes++;
+                        localClassMap[i] = cluster;
                     }
+
+                    pointsPerClass[cluster - 1]++;
                 }
-                if (localClassMap[i] != cluster)
+            }
+            else if (tiledAssign)
+            {
+                #pragma omp for reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < lineOffset; i += tiles.pointTile)
                 {
-                    changes++;
-                    localClassMap[i] = cluster;
+                    int count = MIN(tiles.pointTile, lineOffset - i);
+                    assignTiled(&data[(startLine + i) * samples], count, centroids, K, samples, tiles.centroidTile,
+                                tileMinDist, tileCluster);
+
+                    for (j = 0; j < count; j++)
+                    {
+                        if (localClassMap[i + j] != tileCluster[j])
+                        {
+                            changes++;
+                            localClassMap[i + j] = tileCluster[j];
+                        }
+                        pointsPerClass[tileCluster[j] - 1]++;
+                    }
                 }
+            }
+            else
+            {
+                #pragma omp for reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < lineOffset; i++)
+                {
+                    cluster = 1, minDist = FLT_MAX;
+                    for (j = 0; j < K; j++)
+                    {
+                        dist = euclideanDistance(&data[(startLine + i) * samples], &centroids[j * samples], samples);
+
+                        if (dist < minDist)
+                        {
+                            minDist = dist;
+                            cluster = j + 1;
+                        }
+                    }
+                    if (localClassMap[i] != cluster)
+                    {
+                        changes++;
+                        localClassMap[i] = cluster;
+                    }
 
-                pointsPerClass[cluster - 1]++;
+                    pointsPerClass[cluster - 1]++;
+                }
             }
+            tracePhase(traced, iteration, thread, PHASE_ASSIGN, &mark, omp_get_wtime());
 
-            # pragma omp single nowait
+            if (progressMode)
             {
-                MPI_CHECK_RETURN(
-                    MPI_Iallreduce(MPI_IN_PLACE, pointsPerClass, K, MPI_INT, MPI_SUM, MPI_COMM_WORLD, &req)
-                );
-                MPI_CHECK_RETURN(
-                    MPI_Iallreduce(MPI_IN_PLACE, &changes, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD, &reqs[0])
-                );
+                // Started by the master thread, the one that tests them
+                # pragma omp master
+                startCounts(persistent, pointsPerClass, K, &changes, &req, &reqs[0]);
+            }
+            else
+            {
+                # pragma omp single nowait
+                startCounts(persistent, pointsPerClass, K, &changes, &req, &reqs[0]);
             }
 
             // 2. Compute the coordinates mean of all the point in the same class
-            # pragma omp for reduction(+:localAuxCentroids[:K*samples])
-            for (i = 0; i < lineOffset; i++)
+            if (progressMode && aosoaLayout)
             {
-                cluster = localClassMap[i] - 1;
-                for (j = 0; j < samples; j++)
+                # pragma omp for reduction(+:localAuxCentroids[:K*samples]) schedule(dynamic, PROGRESS_ROWS)
+                for (i = 0; i < layout.groups; i++)
                 {
-                    localAuxCentroids[cluster * samples + j] += data[(startLine + i) * samples + j];
+                    if (omp_get_thread_num() == 0 && i % PROGRESS_ROWS == 0)
+                    {
+                        driveProgress(&req);
+                    }
+                    accumulateAoSoA(&layout, i, &localClassMap[i * layout.width], localAuxCentroids);
                 }
             }
+            else if (progressMode)
+            {
+                # pragma omp for reduction(+:localAuxCentroids[:K*samples]) schedule(dynamic, PROGRESS_ROWS)
+                for (i = 0; i < lineOffset; i++)
+                {
+                    if (omp_get_thread_num() == 0 && i % PROGRESS_ROWS == 0)
+                    {
+                        driveProgress(&req);
+                    }
+                    cluster = localClassMap[i] - 1;
+                    for (j = 0; j < samples; j++)
+                    {
+                        localAuxCentroids[cluster * samples + j] += data[(startLine + i) * samples + j];
+                    }
+                }
+            }
+            else if (aosoaLayout)
+            {
+                # pragma omp for reduction(+:localAuxCentroids[:K*samples])
+                for (i = 0; i < layout.groups; i++)
+                {
+                    accumulateAoSoA(&layout, i, &localClassMap[i * layout.width], localAuxCentroids);
+                }
+            }
+            else
+            {
+                # pragma omp for reduction(+:localAuxCentroids[:K*samples])
+                for (i = 0; i < lineOffset; i++)
+                {
+                    cluster = localClassMap[i] - 1;
+                    for (j = 0; j < samples; j++)
+                    {
+                        localAuxCentroids[cluster * samples + j] += data[(startLine + i) * samples + j];
+                    }
+                }
+            }
+            tracePhase(traced, iteration, thread, PHASE_ACCUMULATE, &mark, omp_get_wtime());
 
             #pragma omp single
             {
-                MPI_CHECK_RETURN(
-                    MPI_Allreduce(MPI_IN_PLACE, localAuxCentroids, K * samples, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD)
-                );
+                if (sharedMemory)
+                {
+                    // Nobody reads the whole centroids after this point until they are updated
+                    if (prevCentroids != NULL)
+                    {
+                        memcpy(prevCentroids, centroids, K * samples * sizeof(float));
+                    }
+                    // Sums of the node in the leader, then added by the leaders of all the nodes
+                    MPI_CHECK_RETURN(MPI_Reduce(localAuxCentroids, nodes.rank == 0 ? auxCentroids : NULL,
+                                                K * samples, MPI_FLOAT, MPI_SUM, 0, nodes.node));
+                    if (nodes.leaders != MPI_COMM_NULL)
+                    {
+                        MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, auxCentroids, K * samples, MPI_FLOAT, MPI_SUM,
+                                                       nodes.leaders));
+                    }
+                    nodeSync(centroidsWin, nodes.node);
+                }
+                else if (persistent)
+                {
+                    MPI_CHECK_RETURN(MPI_Start(&sumsReq));
+                    MPI_CHECK_RETURN(MPI_Wait(&sumsReq, MPI_STATUS_IGNORE));
+                }
+                else
+                {
+                    // Each process only receives the sums of the centroids it updates
+                    MPI_CHECK_RETURN(
+                        MPI_Reduce_scatter(localAuxCentroids, &auxCentroids[startCentroidPerSamples],
+                                           centroidsPerProcess, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD)
+                    );
+                }
                 MPI_CHECK_RETURN(MPI_Wait(&req, MPI_STATUS_IGNORE));
             }
 
@@ -478,39 +728,77 @@ int main(int argc, char* argv[])
                 cluster = startCentroid + i;
                 for (j = 0; j < samples; j++)
                 {
-                    localAuxCentroids[cluster * samples + j] /= pointsPerClass[cluster];
+                    auxCentroids[cluster * samples + j] /= pointsPerClass[cluster];
                 }
             }
+            tracePhase(traced, iteration, thread, PHASE_REDUCE, &mark, omp_get_wtime());
 
-            # pragma omp single nowait
+            if (progressMode)
+            {
+                # pragma omp master
+                startGather(persistent, sharedMemory, auxCentroids, centroidOffsetPerSamples, centroidsPerProcess,
+                            centroidsDispls, &reqs[2]);
+            }
+            else
             {
-                MPI_CHECK_RETURN(MPI_Iallgatherv(
-                    localAuxCentroids + startCentroid * samples, centroidOffsetPerSamples, MPI_FLOAT,
-                    auxCentroids, centroidsPerProcess, centroidsDispls,
-                    MPI_FLOAT, MPI_COMM_WORLD, &reqs[2]));
+                # pragma omp single nowait
+                startGather(persistent, sharedMemory, auxCentroids, centroidOffsetPerSamples, centroidsPerProcess,
+                            centroidsDispls, &reqs[2]);
             }
 
             // 3. Compute the maximum movement of a centroid compared to its previous position
-            # pragma omp for reduction(max:maxDist)
-            for (i = 0; i < centroidOffset; i++)
+            if (progressMode && !sharedMemory)
             {
-                dist = euclideanDistance(
-                    &centroids[(startCentroid + i) * samples],
-                    &localAuxCentroids[(startCentroid + i) * samples],
-                    samples
-                );
-
-                if (dist > maxDist)
+                # pragma omp for reduction(max:maxDist) schedule(dynamic, PROGRESS_ROWS)
+                for (i = 0; i < centroidOffset; i++)
                 {
-                    maxDist = dist;
+                    if (omp_get_thread_num() == 0 && i % PROGRESS_ROWS == 0)
+                    {
+                        driveProgress(&reqs[2]);
+                    }
+                    dist = euclideanDistance(&centroids[(startCentroid + i) * samples],
+                                             &auxCentroids[(startCentroid + i) * samples], samples);
+                    if (dist > maxDist)
+                    {
+                        maxDist = dist;
+                    }
+                }
+            }
+            else
+            {
+                # pragma omp for reduction(max:maxDist)
+                for (i = 0; i < centroidOffset; i++)
+                {
+                    dist = euclideanDistance(
+                        &centroids[(startCentroid + i) * samples],
+                        &auxCentroids[(startCentroid + i) * samples],
+                        samples
+                    );
+
+                    if (dist > maxDist)
+                    {
+                        maxDist = dist;
+                    }
+                    if (sharedMemory)
+                    {
+                        memcpy(&centroids[(startCentroid + i) * samples],
+                               &auxCentroids[(startCentroid + i) * samples], samples * sizeof(float));
+                    }
                 }
             }
 
             #pragma omp single
             {
-                MPI_CHECK_RETURN(
-                    MPI_Iallreduce(MPI_IN_PLACE, &maxDist, 1, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD, &reqs[1])
-                );
+                if (persistent)
+                {
+                    MPI_CHECK_RETURN(MPI_Start(&reqs[1]));
+                }
+                else
+                {
+                    MPI_CHECK_RETURN(
+                        MPI_Iallreduce(MPI_IN_PLACE, &maxDist, 1, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD, &reqs[1])
+                    );
+                }
 
                 memset(pointsPerClass, 0, K * sizeof(int));
                 memset(localAuxCentroids, 0.0, K * samples * sizeof(float));
@@ -520,8 +808,8 @@ int main(int argc, char* argv[])
                 #ifdef DEBUG
                 if(rank == 0)
                 {
-                    sprintf(line, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", it, changes, maxDist);
-                    outputMsg = strcat(outputMsg, line);
+                    appendLog(&outputMsg, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", it, changes,
+                              maxDist);
                 }
                 #endif
 
@@ -530,13 +818,53 @@ int main(int argc, char* argv[])
                 maxDist = FLT_MIN;
                 it++;
 
-                MPI_CHECK_RETURN(MPI_Wait(&reqs[2], MPI_STATUS_IGNORE));
-                memcpy(centroids, auxCentroids, K * samples * sizeof(float));
+                if (sharedMemory)
+                {
+                    // Every part of the centroids is updated before the next assignment
+                    nodeSync(centroidsWin, nodes.node);
+                }
+                else
+                {
+                    MPI_CHECK_RETURN(MPI_Wait(&reqs[2], MPI_STATUS_IGNORE));
+                    if (prevCentroids != NULL)
+                    {
+                        memcpy(prevCentroids, centroids, K * samples * sizeof(float));
+                    }
+                    memcpy(centroids, auxCentroids, K * samples * sizeof(float));
+                }
             }
+            tracePhase(traced, iteration, thread, PHASE_CONVERGE, &mark, omp_get_wtime());
         }
         while (anotherIteration);
+
+        free(tileMinDist);
+        free(tileCluster);
+        free(sketchBound);
+        free(indexListDist);
+        free(indexOrder);
     }
     it--;
+    trace.recorded = it;
+    if (persistent)
+    {
+        freeIterationCollectives(&req, &reqs[0], &reqs[1], &reqs[2], &sumsReq);
+    }
+
+    // Verification pass: the labels must be the ones of a brute-force assignment to the last centroids used
+    if (sketchAssign)
+    {
+        #pragma omp parallel for num_threads(OMP_NUM_THREADS) private(cluster) reduction(+:sketchMismatches)
+        for (i = 0; i < lineOffset; i++)
+        {
+            cluster = assignExact(&data[(startLine + i) * samples], prevCentroids, K, samples);
+            if (localClassMap[i] != cluster)
+            {
+                localClassMap[i] = cluster;
+                sketchMismatches++;
+            }
+        }
+    }
+
     // 5. Gather to the root process all the information that will be written in the output file
     MPI_CHECK_RETURN(MPI_Waitall(2, workSplit, MPI_STATUS_IGNORE));
     MPI_CHECK_RETURN(MPI_Igatherv(
@@ -549,12 +877,65 @@ int main(int argc, char* argv[])
     end = MPI_Wtime();
     localTime = end - start;
     MPI_Reduce(&localTime, &globalTime, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    #ifdef DEBUG
+    // Final-assignment recall: labels compared with a brute-force assignment to the centroids of the last iteration
+    int indexMismatches = 0, globalIndexMismatches = 0;
+    if (indexAssign)
+    {
+        #pragma omp parallel for num_threads(OMP_NUM_THREADS) reduction(+:indexMismatches)
+        for (i = 0; i < lineOffset; i++)
+        {
+            if (assignExact(&data[(startLine + i) * samples], prevCentroids, K, samples) != localClassMap[i])
+            {
+                indexMismatches++;
+            }
+        }
+    }
+    MPI_Reduce(&indexMismatches, &globalIndexMismatches, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    long globalEvaluated = 0;
+    MPI_Reduce(&pdsEvaluated, &globalEvaluated, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    long globalSketchEvaluated = 0;
+    int globalMismatches = 0;
+    MPI_Reduce(&sketchEvaluated, &globalSketchEvaluated, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&sketchMismatches, &globalMismatches, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    #endif
     if (rank == 0)
     {
         #ifdef DEBUG
         // Print to stdout all the info about this run
-        printf("%s", outputMsg);
+        printf("%s", logText(&outputMsg));
         printf("\nComputation: %f seconds", globalTime);
+        if (persistentAsked)
+        {
+            printf("\nPersistent collectives: %s", persistent ? "used" : "not supported, non-blocking calls used");
+        }
+        if (sharedMemory)
+        {
+            // Ring estimate of the bytes sent by each node leader: allreduce of K x samples floats
+            printf("\nCentroid update traffic: %.0f bytes per node leader per iteration, %d nodes",
+                   2.0 * (nodes.nodes - 1) / nodes.nodes * K * samples * sizeof(float), nodes.nodes);
+        }
+        else
+        {
+            // Ring estimate of the bytes sent by each process: reduce-scatter and allgather of K x samples floats
+            printf("\nCentroid update traffic: %.0f bytes per process per iteration",
+                   2.0 * (size - 1) / size * K * samples * sizeof(float));
+        }
+        if (indexAssign)
+        {
+            printf("\nCentroid index: %d lists, %d probes on rank 0, final-assignment recall %.4f%%",
+                   centroidIndex.lists, centroidIndex.probes, 100.0 - 100.0 * globalIndexMismatches / lines);
+        }
+        if (pdsAssign)
+        {
+            printf("\nPartial distance search: %.2f%% of distance FLOPs avoided",
+                   100.0 * (1.0 - (double)globalEvaluated / ((double)it * lines * K * samples)));
+        }
+        if (sketchAssign)
+        {
+            printf("\nRandom projection: %.2f%% of exact distances avoided, %d labels fixed by verification",
+                   100.0 * (1.0 - (double)globalSketchEvaluated / ((double)it * lines * K)), globalMismatches);
+        }
         if (changes <= minChanges)
         {
             printf("\n\nTermination condition:\nMinimum number of changes reached: %d [%d]", changes, minChanges);
@@ -567,7 +948,7 @@ int main(int argc, char* argv[])
         {
             printf("\n\nTermination condition:\nCentroid update precision reached: %g [%g]", maxDist, maxThreshold);
         }
-        free(outputMsg);
+        free(outputMsg.text);
         #else
         printf("%f", globalTime);
         #endif
@@ -594,21 +975,53 @@ int main(int argc, char* argv[])
         free(displacementPerProcess);
         free(classMap);
     }
+    if (traceFile != NULL)
+    {
+        trace.seconds[PHASE_LOAD] = loadSeconds;
+        trace.seconds[PHASE_INIT] = initSeconds;
+        trace.seconds[PHASE_WRITE] = MPI_Wtime() - start;
+        error = gatherTrace(&trace, traceFile);
+        if (error == -3)
+        {
+            showFileError(error, (char*)traceFile);
+        }
+        else if (error == -4)
+        {
+            fprintf(stderr, "Memory allocation error.\n");
+        }
+        freeTrace(&trace);
+    }
 
     //Free memory
+    free(pdsOrder);
+    free(sketchRows);
+    free(dataSketch);
+    free(centroidSketch);
+    free(prevCentroids);
+    freeCentroidIndex(&centroidIndex);
     free(centroidsPerProcess);
     free(centroidsDispls);
     free(pointsPerClass);
-    free(auxCentroids);
     free(localAuxCentroids);
     free(localClassMap);
-    free(data);
+    freeAoSoA(&layout);
+    if (sharedMemory)
+    {
+        freeShared(&dataWin);
+        freeShared(&centroidsWin);
+        freeNodes(&nodes);
+    }
+    else
+    {
+        free(data);
+        free(centroids);
+        free(auxCentroids);
+        MPI_Request_free(&reqs[2]);
+    }
     free(centroidPos);
-    free(centroids);
     MPI_Request_free(&req);
     MPI_Request_free(&reqs[0]);
     MPI_Request_free(&reqs[1]);
-    MPI_Request_free(&reqs[2]);
     MPI_Request_free(&workSplit[0]);
     MPI_Request_free(&workSplit[1]);
     //END CLOCK*****************************************
@@ -22,14 +22,24 @@
 #include <string.h>
 #include <float.h>
 #include <mpi.h>
+#include "kmeans_common.h"
+#include "kmeans_tiling.h"
+#include "kmeans_layout.h"
+#include "kmeans_pds.h"
+#include "kmeans_sketch.h"
+#include "kmeans_index.h"
 
-#define MAXLINE 2000
-#define MAXCAD 200
 
 //Macros
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 
+// Rebalancing: iterations the straggler gap must last, iterations without a new split after one, and
+// smallest move of a row boundary worth migrating, as a fraction of the rows of a process
+#define REBALANCE_PERSIST 3
+#define REBALANCE_COOLDOWN 5
+#define REBALANCE_MIN_MOVE 0.02
+
 #define MPI_CHECK_RETURN(value){            \
     if(value != MPI_SUCCESS){               \
         char error_str[100];                \
@@ -39,153 +49,1765 @@
         MPI_Abort( MPI_COMM_WORLD, EXIT_FAILURE );                              \
     }       \
 }
-/* 
-Function showFileError: It displays the corresponding error during file reading.
+
+#include "kmeans_shared.h"
+#include "kmeans_persistent.h"
+#include "kmeans_compress.h"
+#include "kmeans_ring.h"
+#include "kmeans_stale.h"
+#include "kmeans_trace.h"
+#include "kmeans_perf.h"
+
+
+/*
+ * Input rows shared by all the clusterings of a run, split among the processes of a communicator,
+ * with the structures derived from them
+ */
+typedef struct
+{
+    const float* data;            // lines x samples input rows, loaded by every process
+    int lines;
+    int samples;
+    MPI_Comm comm;                // processes that cooperate in a clustering
+    int rank;
+    int size;
+    int startLine;                // first row of this process
+    int lineOffset;               // number of rows of this process
+    int* linesPerProcess;         // rows of each process, only on the root
+    int* displacementPerProcess;  // first row of each process, only on the root
+    int aosoaLayout;              // KMEANS_LAYOUT=aosoa
+    int tiledAssign;              // KMEANS_ASSIGN=tiled
+    int pdsAssign;                // KMEANS_ASSIGN=pds
+    int sketchAssign;             // KMEANS_ASSIGN=sketch
+    int indexAssign;              // KMEANS_ASSIGN=index
+    AoSoAData layout;             // blocked copy of the local rows
+    int* pdsOrder;                // dimensions sorted by decreasing variance, or NULL
+    float* sketchRows;            // sketchDim x samples projection basis
+    float* dataSketch;            // lineOffset x sketchDim projection of the local rows
+    int sketchDim;
+    int chunks;                   // blocks of centroids whose sums are reduced while the next ones are accumulated
+    NodeComms nodes;              // KMEANS_MPI_SHARED=1: centroids shared by the processes of each node
+    float rebalance;              // straggler gap, relative to the slowest process, that moves rows (0: never)
+    int persistent;               // KMEANS_MPI_PERSISTENT=1: persistent collectives when the library has them
+    int compress;                 // KMEANS_MPI_COMPRESS: encoding of the reduced sums (COMPRESS_*)
+    int compressVerify;           // KMEANS_MPI_COMPRESS_VERIFY=1: also reduce the exact sums and measure the drift
+    int sharded;                  // KMEANS_MPI_SHARDED=1: each process keeps a shard of the centroids
+    int staleness;                // KMEANS_MPI_STALENESS: iterations a process may run ahead of the slowest
+    MPI_Win staleWin;             // with staleness, the window of MPI_COMM_WORLD the models are attached to
+} KMeansInput;
+
+/*
+ * Outcome of one clustering. Counters are the totals of all the processes, only valid on the root.
+ */
+typedef struct
+{
+    int iterations;
+    int changes;          // class changes left when the loop stopped
+    float maxDist;        // centroid movement left when the loop stopped
+    double inertia;       // sum of the squared distances of the points to the centroid of their class
+    long pdsEvaluated;
+    long sketchEvaluated;
+    int sketchMismatches;
+    int indexLists;
+    int indexProbes;      // probes chosen by the root
+    int indexMismatches;  // labels that differ from a brute-force assignment to the last centroids
+    int lloydMismatches;  // labels that differ from exact Lloyd (KMEANS_INDEX_REFERENCE), -1 when not compared
+    int restart;          // restart that produced the result
+    double reduceWait;    // seconds spent waiting for the reduction of the sums (maximum over the processes)
+    int rebalances;       // times the rows were split again among the processes
+    double gapBefore;     // mean straggler gap (slowest - fastest local work) before the first rebalance
+    double gapAfter;      // mean straggler gap after the last rebalance
+    int gapIterations;    // iterations after the last rebalance
+    int persistent;       // the iterations used persistent collectives
+    double compressBytes; // estimated bytes sent per process and iteration by the compressed reduction
+    float drift;          // largest difference between the compressed and the exact centroids
+} KMeansRun;
+
+/*
+Function prepareInput: Splits the rows among the processes of comm, reads the assignment options
+and builds the structures that only depend on the local rows. With bounded staleness it is also
+collective on MPI_COMM_WORLD, every process calling it with its own comm.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+int prepareInput(KMeansInput* in, const float* data, int lines, int samples, MPI_Comm comm)
+{
+    in->data = data;
+    in->lines = lines;
+    in->samples = samples;
+    in->comm = comm;
+    MPI_Comm_rank(comm, &in->rank);
+    MPI_Comm_size(comm, &in->size);
+
+    // Each process calculates its work split for lines
+    int workPerProcess = (lines / in->size), workReminder = (lines % in->size);
+    in->startLine = in->rank * workPerProcess;
+    in->lineOffset = workPerProcess;
+    if (in->rank < workReminder)
+    {
+        in->startLine += in->rank;
+        in->lineOffset++;
+    }
+    else
+    {
+        in->startLine += workReminder;
+    }
+
+    // Only the root process needs to know how lines are divided across the processes
+    in->linesPerProcess = NULL;
+    in->displacementPerProcess = NULL;
+    if (in->rank == 0)
+    {
+        in->linesPerProcess = calloc(in->size, sizeof(int));
+        in->displacementPerProcess = calloc(in->size, sizeof(int));
+        if (in->linesPerProcess == NULL || in->displacementPerProcess == NULL)
+        {
+            return -4;
+        }
+    }
+    MPI_CHECK_RETURN(
+        MPI_Gather(&in->startLine, 1, MPI_INT, in->displacementPerProcess, 1, MPI_INT, 0, comm)
+    )
+    MPI_CHECK_RETURN(
+        MPI_Gather(&in->lineOffset, 1, MPI_INT, in->linesPerProcess, 1, MPI_INT, 0, comm)
+    )
+
+    const float* localData = &data[in->startLine * samples];
+
+    // Sharded centroids and bounded staleness use the plain assignment and their own reductions
+    in->sharded = shardedRequested();
+    const char* RAW_KMEANS_MPI_STALENESS = getenv("KMEANS_MPI_STALENESS");
+    in->staleness = (!in->sharded && RAW_KMEANS_MPI_STALENESS != NULL && atoi(RAW_KMEANS_MPI_STALENESS) > 0)
+                    ? atoi(RAW_KMEANS_MPI_STALENESS) : 0;
+    // One window of all the processes: the windows of the groups of one split would share the context
+    // id of their communicators, and with it the backing file of Open MPI 4
+    in->staleWin = MPI_WIN_NULL;
+    if (in->staleness > 0)
+    {
+        openStaleWindow(&in->staleWin);
+    }
+    const int plainAssign = in->sharded || in->staleness > 0;
+
+    // Optional blocked copy of the local rows: groups of points interleaved per dimension
+    const char* RAW_KMEANS_LAYOUT = getenv("KMEANS_LAYOUT");
+    in->aosoaLayout = !plainAssign && (RAW_KMEANS_LAYOUT != NULL) && (strcmp(RAW_KMEANS_LAYOUT, "aosoa") == 0);
+    in->layout = (AoSoAData){ NULL, 0, 0, 0, 0, 0 };
+    if (in->aosoaLayout && buildAoSoA(&in->layout, localData, in->lineOffset, samples, layoutWidth()) != 0)
+    {
+        return -4;
+    }
+
+    // Assignment kernel: default one centroid at a time, "tiled" for blocks of points x blocks of centroids
+    const char* RAW_KMEANS_ASSIGN = plainAssign ? NULL : getenv("KMEANS_ASSIGN");
+    in->tiledAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "tiled") == 0);
+    // "pds": partial distance search, optionally over the dimensions sorted by variance
+    in->pdsAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "pds") == 0);
+    const char* RAW_KMEANS_PDS_ORDER = getenv("KMEANS_PDS_ORDER");
+    in->pdsOrder = NULL;
+    if (in->pdsAssign && RAW_KMEANS_PDS_ORDER != NULL && strcmp(RAW_KMEANS_PDS_ORDER, "variance") == 0)
+    {
+        in->pdsOrder = varianceOrder(data, lines, samples);
+        if (in->pdsOrder == NULL)
+        {
+            return -4;
+        }
+    }
+    // "sketch": random-projection lower bounds shortlist the centroids compared exactly
+    in->sketchAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "sketch") == 0);
+    in->sketchDim = sketchDims(samples);
+    in->sketchRows = NULL;
+    in->dataSketch = NULL;
+    if (in->sketchAssign)
+    {
+        // The sketch of the local rows is computed once and kept next to data
+        in->sketchRows = sketchBasis(samples, in->sketchDim);
+        in->dataSketch = malloc((long)in->lineOffset * in->sketchDim * sizeof(float));
+        if (in->sketchRows == NULL || in->dataSketch == NULL)
+        {
+            return -4;
+        }
+        projectRows(localData, in->lineOffset, in->sketchRows, samples, in->sketchDim, in->dataSketch);
+    }
+    // "index": search the nearest centroid in inverted lists of centroids rebuilt every iteration
+    in->indexAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "index") == 0);
+
+    // Pipelined reduction of the sums in blocks of centroids
+    const char* RAW_KMEANS_MPI_CHUNKS = getenv("KMEANS_MPI_CHUNKS");
+    in->chunks = (RAW_KMEANS_MPI_CHUNKS != NULL && atoi(RAW_KMEANS_MPI_CHUNKS) > 1) ? atoi(RAW_KMEANS_MPI_CHUNKS) : 1;
+
+    // Rows moved between processes when their local work times differ by more than this fraction.
+    // The blocked copy and the sketch are built once for the initial rows, they stay static.
+    const char* RAW_KMEANS_MPI_REBALANCE = getenv("KMEANS_MPI_REBALANCE");
+    in->rebalance = (RAW_KMEANS_MPI_REBALANCE != NULL) ? atof(RAW_KMEANS_MPI_REBALANCE) : 0.0f;
+    if (in->rebalance < 0.0f || in->aosoaLayout || in->sketchAssign || lines < in->size)
+    {
+        in->rebalance = 0.0f;
+    }
+
+    in->persistent = persistentRequested();
+
+    // Compressed sums replace the pipelined reduction; delta encoding needs the rows to stay put
+    in->compress = compressMode();
+    const char* RAW_KMEANS_MPI_COMPRESS_VERIFY = getenv("KMEANS_MPI_COMPRESS_VERIFY");
+    in->compressVerify = RAW_KMEANS_MPI_COMPRESS_VERIFY != NULL && atoi(RAW_KMEANS_MPI_COMPRESS_VERIFY) == 1;
+    if (in->compress != COMPRESS_NONE)
+    {
+        in->chunks = 1;
+    }
+    if (in->compress == COMPRESS_DELTA)
+    {
+        in->rebalance = 0.0f;
+    }
+    if (plainAssign)
+    {
+        in->chunks = 1;
+        in->rebalance = 0.0f;
+        in->persistent = 0;
+        in->compress = COMPRESS_NONE;
+    }
+
+    // One copy of the centroids and of their sums per node
+    in->nodes = (NodeComms)NO_NODE_COMMS;
+    if (sharedMemoryRequested() && !plainAssign)
+    {
+        splitNodes(comm, &in->nodes);
+    }
+
+    return 0;
+}
+
+/*
+Function freeInput: Releases the structures built by prepareInput, collectively on MPI_COMM_WORLD
+with bounded staleness.
+*/
+void freeInput(KMeansInput* in)
+{
+    free(in->linesPerProcess);
+    free(in->displacementPerProcess);
+    freeAoSoA(&in->layout);
+    free(in->pdsOrder);
+    free(in->sketchRows);
+    free(in->dataSketch);
+    freeNodes(&in->nodes);
+    if (in->staleWin != MPI_WIN_NULL)
+    {
+        MPI_CHECK_RETURN(MPI_Win_free(&in->staleWin));
+    }
+}
+
+/*
+Function splitBySpeed: New row boundaries (size + 1 entries) giving each process a number of rows
+proportional to the rows per second it processed in the last iterations (times: their sum for
+every process, all of them with the rows of split), at least one each.
+*/
+void splitBySpeed(const double* times, const int* split, int size, int* newSplit)
+{
+    double total = 0.0, acc = 0.0;
+    int r, lines = split[size];
+
+    for (r = 0; r < size; r++)
+    {
+        total += (split[r + 1] - split[r]) / MAX(times[r], 1e-9);
+    }
+    newSplit[0] = 0;
+    for (r = 0; r < size - 1; r++)
+    {
+        acc += (split[r + 1] - split[r]) / MAX(times[r], 1e-9);
+        newSplit[r + 1] = MIN(MAX((int)(lines * acc / total + 0.5), newSplit[r] + 1), lines - (size - 1 - r));
+    }
+    newSplit[size] = lines;
+}
+
+/*
+Function migrateRows: Moves the classes of the rows that change process from split to newSplit.
+The ranges stay in rank order, so rows only move between neighbouring processes.
+counts is scratch space for 4 * size ints. Returns the new localClassMap (the old one is
+released) or NULL if the memory could not be allocated.
 */
-void showFileError(int error, char* filename)
+int* migrateRows(int* localClassMap, const int* split, const int* newSplit, int rank, int size, MPI_Comm comm,
+                 int* counts)
 {
-    printf("Error\n");
-    switch (error)
-    {
-    case -1:
-        fprintf(stderr, "\tFile %s has too many columns.\n", filename);
-        fprintf(stderr, "\tThe maximum number of columns has been exceeded. MAXLINE: %d.\n", MAXLINE);
-        break;
-    case -2:
-        fprintf(stderr, "Error reading file: %s.\n", filename);
-        break;
-    case -3:
-        fprintf(stderr, "Error writing file: %s.\n", filename);
-        break;
-    }
-    fflush(stderr);
+    int *sendCounts = counts, *sendDispls = counts + size, *recvCounts = counts + 2 * size;
+    int *recvDispls = counts + 3 * size;
+    int r, low, high;
+    int* newClassMap = malloc(MAX(newSplit[rank + 1] - newSplit[rank], 1) * sizeof(int));
+    if (newClassMap == NULL)
+    {
+        return NULL;
+    }
+
+    for (r = 0; r < size; r++)
+    {
+        low = MAX(split[rank], newSplit[r]);
+        high = MIN(split[rank + 1], newSplit[r + 1]);
+        sendCounts[r] = MAX(high - low, 0);
+        sendDispls[r] = sendCounts[r] > 0 ? low - split[rank] : 0;
+        low = MAX(split[r], newSplit[rank]);
+        high = MIN(split[r + 1], newSplit[rank + 1]);
+        recvCounts[r] = MAX(high - low, 0);
+        recvDispls[r] = recvCounts[r] > 0 ? low - newSplit[rank] : 0;
+    }
+    MPI_CHECK_RETURN(MPI_Alltoallv(localClassMap, sendCounts, sendDispls, MPI_INT, newClassMap, recvCounts,
+                                   recvDispls, MPI_INT, comm));
+    free(localClassMap);
+    return newClassMap;
 }
 
 /*
-Function readInput: It reads the file to determine the number of rows and columns.
+Function kmeansFitSharded: kmeansFit with the centroids split among the processes (KMEANS_MPI_SHARDED=1).
+Every process keeps its shard of the centroids and of their sums, plus the shard in transit. The
+shards go round the ring once for the assignment, every row keeping the nearest centroid seen so
+far, and once more for the sums. centroids is only used on the root, the other processes may pass
+NULL: the initial centroids are scattered from it and the final ones gathered into it. The inertia
+of the final centroids is added up in one more round of the ring.
+Returns 0 on success and -4 if the memory could not be allocated.
 */
-int readInput(char* filename, int* lines, int* samples)
+int kmeansFitSharded(const KMeansInput* in, int K, float* centroids, int* classMap, int maxIterations,
+                     int minChanges, float maxThreshold, KMeansLog* outputMsg, PhaseTrace* trace, PerfCounters* perf,
+                     KMeansRun* run)
 {
-    FILE* fp;
-    char line[MAXLINE] = "";
-    char* ptr;
-    const char* delim = "\t";
-    int contlines, contsamples = 0;
+    const float* data = in->data;
+    const MPI_Comm comm = in->comm;
+    const int samples = in->samples, size = in->size, rank = in->rank;
+    const int startLine = in->startLine, lineOffset = in->lineOffset;
+    const int next = (rank + 1) % size, previous = (rank + size - 1) % size;
+    double reduceWait = 0.0, waitStart, mark;
+    float_t dist, maxDist = FLT_MIN, lastMaxDist = FLT_MIN;
+    int it = 1, changes = 0, lastChanges = 0, anotherIteration = 0;
+    int cluster, origin, i, j, s;
+    MPI_Request ringReqs[2], countsReq, changesReq;
+
+    // shardStart / shardSize: first centroid and number of centroids of each process
+    // shardFloats / shardDispls: the same in floats, for the final gather
+    int* shardStart = malloc(size * sizeof(int));
+    int* shardSize = malloc(size * sizeof(int));
+    int* shardFloats = malloc(size * sizeof(int));
+    int* shardDispls = malloc(size * sizeof(int));
+    if (shardStart == NULL || shardSize == NULL || shardFloats == NULL || shardDispls == NULL)
+    {
+        return -4;
+    }
+    splitShards(K, size, shardStart, shardSize);
+    for (i = 0; i < size; i++)
+    {
+        shardFloats[i] = shardSize[i] * samples;
+        shardDispls[i] = shardStart[i] * samples;
+    }
+    // The first process has the largest shard
+    const long blockSize = MAX((long)shardFloats[0], 1);
+    const int ownedCentroids = shardSize[rank];
 
-    contlines = 0;
+    // shard: owned centroids; blocks: two shards in transit in the assignment
+    // sums: partial sums in transit (two) and the contribution of this process being added
+    float* shard = malloc(blockSize * sizeof(float));
+    float* blocks = malloc(2 * blockSize * sizeof(float));
+    float* sums = malloc(3 * blockSize * sizeof(float));
+    int* pointsPerClass = calloc(K, sizeof(int));
+    int* shardCounts = malloc(MAX(ownedCentroids, 1) * sizeof(int));
+    float* rowMinDist = malloc(MAX(lineOffset, 1) * sizeof(float));
+    int* rowCluster = malloc(MAX(lineOffset, 1) * sizeof(int));
+    int* localClassMap = calloc(MAX(lineOffset, 1), sizeof(int));
+    if (shard == NULL || blocks == NULL || sums == NULL || pointsPerClass == NULL || shardCounts == NULL ||
+        rowMinDist == NULL || rowCluster == NULL || localClassMap == NULL)
+    {
+        return -4;
+    }
+    MPI_CHECK_RETURN(MPI_Scatterv(centroids, shardFloats, shardDispls, MPI_FLOAT, shard, shardFloats[rank],
+                                  MPI_FLOAT, 0, comm));
+    const float* localData = &data[(long)startLine * samples];
+    if (perf != NULL)
+    {
+        perfOpen(perf, MPI_Wtime());
+    }
 
-    if ((fp = fopen(filename, "r")) != NULL)
+    do
     {
-        while (fgets(line, MAXLINE, fp) != NULL)
+        mark = MPI_Wtime();
+
+        // 1. Assignment: at step s this process holds the shard of process rank - s and receives the next one
+        for (i = 0; i < lineOffset; i++)
+        {
+            rowMinDist[i] = FLT_MAX;
+            rowCluster[i] = 1;
+        }
+        const float* current = shard;
+        for (s = 0; s < size; s++)
         {
-            if (strchr(line, '\n') == NULL)
+            origin = (rank - s + size) % size;
+            float* incoming = &blocks[(s % 2) * blockSize];
+            if (s < size - 1)
+            {
+                ringShift(current, shardFloats[origin], incoming, shardFloats[(origin + size - 1) % size], previous,
+                          next, comm, ringReqs);
+            }
+            for (i = 0; i < lineOffset; i++)
             {
-                return -1;
+                for (j = 0; j < shardSize[origin]; j++)
+                {
+                    dist = euclideanDistance(&localData[(long)i * samples], &current[j * samples], samples);
+                    cluster = shardStart[origin] + j + 1;
+                    // Equal distances keep the lowest class, as the full loop over the centroids does
+                    if (dist < rowMinDist[i] || (dist == rowMinDist[i] && cluster < rowCluster[i]))
+                    {
+                        rowMinDist[i] = dist;
+                        rowCluster[i] = cluster;
+                    }
+                }
             }
-            contlines++;
-            ptr = strtok(line, delim);
-            contsamples = 0;
-            while (ptr != NULL)
+            if (s < size - 1)
             {
-                contsamples++;
-                ptr = strtok(NULL, delim);
+                waitStart = MPI_Wtime();
+                MPI_CHECK_RETURN(MPI_Waitall(2, ringReqs, MPI_STATUSES_IGNORE));
+                reduceWait += MPI_Wtime() - waitStart;
+                current = incoming;
             }
         }
-        fclose(fp);
-        *lines = contlines;
-        *samples = contsamples;
-        return 0;
+        for (i = 0; i < lineOffset; i++)
+        {
+            if (localClassMap[i] != rowCluster[i])
+            {
+                changes++;
+                localClassMap[i] = rowCluster[i];
+            }
+            pointsPerClass[rowCluster[i] - 1]++;
+        }
+        MPI_CHECK_RETURN(MPI_Ireduce_scatter(pointsPerClass, shardCounts, shardSize, MPI_INT, MPI_SUM, comm,
+                                             &countsReq));
+        MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, &changes, 1, MPI_INT, MPI_SUM, comm, &changesReq));
+        tracePhase(trace, it, 0, PHASE_ASSIGN, &mark, MPI_Wtime());
+        perfPhase(perf, PERF_ASSIGN, mark);
+
+        // 2. Sums: at step s the partial sums of the shard of process rank - s - 2 arrive, while the
+        // rows of this process in that shard are added up
+        float *partial = sums, *incoming = &sums[blockSize], *contribution = &sums[2 * blockSize];
+        origin = (rank + size - 1) % size;
+        shardSums(localData, localClassMap, lineOffset, samples, shardStart[origin], shardSize[origin], partial);
+        for (s = 0; s < size - 1; s++)
+        {
+            origin = (rank - s - 2 + 2 * size) % size;
+            ringShift(partial, shardFloats[(origin + 1) % size], incoming, shardFloats[origin], previous, next, comm,
+                      ringReqs);
+            shardSums(localData, localClassMap, lineOffset, samples, shardStart[origin], shardSize[origin],
+                      contribution);
+            waitStart = MPI_Wtime();
+            MPI_CHECK_RETURN(MPI_Waitall(2, ringReqs, MPI_STATUSES_IGNORE));
+            reduceWait += MPI_Wtime() - waitStart;
+            for (j = 0; j < shardFloats[origin]; j++)
+            {
+                incoming[j] += contribution[j];
+            }
+            float* sent = partial;
+            partial = incoming;
+            incoming = sent;
+        }
+        // The sums travel with the ring, so the shards are reduced while they are accumulated
+        tracePhase(trace, it, 0, PHASE_ACCUMULATE, &mark, MPI_Wtime());
+        MPI_CHECK_RETURN(MPI_Wait(&countsReq, MPI_STATUS_IGNORE));
+
+        // 3. New owned centroids and the maximum movement of a centroid
+        for (i = 0; i < ownedCentroids; i++)
+        {
+            for (j = 0; j < samples; j++)
+            {
+                partial[i * samples + j] /= shardCounts[i];
+            }
+            dist = euclideanDistance(&shard[i * samples], &partial[i * samples], samples);
+            if (dist > maxDist)
+            {
+                maxDist = dist;
+            }
+        }
+        tracePhase(trace, it, 0, PHASE_REDUCE, &mark, MPI_Wtime());
+        memcpy(shard, partial, shardFloats[rank] * sizeof(float));
+        MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, &maxDist, 1, MPI_FLOAT, MPI_MAX, comm));
+        MPI_CHECK_RETURN(MPI_Wait(&changesReq, MPI_STATUS_IGNORE));
+        memset(pointsPerClass, 0, K * sizeof(int));
+
+        #ifdef DEBUG
+            if(outputMsg != NULL)
+            {
+                appendLog(outputMsg, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", it, changes, maxDist);
+            }
+        #endif
+
+        anotherIteration = (changes > minChanges) && (it < maxIterations) && (maxDist > maxThreshold);
+        // Kept for the result, the reduction variables start again from zero
+        lastChanges = changes;
+        lastMaxDist = maxDist;
+        changes = 0;
+        maxDist = FLT_MIN;
+        tracePhase(trace, it, 0, PHASE_CONVERGE, &mark, MPI_Wtime());
+        perfPhase(perf, PERF_UPDATE, mark);
+        it++;
     }
-    else
+    while (anotherIteration);
+    it--;
+    perfClose(perf);
+    if (trace != NULL)
+    {
+        trace->recorded = it;
+    }
+
+    // 4. Inertia: the final shards go round the ring once more, each row adding its distance to its
+    // centroid when the shard that holds it comes by
+    double inertia = 0.0;
+    const float* current = shard;
+    for (s = 0; s < size; s++)
+    {
+        origin = (rank - s + size) % size;
+        float* incoming = &blocks[(s % 2) * blockSize];
+        if (s < size - 1)
+        {
+            ringShift(current, shardFloats[origin], incoming, shardFloats[(origin + size - 1) % size], previous, next,
+                      comm, ringReqs);
+        }
+        for (i = 0; i < lineOffset; i++)
+        {
+            cluster = localClassMap[i] - 1 - shardStart[origin];
+            if (cluster >= 0 && cluster < shardSize[origin])
+            {
+                inertia += exactSquared(&localData[(long)i * samples], &current[cluster * samples], samples);
+            }
+        }
+        if (s < size - 1)
+        {
+            MPI_CHECK_RETURN(MPI_Waitall(2, ringReqs, MPI_STATUSES_IGNORE));
+            current = incoming;
+        }
+    }
+    MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, &inertia, 1, MPI_DOUBLE, MPI_SUM, comm));
+
+    // 5. Final centroids and classes on the root
+    MPI_CHECK_RETURN(MPI_Gatherv(shard, shardFloats[rank], MPI_FLOAT, centroids, shardFloats, shardDispls, MPI_FLOAT,
+                                 0, comm));
+    MPI_CHECK_RETURN(MPI_Gatherv(localClassMap, lineOffset, MPI_INT, classMap, in->linesPerProcess,
+                                 in->displacementPerProcess, MPI_INT, 0, comm));
+
+    memset(run, 0, sizeof(*run));
+    MPI_Reduce(&reduceWait, &run->reduceWait, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    run->iterations = it;
+    run->changes = lastChanges;
+    run->maxDist = lastMaxDist;
+    run->inertia = inertia;
+
+    free(shardStart);
+    free(shardSize);
+    free(shardFloats);
+    free(shardDispls);
+    free(shard);
+    free(blocks);
+    free(sums);
+    free(pointsPerClass);
+    free(shardCounts);
+    free(rowMinDist);
+    free(rowCluster);
+    free(localClassMap);
+    return 0;
+}
+
+/*
+Function updateCentroids: Replaces centroids by the means given by the sums and class counts of a
+reduction (newCentroids is scratch space for K x samples floats). Returns the largest movement.
+*/
+float updateCentroids(const float* sums, const int* counts, float* centroids, float* newCentroids, int K,
+                      int samples)
+{
+    float_t dist, maxDist = FLT_MIN;
+    int cluster, j;
+
+    for (cluster = 0; cluster < K; cluster++)
     {
-        return -2;
+        for (j = 0; j < samples; j++)
+        {
+            newCentroids[cluster * samples + j] = sums[cluster * samples + j] / counts[cluster];
+        }
+        dist = euclideanDistance(&centroids[cluster * samples], &newCentroids[cluster * samples], samples);
+        if (dist > maxDist)
+        {
+            maxDist = dist;
+        }
     }
+    memcpy(centroids, newCentroids, K * samples * sizeof(float));
+    return maxDist;
 }
 
 /*
-Function readInput2: It loads data from file.
+Function kmeansFitStale: kmeansFit with bounded staleness (KMEANS_MPI_STALENESS=s > 0).
+There is no collective in the iterations: every process publishes the change of its sums in the
+model window of the root and computes its next centroids from the model as it finds it, waiting only
+while some process has not finished iteration it - s - 1. The stop condition is checked on the total
+changes of iteration it - s - 2 and the largest movement of a centroid after it, complete by then, so
+every process takes the same decision and runs the same s + 1 iterations after the one that met the
+condition. At the end every process reads the complete model, so the final centroids are the means
+of the final classes.
+Returns 0 on success and -4 if the memory could not be allocated.
 */
-int readInput2(char* filename, float* data)
+int kmeansFitStale(const KMeansInput* in, int K, float* centroids, int* classMap, int maxIterations, int minChanges,
+                   float maxThreshold, KMeansLog* outputMsg, PhaseTrace* trace, PerfCounters* perf, KMeansRun* run)
 {
-    FILE* fp;
-    char line[MAXLINE] = "";
-    char* ptr;
-    const char* delim = "\t";
-    int i = 0;
+    const float* data = in->data;
+    const MPI_Comm comm = in->comm;
+    const int samples = in->samples, rank = in->rank, size = in->size;
+    const int startLine = in->startLine, lineOffset = in->lineOffset;
+    const long sumsSize = (long)K * samples;
+    double reduceWait = 0.0, mark;
+    float_t dist, minDist, maxDist = FLT_MIN;
+    float recordMoved = FLT_MIN;
+    int it, decided, stopped = 0, changes, recordChanges = 0, cluster, previous, i, j;
 
-    if ((fp = fopen(filename, "rt")) != NULL)
+    // sums / counts: copy of the model; deltaSums / deltaCounts: change of the local part of it
+    // progress: last iteration finished by each process
+    float* sums = malloc(sumsSize * sizeof(float));
+    int* counts = malloc(K * sizeof(int));
+    float* deltaSums = malloc(sumsSize * sizeof(float));
+    int* deltaCounts = malloc(K * sizeof(int));
+    float* newCentroids = malloc(sumsSize * sizeof(float));
+    int* progress = malloc(size * sizeof(int));
+    int* localClassMap = calloc(MAX(lineOffset, 1), sizeof(int));
+    if (sums == NULL || counts == NULL || deltaSums == NULL || deltaCounts == NULL || newCentroids == NULL ||
+        progress == NULL || localClassMap == NULL)
     {
-        while (fgets(line, MAXLINE, fp) != NULL)
+        return -4;
+    }
+    StaleModel model;
+    if (initStaleModel(&model, in->staleWin, K, samples, maxIterations, comm) != 0)
+    {
+        return -4;
+    }
+    if (perf != NULL)
+    {
+        perfOpen(perf, MPI_Wtime());
+    }
+
+    for (it = 1; it <= maxIterations; it++)
+    {
+        // Reading the model is the reduce phase and the new centroids the converge one of iteration it;
+        // the sums are accumulated in the assignment and published in the accumulate phase
+        mark = MPI_Wtime();
+        maxDist = FLT_MIN;
+        if (it > 1)
         {
-            ptr = strtok(line, delim);
-            while (ptr != NULL)
+            // Every process must have finished iteration it - s - 1, and the first one
+            reduceWait += waitStale(&model, MAX(it - in->staleness - 1, 1), progress);
+            // The record of iteration it - s - 2 is complete, the same on every process
+            decided = it - in->staleness - 2;
+            readStale(&model, sums, counts, progress, MAX(decided, 0), &recordChanges, &recordMoved);
+            tracePhase(trace, it, 0, PHASE_REDUCE, &mark, MPI_Wtime());
+
+            maxDist = updateCentroids(sums, counts, centroids, newCentroids, K, samples);
+            tracePhase(trace, it, 0, PHASE_CONVERGE, &mark, MPI_Wtime());
+            if (decided >= 1)
             {
-                data[i] = atof(ptr);
-                i++;
-                ptr = strtok(NULL, delim);
+                #ifdef DEBUG
+                    if(outputMsg != NULL)
+                    {
+                        appendLog(outputMsg, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", decided,
+                                  recordChanges, recordMoved);
+                    }
+                #endif
+
+                if (!(recordChanges > minChanges && recordMoved > maxThreshold))
+                {
+                    stopped = decided;
+                    break;
+                }
             }
         }
-        fclose(fp);
-        return 0;
+
+        // The update of the centroids of this assignment: publishing the previous sums, waiting and reading
+        perfPhase(perf, PERF_UPDATE, MPI_Wtime());
+
+        // 1. Assign each point to a class, keeping the change of the local sums and counts
+        changes = 0;
+        memset(deltaSums, 0, sumsSize * sizeof(float));
+        memset(deltaCounts, 0, K * sizeof(int));
+        for (i = 0; i < lineOffset; i++)
+        {
+            cluster = 1, minDist = FLT_MAX;
+            for (j = 0; j < K; j++)
+            {
+                dist = euclideanDistance(&data[(startLine + i) * samples], &centroids[j * samples], samples);
+
+                if (dist < minDist)
+                {
+                    minDist = dist;
+                    cluster = j + 1;
+                }
+            }
+            previous = localClassMap[i];
+            if (previous == cluster)
+            {
+                continue;
+            }
+            changes++;
+            localClassMap[i] = cluster;
+            for (j = 0; j < samples; j++)
+            {
+                if (previous > 0)
+                {
+                    deltaSums[(previous - 1) * samples + j] -= data[(startLine + i) * samples + j];
+                }
+                deltaSums[(cluster - 1) * samples + j] += data[(startLine + i) * samples + j];
+            }
+            if (previous > 0)
+            {
+                deltaCounts[previous - 1]--;
+            }
+            deltaCounts[cluster - 1]++;
+        }
+        tracePhase(trace, it, 0, PHASE_ASSIGN, &mark, MPI_Wtime());
+        perfPhase(perf, PERF_ASSIGN, mark);
+
+        // 2. The model gets the new sums of this process without waiting for the others
+        publishStale(&model, changes > 0 ? deltaSums : NULL, deltaCounts, rank, it, changes, maxDist);
+        tracePhase(trace, it, 0, PHASE_ACCUMULATE, &mark, MPI_Wtime());
     }
-    else
+    it--;
+    perfClose(perf);
+    if (trace != NULL)
+    {
+        trace->recorded = MIN(it + 1, maxIterations);
+    }
+
+    // Every contribution is in the model: the same final centroids on all the processes. Without a
+    // stop the result reports the changes of the last iteration and the final movement
+    MPI_CHECK_RETURN(MPI_Barrier(comm));
+    readStale(&model, sums, counts, progress, stopped != 0 ? stopped : it, &recordChanges, &recordMoved);
+    maxDist = updateCentroids(sums, counts, centroids, newCentroids, K, samples);
+    freeStaleModel(&model);
+    if (stopped == 0)
+    {
+        MPI_CHECK_RETURN(MPI_Allreduce(&maxDist, &recordMoved, 1, MPI_FLOAT, MPI_MAX, comm));
+    }
+
+    // 5. Classes on the root
+    MPI_CHECK_RETURN(MPI_Gatherv(localClassMap, lineOffset, MPI_INT, classMap, in->linesPerProcess,
+                                 in->displacementPerProcess, MPI_INT, 0, comm));
+
+    double inertia = 0.0;
+    for (i = 0; i < lineOffset; i++)
     {
-        return -2; //No file found
+        inertia += exactSquared(&data[(startLine + i) * samples], &centroids[(localClassMap[i] - 1) * samples],
+                                samples);
     }
+    MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, &inertia, 1, MPI_DOUBLE, MPI_SUM, comm));
+
+    memset(run, 0, sizeof(*run));
+    MPI_Reduce(&reduceWait, &run->reduceWait, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    run->iterations = it;
+    run->changes = recordChanges;
+    run->maxDist = recordMoved;
+    run->inertia = inertia;
+
+    free(sums);
+    free(counts);
+    free(deltaSums);
+    free(deltaCounts);
+    free(newCentroids);
+    free(progress);
+    free(localClassMap);
+    return 0;
 }
 
 /*
-Function writeResult: It writes in the output file the cluster of each sample (point).
+Function kmeansFit: Runs the clustering of the input in K classes with the processes of in->comm.
+centroids holds the initial centroids (the same on every process) and receives the final ones;
+classMap (lines entries) receives the class of each point on the root, it may be NULL elsewhere.
+With node-shared arrays the sums of each node are added in the node leader, only the leaders
+reduce them between nodes, and the processes of a node divide and update a part of the centroids each.
+With in->rebalance the local work of every iteration is timed and, when the slowest process lags
+too much, the rows are split again in proportion to the speed of each process.
+With in->sharded the work is done by kmeansFitSharded, which only uses centroids on the root, with
+in->staleness by kmeansFitStale.
+In debug mode the progress of each iteration is appended to outputMsg when it is not NULL, and the
+time of each phase of each iteration is added to trace when it is not NULL, and the hardware
+counters of the assignment and the update to perf when it is not NULL.
+Returns 0 on success and -4 if the memory could not be allocated.
 */
-int writeResult(int* classMap, int lines, const char* filename)
+int kmeansFit(const KMeansInput* in, int K, float* centroids, int* classMap, int maxIterations, int minChanges,
+              float maxThreshold, KMeansLog* outputMsg, PhaseTrace* trace, PerfCounters* perf, KMeansRun* run)
 {
-    FILE* fp;
+    if (in->sharded)
+    {
+        return kmeansFitSharded(in, K, centroids, classMap, maxIterations, minChanges, maxThreshold, outputMsg,
+                                trace, perf, run);
+    }
+    if (in->staleness > 0)
+    {
+        return kmeansFitStale(in, K, centroids, classMap, maxIterations, minChanges, maxThreshold, outputMsg, trace,
+                              perf, run);
+    }
+
+    const float* data = in->data;
+    const MPI_Comm comm = in->comm;
+    const int samples = in->samples, size = in->size;
+    int startLine = in->startLine, lineOffset = in->lineOffset;
+    const int aosoaLayout = in->aosoaLayout, tiledAssign = in->tiledAssign, pdsAssign = in->pdsAssign;
+    const int sketchAssign = in->sketchAssign, indexAssign = in->indexAssign, sketchDim = in->sketchDim;
+    const AoSoAData layout = in->layout;
+    const int shared = in->nodes.node != MPI_COMM_NULL;
+    const int chunks = shared ? 1 : MIN(in->chunks, K);
+
+    long pdsEvaluated = 0, sketchEvaluated = 0;
+    int sketchMismatches = 0;
+    double reduceWait = 0.0, waitStart, workStart, workTime = 0.0, mark;
+
+    float_t dist, minDist = FLT_MAX, maxDist = FLT_MIN, lastMaxDist = FLT_MIN;
+    int it = 1, changes = 0, lastChanges = 0, anotherIteration = 0, auxCentroidsSize = K * samples;
+    int cluster, i, j, m;
+
+    // pointPerClass: number of points classified in each class
+    // auxCentroids: mean of the points in each class
+    // centroidsPerProcess: number of centroids assigned to each process
+    // centroidsDisplacement: starting centroid position for each process
+    // localAuxCentroids: local version of auxCentroid for each process
+    int* centroidsPerProcess = calloc(size, sizeof(int));
+    int* centroidsDispls = calloc(size, sizeof(int));
+    int* pointsPerClass = calloc(K, sizeof(int));
+    float* auxCentroids;
+    float* localAuxCentroids = calloc(auxCentroidsSize, sizeof(float));
+    // Shared: centroids and auxCentroids live in one node window, the caller's array gets the result
+    float* resultCentroids = centroids;
+    MPI_Win centroidsWin = MPI_WIN_NULL;
+    if (shared)
+    {
+        centroids = allocateShared(2L * auxCentroidsSize * sizeof(float), in->nodes.node, &centroidsWin);
+        auxCentroids = centroids + auxCentroidsSize;
+        if (in->nodes.rank == 0)
+        {
+            memcpy(centroids, resultCentroids, auxCentroidsSize * sizeof(float));
+        }
+        nodeSync(centroidsWin, in->nodes.node);
+    }
+    else
+    {
+        auxCentroids = calloc(auxCentroidsSize, sizeof(float));
+    }
+    // Each rank will compute only his part of classMap
+    int* localClassMap = calloc(sizeof(int), lineOffset);
+    if (pointsPerClass == NULL || auxCentroids == NULL || localAuxCentroids == NULL || centroidsPerProcess == NULL ||
+        centroidsDispls == NULL || localClassMap == NULL)
+    {
+        return -4;
+    }
+
+    MPI_Request reqs[3], req, sumsReq;
+    int startCentroidPerSamples, centroidOffsetPerSamples;
+    // Shared: the centroids are split among the processes of the node instead
+    const int splitRank = shared ? in->nodes.rank : in->rank, splitSize = shared ? in->nodes.size : size;
+    int processCentroids = (K / splitSize), centroidsReminder = (K % splitSize);
+    int startCentroid = splitRank * processCentroids;
+    int centroidOffset = processCentroids;
+
+    // Each process calculates its work split for centroids
+    if (splitRank < centroidsReminder)
+    {
+        startCentroid += splitRank;
+        centroidOffset++;
+    }
+    else
+    {
+        startCentroid += centroidsReminder;
+    }
+
+    startCentroidPerSamples = startCentroid * samples;
+    centroidOffsetPerSamples = centroidOffset * samples;
+
+    MPI_CHECK_RETURN(
+        MPI_Iallgather(&startCentroidPerSamples, 1, MPI_INT, centroidsDispls, 1, MPI_INT, comm, &reqs[0])
+    )
+    MPI_CHECK_RETURN(
+        MPI_Iallgather(&centroidOffsetPerSamples, 1, MPI_INT, centroidsPerProcess, 1, MPI_INT, comm, &reqs[1])
+    )
+
+    float *centroidSketch = NULL, *prevCentroids = NULL;
+    if (sketchAssign && ((centroidSketch = malloc((long)K * sketchDim * sizeof(float))) == NULL ||
+                         (prevCentroids = malloc((long)K * samples * sizeof(float))) == NULL))
+    {
+        return -4;
+    }
+    CentroidIndex centroidIndex = { 0, 0, 0, 0.0f, NULL, NULL, NULL, NULL, NULL };
+    if (indexAssign && (initCentroidIndex(&centroidIndex, lineOffset, samples, K) != 0 ||
+                        (prevCentroids = malloc((long)K * samples * sizeof(float))) == NULL))
+    {
+        return -4;
+    }
+
+    // Partial minimum of the points in the current block
+    const TileSizes tiles = chooseTileSizes(lineOffset, samples, K, 1);
+    float* tileMinDist = NULL;
+    int* tileCluster = NULL;
+    if (tiledAssign)
+    {
+        tileMinDist = malloc(tiles.pointTile * sizeof(float));
+        tileCluster = malloc(tiles.pointTile * sizeof(int));
+        if (tileMinDist == NULL || tileCluster == NULL)
+        {
+            return -4;
+        }
+    }
+
+    int groupCluster[AOSOA_MAX_WIDTH];
+    float* sketchBound = NULL;
+    float* indexListDist = NULL;
+    int* indexOrder = NULL;
+    if (indexAssign && ((indexListDist = malloc(centroidIndex.lists * sizeof(float))) == NULL ||
+                        (indexOrder = malloc(centroidIndex.lists * sizeof(int))) == NULL))
+    {
+        return -4;
+    }
+    if (sketchAssign && (sketchBound = malloc(K * sizeof(float))) == NULL)
+    {
+        return -4;
+    }
+
+    // Pipelined reduction: local rows sorted by class, classStart[c] is the first row of class c
+    // chunkCounts: part of each block of centroids owned by each process
+    int* classRows = NULL;
+    int* classStart = NULL;
+    int* chunkCounts = NULL;
+    MPI_Request* chunkReqs = NULL;
+    if (chunks > 1 && ((classRows = malloc(lineOffset * sizeof(int))) == NULL ||
+                       (classStart = malloc((K + 1) * sizeof(int))) == NULL ||
+                       (chunkCounts = malloc(chunks * size * sizeof(int))) == NULL ||
+                       (chunkReqs = malloc(chunks * sizeof(MPI_Request))) == NULL))
+    {
+        return -4;
+    }
+
+    // Rebalancing: work time of every process in the last iteration and row boundaries of all of them
+    const int rebalance = in->rebalance > 0.0f;
+    // windowTimes: work times added up over the iterations the gap lasted; gapWindow: gaps since the last rebalance
+    double *workTimes = NULL, *windowTimes = NULL;
+    int *rowSplit = NULL, *newSplit = NULL, *migration = NULL;
+    int rebalances = 0, gapsBefore = 0, gapsWindow = 0, lagging = 0, cooldown = 0;
+    double gapBefore = 0.0, gapWindow = 0.0;
+    MPI_Request timingReq;
+    if (rebalance && ((workTimes = malloc(size * sizeof(double))) == NULL ||
+                      (windowTimes = malloc(size * sizeof(double))) == NULL ||
+                      (rowSplit = malloc((size + 1) * sizeof(int))) == NULL ||
+                      (newSplit = malloc((size + 1) * sizeof(int))) == NULL ||
+                      (migration = malloc(4 * size * sizeof(int))) == NULL))
+    {
+        return -4;
+    }
+    if (rebalance)
+    {
+        MPI_CHECK_RETURN(MPI_Allgather(&startLine, 1, MPI_INT, rowSplit, 1, MPI_INT, comm));
+        rowSplit[size] = in->lines;
+    }
+
+    MPI_CHECK_RETURN(MPI_Waitall(2, reqs, MPI_STATUS_IGNORE));
+
+    // Compressed sums: with delta encoding every process keeps all the sums and divides all of them
+    CompressedSums compressed;
+    if (initCompressedSums(&compressed, shared ? COMPRESS_NONE : in->compress, in->compressVerify, K, samples,
+                           lineOffset, centroidOffsetPerSamples) != 0)
+    {
+        return -4;
+    }
+    const int deltaSums = compressed.mode == COMPRESS_DELTA;
+    const int firstDivided = deltaSums ? 0 : startCentroid, dividedCentroids = deltaSums ? K : centroidOffset;
+
+    // Persistent collectives: built once, only started and waited on in every iteration
+    const int persistent = in->persistent && !shared && compressed.mode == COMPRESS_NONE &&
+                           initIterationCollectives(pointsPerClass, K, &changes, &maxDist, localAuxCentroids,
+                                                    auxCentroids, centroidsPerProcess, centroidsDispls, comm, &req,
+                                                    &reqs[0], &reqs[1], &reqs[2], chunks > 1 ? NULL : &sumsReq);
+
+    for (int chunk = 0; chunk < chunks && chunks > 1; chunk++)
+    {
+        int first = chunk * K / chunks * samples, last = (chunk + 1) * K / chunks * samples;
+        for (i = 0; i < size; i++)
+        {
+            int low = MAX(first, centroidsDispls[i]), high = MIN(last, centroidsDispls[i] + centroidsPerProcess[i]);
+            chunkCounts[chunk * size + i] = MAX(high - low, 0);
+        }
+    }
+    if (perf != NULL)
+    {
+        perfOpen(perf, MPI_Wtime());
+    }
+    do
+    {
+        mark = workStart = MPI_Wtime();
+        if (sketchAssign)
+        {
+            for (i = 0; i < K; i++)
+            {
+                projectRow(&centroids[i * samples], in->sketchRows, samples, sketchDim, &centroidSketch[i * sketchDim]);
+            }
+        }
+
+        if (indexAssign)
+        {
+            buildCentroidIndex(&centroidIndex, centroids, K, samples);
+            calibrateCentroidIndex(&centroidIndex, &data[startLine * samples], lineOffset, centroids, K, samples,
+                                   indexListDist);
+        }
+
+        // 1. Assign each point to a class and count the elements in each class
+        if (aosoaLayout)
+        {
+            for (i = 0; i < layout.groups; i++)
+            {
+                int count = groupSize(&layout, i);
+                assignAoSoA(&layout, i, centroids, K, groupCluster);
+
+                for (j = 0; j < count; j++)
+                {
+                    cluster = groupCluster[j];
+                    if (localClassMap[i * layout.width + j] != cluster)
+                    {
+                        changes++;
+                        localClassMap[i * layout.width + j] = cluster;
+                    }
+                    pointsPerClass[cluster - 1]++;
+                }
+            }
+        }
+        else if (sketchAssign)
+        {
+            for (i = 0; i < lineOffset; i++)
+            {
+                cluster = assignSketch(&data[(startLine + i) * samples], &in->dataSketch[i * sketchDim], centroids,
+                                       centroidSketch, K, samples, sketchDim, localClassMap[i], sketchBound,
+                                       &sketchEvaluated);
+                if (localClassMap[i] != cluster)
+                {
+                    changes++;
+                    localClassMap[i] = cluster;
+                }
+
+                pointsPerClass[cluster - 1]++;
+            }
+        }
+        else if (indexAssign)
+        {
+            for (i = 0; i < lineOffset; i++)
+            {
+                cluster = searchCentroidIndex(&centroidIndex, &data[(startLine + i) * samples], centroids, K, samples,
+                                              localClassMap[i], indexListDist, indexOrder);
+                if (localClassMap[i] != cluster)
+                {
+                    changes++;
+                    localClassMap[i] = cluster;
+                }
+
+                pointsPerClass[cluster - 1]++;
+            }
+        }
+        else if (pdsAssign)
+        {
+            for (i = 0; i < lineOffset; i++)
+            {
+                cluster = assignPDS(&data[(startLine + i) * samples], centroids, K, samples, localClassMap[i],
+                                    in->pdsOrder, &pdsEvaluated);
+                if (localClassMap[i] != cluster)
+                {
+                    changes++;
+                    localClassMap[i] = cluster;
+                }
+
+                pointsPerClass[cluster - 1]++;
+            }
+        }
+        else if (tiledAssign)
+        {
+            for (i = 0; i < lineOffset; i += tiles.pointTile)
+            {
+                int count = MIN(tiles.pointTile, lineOffset - i);
+                assignTiled(&data[(startLine + i) * samples], count, centroids, K, samples, tiles.centroidTile,
+                            tileMinDist, tileCluster);
+
+                for (j = 0; j < count; j++)
+                {
+                    if (localClassMap[i + j] != tileCluster[j])
+                    {
+                        changes++;
+                        localClassMap[i + j] = tileCluster[j];
+                    }
+                    pointsPerClass[tileCluster[j] - 1]++;
+                }
+            }
+        }
+        else
+        {
+            for (i = 0; i < lineOffset; i++)
+            {
+                cluster = 1, minDist = FLT_MAX;
+                for (j = 0; j < K; j++)
+                {
+                    dist = euclideanDistance(&data[(startLine + i) * samples], &centroids[j * samples], samples);
+
+                    if (dist < minDist)
+                    {
+                        minDist = dist;
+                        cluster = j + 1;
+                    }
+                }
+                if (localClassMap[i] != cluster)
+                {
+                    changes++;
+                    localClassMap[i] = cluster;
+                }
+
+                pointsPerClass[cluster - 1]++;
+            }
+        }
+        tracePhase(trace, it, 0, PHASE_ASSIGN, &mark, MPI_Wtime());
+        perfPhase(perf, PERF_ASSIGN, mark);
+
+        // 2. Compute the coordinates mean of all the point in the same class
+        if (persistent)
+        {
+            MPI_CHECK_RETURN(MPI_Start(&req));
+            MPI_CHECK_RETURN(MPI_Start(&reqs[0]));
+        }
+        else
+        {
+            MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, pointsPerClass, K, MPI_INT, MPI_SUM, comm, &req));
+            MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, &changes, 1, MPI_INT, MPI_SUM, comm, &reqs[0]));
+        }
+
+        if (chunks > 1)
+        {
+            // Counting sort of the local rows by class, stable so every sum adds its rows in the same order
+            memset(classStart, 0, (K + 1) * sizeof(int));
+            for (i = 0; i < lineOffset; i++)
+            {
+                classStart[localClassMap[i]]++;
+            }
+            for (i = 0; i < K; i++)
+            {
+                classStart[i + 1] += classStart[i];
+            }
+            for (i = 0; i < lineOffset; i++)
+            {
+                classRows[classStart[localClassMap[i] - 1]++] = i;
+            }
+            for (i = K; i > 0; i--)
+            {
+                classStart[i] = classStart[i - 1];
+            }
+            classStart[0] = 0;
+
+            // The sums of each block of centroids are reduced while the next blocks are accumulated
+            for (int chunk = 0; chunk < chunks; chunk++)
+            {
+                int first = chunk * K / chunks, last = (chunk + 1) * K / chunks, done;
+                for (cluster = first; cluster < last; cluster++)
+                {
+                    for (m = classStart[cluster]; m < classStart[cluster + 1]; m++)
+                    {
+                        for (j = 0; j < samples; j++)
+                        {
+                            localAuxCentroids[cluster * samples + j] += data[(startLine + classRows[m]) * samples + j];
+                        }
+                    }
+                }
+                MPI_CHECK_RETURN(MPI_Ireduce_scatter(&localAuxCentroids[first * samples],
+                                                     &auxCentroids[MAX(first * samples, startCentroidPerSamples)],
+                                                     &chunkCounts[chunk * size], MPI_FLOAT, MPI_SUM, comm,
+                                                     &chunkReqs[chunk]));
+                // Give the library a chance to progress the reductions already started
+                MPI_CHECK_RETURN(MPI_Testall(chunk + 1, chunkReqs, &done, MPI_STATUSES_IGNORE));
+            }
+            workTime = MPI_Wtime() - workStart;
+            tracePhase(trace, it, 0, PHASE_ACCUMULATE, &mark, workStart + workTime);
+
+            waitStart = MPI_Wtime();
+            MPI_CHECK_RETURN(MPI_Waitall(chunks, chunkReqs, MPI_STATUSES_IGNORE));
+            reduceWait += MPI_Wtime() - waitStart;
+        }
+        else
+        {
+            // Delta encoding computes the changes of the sums from the changes of class instead
+            const int accumulate = !deltaSums || compressed.verify;
+            if (aosoaLayout && accumulate)
+            {
+                for (i = 0; i < layout.groups; i++)
+                {
+                    accumulateAoSoA(&layout, i, &localClassMap[i * layout.width], localAuxCentroids);
+                }
+            }
+            else if (accumulate)
+            {
+                for (i = 0; i < lineOffset; i++)
+                {
+                    cluster = localClassMap[i] - 1;
+                    for (j = 0; j < samples; j++)
+                    {
+                        localAuxCentroids[cluster * samples + j] += data[(startLine + i) * samples + j];
+                    }
+                }
+            }
+
+            workTime = MPI_Wtime() - workStart;
+            tracePhase(trace, it, 0, PHASE_ACCUMULATE, &mark, workStart + workTime);
+
+            waitStart = MPI_Wtime();
+            if (shared)
+            {
+                // Nobody reads the whole centroids after this point until they are updated
+                if (prevCentroids != NULL)
+                {
+                    memcpy(prevCentroids, centroids, K * samples * sizeof(float));
+                }
+                // Sums of the node in the leader, then added by the leaders of all the nodes
+                MPI_CHECK_RETURN(MPI_Reduce(localAuxCentroids, in->nodes.rank == 0 ? auxCentroids : NULL,
+                                            K * samples, MPI_FLOAT, MPI_SUM, 0, in->nodes.node));
+                if (in->nodes.leaders != MPI_COMM_NULL)
+                {
+                    MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, auxCentroids, K * samples, MPI_FLOAT, MPI_SUM,
+                                                   in->nodes.leaders));
+                }
+                nodeSync(centroidsWin, in->nodes.node);
+            }
+            else if (deltaSums)
+            {
+                reduceDelta(&compressed, &data[startLine * samples], localClassMap, lineOffset, K, samples,
+                            auxCentroids, comm);
+            }
+            else if (compressed.mode == COMPRESS_BF16)
+            {
+                reduceBf16(&compressed, localAuxCentroids, &auxCentroids[startCentroidPerSamples],
+                           centroidsPerProcess, K, samples, comm);
+            }
+            else if (persistent)
+            {
+                MPI_CHECK_RETURN(MPI_Start(&sumsReq));
+                MPI_CHECK_RETURN(MPI_Wait(&sumsReq, MPI_STATUS_IGNORE));
+            }
+            else
+            {
+                // Each process only receives the sums of the centroids it updates
+                MPI_CHECK_RETURN(MPI_Reduce_scatter(localAuxCentroids, &auxCentroids[startCentroidPerSamples],
+                                                    centroidsPerProcess, MPI_FLOAT, MPI_SUM, comm));
+            }
+            reduceWait += MPI_Wtime() - waitStart;
+            if (compressed.verify)
+            {
+                MPI_CHECK_RETURN(MPI_Reduce_scatter(localAuxCentroids, compressed.exact, centroidsPerProcess,
+                                                    MPI_FLOAT, MPI_SUM, comm));
+            }
+        }
+        if (rebalance)
+        {
+            MPI_CHECK_RETURN(MPI_Iallgather(&workTime, 1, MPI_DOUBLE, workTimes, 1, MPI_DOUBLE, comm, &timingReq));
+        }
+        MPI_CHECK_RETURN(MPI_Wait(&req, MPI_STATUS_IGNORE));
+
+        for (i = 0; i < dividedCentroids; i++)
+        {
+            cluster = firstDivided + i;
+            for (j = 0; j < samples; j++)
+            {
+                auxCentroids[cluster * samples + j] /= pointsPerClass[cluster];
+            }
+        }
+        tracePhase(trace, it, 0, PHASE_REDUCE, &mark, MPI_Wtime());
+
+        // Distance between the owned centroids of the compressed and of the exact sums
+        for (i = 0; i < centroidOffsetPerSamples && compressed.verify; i++)
+        {
+            cluster = startCentroid + i / samples;
+            if (pointsPerClass[cluster] > 0)
+            {
+                dist = fabsf(compressed.exact[i] / pointsPerClass[cluster] - auxCentroids[startCentroidPerSamples + i]);
+                compressed.drift = MAX(compressed.drift, dist);
+            }
+        }
+
+        // no need for barrier, the rank will work only on the auxCentroids he computed
+        // so they will necessarily be ready
+        if (persistent)
+        {
+            MPI_CHECK_RETURN(MPI_Start(&reqs[2]));
+        }
+        else if (deltaSums)
+        {
+            // Every process already has all the centroids
+            reqs[2] = MPI_REQUEST_NULL;
+        }
+        else if (!shared)
+        {
+            MPI_CHECK_RETURN(MPI_Iallgatherv(
+                MPI_IN_PLACE, centroidOffsetPerSamples, MPI_FLOAT,
+                auxCentroids, centroidsPerProcess, centroidsDispls,
+                MPI_FLOAT, comm, &reqs[2]));
+        }
+
+        // 3. Compute the maximum movement of a centroid compared to its previous position
+        for (i = 0; i < centroidOffset; i++)
+        {
+            dist = euclideanDistance(
+                &centroids[(startCentroid + i) * samples],
+                &auxCentroids[(startCentroid + i) * samples],
+                samples
+            );
+
+            if (dist > maxDist)
+            {
+                maxDist = dist;
+            }
+            if (shared)
+            {
+                memcpy(&centroids[(startCentroid + i) * samples], &auxCentroids[(startCentroid + i) * samples],
+                       samples * sizeof(float));
+            }
+        }
+
+        if (persistent)
+        {
+            MPI_CHECK_RETURN(MPI_Start(&reqs[1]));
+        }
+        else
+        {
+            MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, &maxDist, 1, MPI_FLOAT, MPI_MAX, comm, &reqs[1]));
+        }
+
+        memset(pointsPerClass, 0, K * sizeof(int));
+        memset(localAuxCentroids, 0.0, K * samples * sizeof(float));
+
+        MPI_CHECK_RETURN(MPI_Waitall(2, reqs, MPI_STATUS_IGNORE));
+
+        #ifdef DEBUG
+            if(outputMsg != NULL)
+            {
+                appendLog(outputMsg, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", it, changes, maxDist);
+            }
+        #endif
+
+        anotherIteration = (changes > minChanges) && (it < maxIterations) && (maxDist > maxThreshold);
+        // Kept for the result, the reduction variables start again from zero
+        lastChanges = changes;
+        lastMaxDist = maxDist;
+        changes = 0;
+        maxDist = FLT_MIN;
+        it++;
+
+        if (rebalance)
+        {
+            // Every process takes the same decision from the same times
+            double slowest = 0.0, fastest = DBL_MAX;
+            MPI_CHECK_RETURN(MPI_Wait(&timingReq, MPI_STATUS_IGNORE));
+            for (i = 0; i < size; i++)
+            {
+                slowest = MAX(slowest, workTimes[i]);
+                fastest = MIN(fastest, workTimes[i]);
+            }
+            gapWindow += slowest - fastest;
+            gapsWindow++;
+
+            // The gap must last REBALANCE_PERSIST iterations, and the rows only move again REBALANCE_COOLDOWN
+            // iterations after a rebalance; the split follows the speeds over all the lagging iterations
+            lagging = slowest - fastest > in->rebalance * slowest ? lagging + 1 : 0;
+            for (i = 0; lagging > 0 && i < size; i++)
+            {
+                windowTimes[i] = (lagging > 1 ? windowTimes[i] : 0.0) + workTimes[i];
+            }
+            cooldown = MAX(cooldown - 1, 0);
+            int moved = 0;
+            if (anotherIteration && cooldown == 0 && lagging >= REBALANCE_PERSIST)
+            {
+                splitBySpeed(windowTimes, rowSplit, size, newSplit);
+                for (i = 1; i < size; i++)
+                {
+                    moved = MAX(moved, abs(newSplit[i] - rowSplit[i]));
+                }
+                lagging = 0;
+            }
+            // Boundaries that hardly change are not worth the migration
+            if (moved > 0 && moved >= REBALANCE_MIN_MOVE * in->lines / size)
+            {
+                if ((localClassMap = migrateRows(localClassMap, rowSplit, newSplit, in->rank, size, comm,
+                                                 migration)) == NULL)
+                {
+                    return -4;
+                }
+                #ifdef DEBUG
+                if (outputMsg != NULL)
+                {
+                    appendLog(outputMsg, "\n[%d] Rebalance: mean straggler gap %f seconds since the last split, "
+                              "boundaries moved by up to %d rows", it - 1, gapWindow / gapsWindow, moved);
+                }
+                #endif
+                memcpy(rowSplit, newSplit, (size + 1) * sizeof(int));
+                startLine = rowSplit[in->rank];
+                lineOffset = rowSplit[in->rank + 1] - startLine;
+                if (chunks > 1)
+                {
+                    free(classRows);
+                    if ((classRows = malloc(MAX(lineOffset, 1) * sizeof(int))) == NULL)
+                    {
+                        return -4;
+                    }
+                }
+                if (rebalances == 0)
+                {
+                    gapBefore = gapWindow;
+                    gapsBefore = gapsWindow;
+                }
+                rebalances++;
+                cooldown = REBALANCE_COOLDOWN;
+                gapWindow = 0.0;
+                gapsWindow = 0;
+            }
+        }
+
+        if (shared)
+        {
+            // Every part of the centroids is updated before the next assignment
+            nodeSync(centroidsWin, in->nodes.node);
+        }
+        else
+        {
+            MPI_CHECK_RETURN(MPI_Wait(&reqs[2], MPI_STATUS_IGNORE));
+            if (prevCentroids != NULL)
+            {
+                memcpy(prevCentroids, centroids, K * samples * sizeof(float));
+            }
+            memcpy(centroids, auxCentroids, K * samples * sizeof(float));
+        }
+        tracePhase(trace, it - 1, 0, PHASE_CONVERGE, &mark, MPI_Wtime());
+        perfPhase(perf, PERF_UPDATE, mark);
+    }
+    while (anotherIteration);
+    it--;
+    perfClose(perf);
+    if (trace != NULL)
+    {
+        trace->recorded = it;
+    }
+    if (persistent)
+    {
+        freeIterationCollectives(&req, &reqs[0], &reqs[1], &reqs[2], chunks > 1 ? NULL : &sumsReq);
+    }
+
+    // Verification pass: the labels must be the ones of a brute-force assignment to the last centroids used
+    if (sketchAssign)
+    {
+        for (i = 0; i < lineOffset; i++)
+        {
+            cluster = assignExact(&data[(startLine + i) * samples], prevCentroids, K, samples);
+            if (localClassMap[i] != cluster)
+            {
+                localClassMap[i] = cluster;
+                sketchMismatches++;
+            }
+        }
+    }
+
+    // 5. Gather to the root process all the information that will be written in the output file
+    int* linesPerProcess = in->linesPerProcess;
+    int* displacementPerProcess = in->displacementPerProcess;
+    if (rebalance)
+    {
+        // Current split of the rows
+        linesPerProcess = migration;
+        displacementPerProcess = migration + size;
+        for (i = 0; i < size; i++)
+        {
+            linesPerProcess[i] = rowSplit[i + 1] - rowSplit[i];
+            displacementPerProcess[i] = rowSplit[i];
+        }
+    }
+    MPI_CHECK_RETURN(MPI_Igatherv(
+        localClassMap, lineOffset,
+        MPI_INT, classMap, linesPerProcess,
+        displacementPerProcess, MPI_INT, 0, comm, &req
+    ));
+
+    // Within-cluster sum of squares of the final classes
+    double inertia = 0.0;
+    for (i = 0; i < lineOffset; i++)
+    {
+        inertia += exactSquared(&data[(startLine + i) * samples], &centroids[(localClassMap[i] - 1) * samples], samples);
+    }
+    MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, &inertia, 1, MPI_DOUBLE, MPI_SUM, comm));
+
+    int indexMismatches = 0;
+    // Final-assignment recall: labels compared with a brute-force assignment to the centroids of the last iteration
+    if (indexAssign)
+    {
+        for (i = 0; i < lineOffset; i++)
+        {
+            if (assignExact(&data[(startLine + i) * samples], prevCentroids, K, samples) != localClassMap[i])
+            {
+                indexMismatches++;
+            }
+        }
+    }
+    MPI_Reduce(&indexMismatches, &run->indexMismatches, 1, MPI_INT, MPI_SUM, 0, comm);
+    MPI_Reduce(&pdsEvaluated, &run->pdsEvaluated, 1, MPI_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(&sketchEvaluated, &run->sketchEvaluated, 1, MPI_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(&sketchMismatches, &run->sketchMismatches, 1, MPI_INT, MPI_SUM, 0, comm);
+    MPI_Reduce(&reduceWait, &run->reduceWait, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    double compressBytes = compressed.bytes / it;
+    MPI_Reduce(&compressBytes, &run->compressBytes, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&compressed.drift, &run->drift, 1, MPI_FLOAT, MPI_MAX, 0, comm);
+    freeCompressedSums(&compressed);
+    run->iterations = it;
+    run->restart = 0;
+    run->changes = lastChanges;
+    run->maxDist = lastMaxDist;
+    run->inertia = inertia;
+    run->indexLists = centroidIndex.lists;
+    run->indexProbes = centroidIndex.probes;
+    run->persistent = persistent;
+    run->rebalances = rebalances;
+    // Without rebalances the whole run is the gap before
+    run->gapBefore = rebalances > 0 ? gapBefore / gapsBefore : gapsWindow > 0 ? gapWindow / gapsWindow : 0.0;
+    run->gapAfter = rebalances > 0 && gapsWindow > 0 ? gapWindow / gapsWindow : run->gapBefore;
+    run->gapIterations = rebalances > 0 ? gapsWindow : 0;
+    MPI_CHECK_RETURN(MPI_Wait(&req, MPI_STATUS_IGNORE));
+
+    if (shared)
+    {
+        memcpy(resultCentroids, centroids, K * samples * sizeof(float));
+        freeShared(&centroidsWin);
+    }
+    else
+    {
+        free(auxCentroids);
+    }
+    free(workTimes);
+    free(windowTimes);
+    free(rowSplit);
+    free(newSplit);
+    free(migration);
+    free(classRows);
+    free(classStart);
+    free(chunkCounts);
+    free(chunkReqs);
+    free(sketchBound);
+    free(indexListDist);
+    free(indexOrder);
+    free(centroidSketch);
+    free(prevCentroids);
+    freeCentroidIndex(&centroidIndex);
+    free(centroidsPerProcess);
+    free(centroidsDispls);
+    free(pointsPerClass);
+    free(localAuxCentroids);
+    free(localClassMap);
+    free(tileMinDist);
+    free(tileCluster);
+    return 0;
+}
+
+/*
+Function restartGroups: Number of groups of processes that run restarts at the same time, one per
+restart up to one per process. KMEANS_N_INIT_MODE=points keeps all the processes in a single group.
+*/
+int restartGroups(int restarts, int size)
+{
+    const char* RAW_KMEANS_N_INIT_MODE = getenv("KMEANS_N_INIT_MODE");
+    if (restarts <= 1 || (RAW_KMEANS_N_INIT_MODE != NULL && strcmp(RAW_KMEANS_N_INIT_MODE, "points") == 0))
+    {
+        return 1;
+    }
+    return MIN(restarts, size);
+}
+
+/*
+Function fitRestarts: Runs the restarts group, group + groups, ... of the clustering in K classes
+with the processes of in->comm and keeps the one with the lowest inertia. Restart 0 starts from
+centroids, restart r from drawCentroids(r). centroids and classMap (root only) receive the result
+of the best restart. With in->sharded the centroids are only kept by the root, and only when
+centroids is not NULL. outputMsg, trace and perf only receive the first restart of the group.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+int fitRestarts(const KMeansInput* in, int K, int restarts, int group, int groups, float* centroids, int* classMap,
+                int maxIterations, int minChanges, float maxThreshold, KMeansLog* outputMsg, PhaseTrace* trace,
+                PerfCounters* perf, KMeansRun* run)
+{
+    if (restarts <= 1)
+    {
+        return kmeansFit(in, K, centroids, classMap, maxIterations, minChanges, maxThreshold, outputMsg, trace, perf,
+                         run);
+    }
+
+    const int size = K * in->samples;
+    // Sharded centroids are only drawn and gathered on the root
+    const int fullCentroids = !in->sharded || in->rank == 0;
+    float* candidateCentroids = fullCentroids ? malloc(size * sizeof(float)) : NULL;
+    int* candidateMap = in->rank == 0 ? malloc(in->lines * sizeof(int)) : NULL;
+    KMeansRun candidate;
+    int r, error = 0, first = 1;
+
+    if ((fullCentroids && candidateCentroids == NULL) || (in->rank == 0 && candidateMap == NULL))
+    {
+        error = -4;
+    }
+
+    for (r = group; r < restarts && error == 0; r += groups)
+    {
+        if (fullCentroids && r == 0)
+        {
+            memcpy(candidateCentroids, centroids, size * sizeof(float));
+        }
+        else if (fullCentroids)
+        {
+            drawCentroids(in->data, in->lines, in->samples, K, r, candidateCentroids);
+        }
+        if (candidateMap != NULL)
+        {
+            memset(candidateMap, 0, in->lines * sizeof(int));
+        }
+
+        error = kmeansFit(in, K, candidateCentroids, candidateMap, maxIterations, minChanges, maxThreshold,
+                          first ? outputMsg : NULL, first ? trace : NULL, first ? perf : NULL, &candidate);
+        // The inertia is reduced on every process, so all of them take the same decision
+        if (error == 0 && (first || candidate.inertia < run->inertia))
+        {
+            *run = candidate;
+            run->restart = r;
+            if (fullCentroids && centroids != NULL)
+            {
+                memcpy(centroids, candidateCentroids, size * sizeof(float));
+            }
+            if (candidateMap != NULL)
+            {
+                memcpy(classMap, candidateMap, in->lines * sizeof(int));
+            }
+        }
+        first = 0;
+    }
+
+    free(candidateCentroids);
+    free(candidateMap);
+    return error;
+}
+
+/*
+Function shareBestRestart: When the restarts were split among groups of processes, the root of the
+group with the lowest inertia sends its classes and run to rank 0 of MPI_COMM_WORLD.
+*/
+void shareBestRestart(const KMeansInput* in, int* classMap, KMeansRun* run)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // Only the roots of the groups compete
+    struct { double inertia; int rank; } local = { in->rank == 0 ? run->inertia : DBL_MAX, rank }, best;
+    MPI_CHECK_RETURN(MPI_Allreduce(&local, &best, 1, MPI_DOUBLE_INT, MPI_MINLOC, MPI_COMM_WORLD));
+
+    if (best.rank != 0 && rank == best.rank)
+    {
+        MPI_CHECK_RETURN(MPI_Send(classMap, in->lines, MPI_INT, 0, 0, MPI_COMM_WORLD));
+        MPI_CHECK_RETURN(MPI_Send(run, sizeof(KMeansRun), MPI_BYTE, 0, 1, MPI_COMM_WORLD));
+    }
+    else if (best.rank != 0 && rank == 0)
+    {
+        MPI_CHECK_RETURN(MPI_Recv(classMap, in->lines, MPI_INT, best.rank, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+        MPI_CHECK_RETURN(MPI_Recv(run, sizeof(KMeansRun), MPI_BYTE, best.rank, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+    }
+}
+
+/*
+Function sweepClusters: Clusters the same input once for each number of clusters of the list.
+MPI_COMM_WORLD is split in KMEANS_SWEEP_GROUPS groups of processes, each group takes every
+groups-th K. Every clustering starts from the centroids a run with only that K would use, and keeps the best of
+restarts restarts run one after another by the group. The root
+of each group writes the classes to <output>.k<K> and rank 0 prints one CSV line per K.
+*/
+void sweepClusters(const float* data, int lines, int samples, const int* clusters, int count, int restarts,
+                   int maxIterations, int minChanges, float maxThreshold, const char* outputFile)
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    const char* RAW_KMEANS_SWEEP_GROUPS = getenv("KMEANS_SWEEP_GROUPS");
+    int groups = (RAW_KMEANS_SWEEP_GROUPS != NULL && atoi(RAW_KMEANS_SWEEP_GROUPS) > 0) ? atoi(RAW_KMEANS_SWEEP_GROUPS) : 1;
+    groups = MIN(groups, MIN(count, size));
+    const int color = rank * groups / size;
+
+    MPI_Comm comm;
+    MPI_CHECK_RETURN(MPI_Comm_split(MPI_COMM_WORLD, color, rank, &comm));
+
+    KMeansInput input;
+    // iterations, inertia and seconds of each K, filled by the root of the group that ran it
+    double* results = calloc(3 * count, sizeof(double));
+    double* globalResults = rank == 0 ? calloc(3 * count, sizeof(double)) : NULL;
+    char* filename = malloc(strlen(outputFile) + 16);
+    if (results == NULL || (rank == 0 && globalResults == NULL) || filename == NULL ||
+        prepareInput(&input, data, lines, samples, comm) != 0)
+    {
+        fprintf(stderr, "Memory allocation error.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
 
-    if ((fp = fopen(filename, "wt")) != NULL)
+    for (int k = color; k < count; k += groups)
     {
-        for (int i = 0; i < lines; i++)
+        const int K = clusters[k];
+        // Sharded centroids are only drawn and gathered on the root
+        const int fullCentroids = !input.sharded || input.rank == 0;
+        int* centroidPos = calloc(K, sizeof(int));
+        float* centroids = fullCentroids ? calloc(K * samples, sizeof(float)) : NULL;
+        int* classMap = input.rank == 0 ? calloc(lines, sizeof(int)) : NULL;
+        KMeansRun run;
+        if (centroidPos == NULL || (fullCentroids && centroids == NULL) || (input.rank == 0 && classMap == NULL))
         {
-            fprintf(fp, "%d\n", classMap[i]);
+            fprintf(stderr, "Memory allocation error.\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
         }
-        fclose(fp);
 
-        return 0;
-    }
-    else
-    {
-        return -3; //No file found
-    }
-}
+        if (fullCentroids)
+        {
+            srand(0);
+            for (int i = 0; i < K; i++)
+                centroidPos[i] = rand() % lines;
+            initCentroids(data, centroids, centroidPos, samples, K);
+        }
 
-/*
+        MPI_Barrier(comm);
+        double start = MPI_Wtime();
+        if (fitRestarts(&input, K, restarts, 0, 1, centroids, classMap, maxIterations, minChanges, maxThreshold, NULL,
+                        NULL, NULL, &run) != 0)
+        {
+            fprintf(stderr, "Memory allocation error.\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        double localTime = MPI_Wtime() - start, time;
+        MPI_Reduce(&localTime, &time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
 
-Function initCentroids: This function copies the values of the initial centroids, using their
-position in the input data structure as a reference map.
-*/
-void initCentroids(const float* data, float* centroids, int* centroidPos, int samples, int K)
-{
-    int i;
-    int idx;
-    for (i = 0; i < K; i++)
-    {
-        idx = centroidPos[i];
-        memcpy(&centroids[i * samples], &data[idx * samples], (samples * sizeof(float)));
+        if (input.rank == 0)
+        {
+            results[3 * k] = run.iterations;
+            results[3 * k + 1] = run.inertia;
+            results[3 * k + 2] = time;
+            sprintf(filename, "%s.k%d", outputFile, K);
+            int error = writeResult(classMap, lines, filename);
+            if (error != 0)
+            {
+                showFileError(error, filename);
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+        }
+        free(centroidPos);
+        free(centroids);
+        free(classMap);
     }
-}
 
-/*
-Function euclideanDistance: Euclidean distance
-This function could be modified
-*/
-float_t euclideanDistance(const float* point, const float* center, const int samples)
-{
-    float_t dist = 0.0;
-    for (int i = 0; i < samples; i++)
+    MPI_Reduce(results, globalResults, 3 * count, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0)
     {
-        dist += (point[i] - center[i]) * (point[i] - center[i]);
+        printf("K,iterations,inertia,seconds\n");
+        for (int k = 0; k < count; k++)
+        {
+            printf("%d,%d,%f,%f\n", clusters[k], (int)globalResults[3 * k], globalResults[3 * k + 1],
+                   globalResults[3 * k + 2]);
+        }
+        fflush(stdout);
     }
 
-    return sqrt(dist);
+    freeInput(&input);
+    free(results);
+    free(globalResults);
+    free(filename);
+    MPI_Comm_free(&comm);
 }
 
 int main(int argc, char* argv[])
@@ -206,7 +1828,8 @@ int main(int argc, char* argv[])
     * PARAMETERS
     *
     * argv[1]: Input data file
-    * argv[2]: Number of clusters
+    * argv[2]: Number of clusters. A list ("4,8,16") or a range ("2:10" or "2:10:2") runs one clustering
+    *          per number of clusters on the same input.
     * argv[3]: Maximum number of iterations of the method. Algorithm termination condition.
     * argv[4]: Minimum percentage of class changes. Algorithm termination condition.
     *          If between one iteration and the next, the percentage of class changes is less than
@@ -230,6 +1853,7 @@ int main(int argc, char* argv[])
     // Reading the input data
     // lines = number of points; samples = number of dimensions per point
     int lines = 0, samples = 0;
+    double loadStart = MPI_Wtime();
 
     int error = readInput(argv[1], &lines, &samples);
     if (error != 0)
@@ -238,29 +1862,82 @@ int main(int argc, char* argv[])
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
 
-    float* data = (float*)calloc(lines * samples, sizeof(float));
+    // KMEANS_MPI_SHARED=1: one copy of the rows per node, read by the first process of the node
+    const int sharedMemory = sharedMemoryRequested();
+    NodeComms nodes = NO_NODE_COMMS;
+    MPI_Win dataWin = MPI_WIN_NULL;
+    float* data;
+    if (sharedMemory)
+    {
+        splitNodes(MPI_COMM_WORLD, &nodes);
+        data = allocateShared((long)lines * samples * sizeof(float), nodes.node, &dataWin);
+        if (nodes.rank == 0)
+        {
+            memset(data, 0, (long)lines * samples * sizeof(float));
+        }
+    }
+    else
+    {
+        data = (float*)calloc(lines * samples, sizeof(float));
+    }
     if (data == NULL)
     {
         fprintf(stderr, "Memory allocation error.\n");
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
-    error = readInput2(argv[1], data);
+    error = (nodes.rank == 0) ? readInput2(argv[1], data) : 0;
     if (error != 0)
     {
         showFileError(error, argv[1]);
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
+    if (sharedMemory)
+    {
+        nodeSync(dataWin, nodes.node);
+    }
+    const double loadSeconds = MPI_Wtime() - loadStart;
 
     // Parameters
-    int K = atoi(argv[2]);
+    int sweepCount = 0;
+    int* sweepClustersList = parseClusters(argv[2], &sweepCount);
+    if (sweepClustersList == NULL)
+    {
+        fprintf(stderr, "EXECUTION ERROR K-MEANS: Wrong number of clusters: %s\n", argv[2]);
+        fflush(stderr);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    int K = sweepClustersList[0];
     int maxIterations = atoi(argv[3]);
     int minChanges = (int)(lines * atof(argv[4]) / 100.0);
     float maxThreshold = atof(argv[5]);
+    // Number of independent restarts, the one with the lowest inertia is kept
+    const char* RAW_KMEANS_N_INIT = getenv("KMEANS_N_INIT");
+    const int restarts = (RAW_KMEANS_N_INIT != NULL && atoi(RAW_KMEANS_N_INIT) > 1) ? atoi(RAW_KMEANS_N_INIT) : 1;
+
+    if (sweepCount > 1)
+    {
+        sweepClusters(data, lines, samples, sweepClustersList, sweepCount, restarts, maxIterations, minChanges,
+                      maxThreshold, argv[6]);
+        free(sweepClustersList);
+        if (sharedMemory)
+        {
+            freeShared(&dataWin);
+            freeNodes(&nodes);
+        }
+        else
+        {
+            free(data);
+        }
+        MPI_Finalize();
+        return 0;
+    }
 
+    // KMEANS_MPI_SHARDED=1: only the root holds all the centroids, to scatter and gather them
+    const int fullCentroids = !shardedRequested() || rank == 0;
     int* centroidPos = (int*)calloc(K, sizeof(int));
-    float* centroids = (float*)calloc(K * samples, sizeof(float));
+    float* centroids = fullCentroids ? (float*)calloc(K * samples, sizeof(float)) : NULL;
 
-    if (centroidPos == NULL || centroids == NULL)
+    if (centroidPos == NULL || (fullCentroids && centroids == NULL))
     {
         fprintf(stderr, "Memory allocation error.\n");
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
@@ -274,7 +1951,10 @@ int main(int argc, char* argv[])
 
     // Loading the array of initial centroids with the data from the array data
     // The centroids are points stored in the data array.
-    initCentroids(data, centroids, centroidPos, samples, K);
+    if (fullCentroids)
+    {
+        initCentroids(data, centroids, centroidPos, samples, K);
+    }
 
     #ifdef DEBUG
     if (rank == 0)
@@ -302,249 +1982,208 @@ int main(int argc, char* argv[])
     MPI_Barrier(MPI_COMM_WORLD);
     start = MPI_Wtime();
     //**************************************************
-    #ifdef DEBUG
-    char* outputMsg = NULL;
-    char line[100];
+    KMeansLog outputMsg = { NULL, 0, 0 };
 
-    if (rank == 0)
+    // KMEANS_TRACE=<file>: time of every phase of every iteration of every process
+    const char* traceFile = tracePath();
+    PhaseTrace trace = { 1, 0, 0, NULL };
+    if (traceFile != NULL && initTrace(&trace, maxIterations, 1) != 0)
     {
-        outputMsg = calloc(10000, sizeof(char));
-        if (outputMsg == NULL)
-        {
-            fprintf(stderr, "Memory allocation error.\n");
-            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
-        }
+        fprintf(stderr, "Memory allocation error.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
-    #endif
+    // KMEANS_PERF=1: hardware counters of the assignment and the update of every process
+    const int perfMode = perfRequested();
+    PerfCounters perf;
+    memset(&perf, 0, sizeof(perf));
 
-    float_t dist, minDist = FLT_MAX, maxDist = FLT_MIN;
-    int it = 1, changes = 0, anotherIteration = 0, auxCentroidsSize = K * samples;
-    int cluster, j;
-    int* classMap = NULL;
+    // Restarts are split among groups of processes, rank 0 is the root of the first group
+    const int groups = restartGroups(restarts, size);
+    const int group = rank * groups / size;
+    MPI_Comm comm = MPI_COMM_WORLD;
+    if (groups > 1)
+    {
+        MPI_CHECK_RETURN(MPI_Comm_split(MPI_COMM_WORLD, group, rank, &comm));
+    }
 
-    // pointPerClass: number of points classified in each class
-    // auxCentroids: mean of the points in each class
-    // centroidsPerProcess: number of centroids assigned to each process
-    // centroidsDisplacement: starting centroid position for each process
-    // localAuxCentroids: local version of auxCentroid for each process
-    int* centroidsPerProcess = calloc(size, sizeof(int));
-    int* centroidsDispls = calloc(size, sizeof(int));
-    int* pointsPerClass = calloc(K, sizeof(int));
-    float* auxCentroids = calloc(auxCentroidsSize, sizeof(float));
-    float* localAuxCentroids = calloc(auxCentroidsSize, sizeof(float));
-    if (pointsPerClass == NULL || auxCentroids == NULL || localAuxCentroids == NULL || centroidsPerProcess == NULL ||
-        centroidsDispls == NULL)
+    KMeansInput input;
+    KMeansRun run;
+    int* classMap = NULL;
+    double initStart = MPI_Wtime();
+    if (prepareInput(&input, data, lines, samples, comm) != 0 ||
+        (input.rank == 0 && (classMap = calloc(lines, sizeof(int))) == NULL))
     {
         fprintf(stderr, "Memory allocation error.\n");
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
-
-    MPI_Request reqs[3], req, workSplit[2];
-    int startCentroidPerSamples, centroidOffsetPerSamples;
-    int *linesPerProcess = NULL, *displacementPerProcess = NULL;
-    int workPerProcess = (lines / size), workReminder = (lines % size);
-    int processCentroids = (K / size), centroidsReminder = (K % size);
-    int startLine = rank * workPerProcess;
-    int lineOffset = workPerProcess;
-    int startCentroid = rank * processCentroids;
-    int centroidOffset = processCentroids;
-
-    // Each process calculates its work split for lines
-    if (rank < workReminder)
+    const double initSeconds = MPI_Wtime() - initStart;
+    // KMEANS_INDEX_REFERENCE: the initial centroids of the exact clustering the index is compared with
+    const int reference = input.indexAssign && indexReference();
+    float* referenceCentroids = reference ? malloc(K * samples * sizeof(float)) : NULL;
+    if (reference && referenceCentroids == NULL)
     {
-        startLine += rank;
-        lineOffset++;
+        fprintf(stderr, "Memory allocation error.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
-    else
+    if (reference)
     {
-        startLine += workReminder;
+        memcpy(referenceCentroids, centroids, K * samples * sizeof(float));
     }
-
-    // Each process calculates its work split for centroids
-    if (rank < centroidsReminder)
+    if (fitRestarts(&input, K, restarts, group, groups, centroids, classMap, maxIterations, minChanges, maxThreshold,
+                    rank == 0 ? &outputMsg : NULL, trace.seconds != NULL ? &trace : NULL, perfMode ? &perf : NULL,
+                    &run) != 0)
     {
-        startCentroid += rank;
-        centroidOffset++;
+        fprintf(stderr, "Memory allocation error.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
-    else
+    if (groups > 1)
     {
-        startCentroid += centroidsReminder;
+        shareBestRestart(&input, classMap, &run);
     }
 
-    startCentroidPerSamples = startCentroid * samples;
-    centroidOffsetPerSamples = centroidOffset * samples;
-
-    MPI_CHECK_RETURN(
-        MPI_Iallgather(&startCentroidPerSamples, 1, MPI_INT, centroidsDispls, 1, MPI_INT, MPI_COMM_WORLD, &reqs[0])
-    )
-    MPI_CHECK_RETURN(
-        MPI_Iallgather(&centroidOffsetPerSamples, 1, MPI_INT, centroidsPerProcess, 1, MPI_INT, MPI_COMM_WORLD, &reqs[1])
-    )
-
-    if (rank == 0)
+    //END CLOCK*****************************************
+    end = MPI_Wtime();
+    localTime = end - start;
+    MPI_Reduce(&localTime, &globalTime, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    run.lloydMismatches = -1;
+    if (reference)
     {
-        // Only the root process needs to know how lines are divided across the processes
-        linesPerProcess = calloc(size, sizeof(int));
-        displacementPerProcess = calloc(size, sizeof(int));
-        classMap = calloc(lines, sizeof(int));
-
-
-        if (linesPerProcess == NULL || displacementPerProcess == NULL || classMap == NULL)
+        // The same restarts with the exact assignment, outside the measured time
+        KMeansInput exact = input;
+        KMeansRun exactRun;
+        int* exactMap = input.rank == 0 ? calloc(lines, sizeof(int)) : NULL;
+        exact.indexAssign = 0;
+        if ((input.rank == 0 && exactMap == NULL) ||
+            fitRestarts(&exact, K, restarts, group, groups, referenceCentroids, exactMap, maxIterations, minChanges,
+                        maxThreshold, NULL, NULL, NULL, &exactRun) != 0)
         {
             fprintf(stderr, "Memory allocation error.\n");
             MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
         }
+        if (groups > 1)
+        {
+            shareBestRestart(&exact, exactMap, &exactRun);
+        }
+        for (i = 0, run.lloydMismatches = 0; rank == 0 && i < lines; i++)
+        {
+            run.lloydMismatches += exactMap[i] != classMap[i];
+        }
+        free(exactMap);
+        free(referenceCentroids);
     }
-
-    MPI_CHECK_RETURN(
-        MPI_Igather(&startLine, 1, MPI_INT, displacementPerProcess, 1, MPI_INT, 0, MPI_COMM_WORLD, &workSplit[0])
-    )
-    MPI_CHECK_RETURN(
-        MPI_Igather(&lineOffset, 1, MPI_INT, linesPerProcess, 1, MPI_INT, 0, MPI_COMM_WORLD, &workSplit[1])
-    )
-
-    // Each rank will compute only his part of classMap
-    int* localClassMap = calloc(sizeof(int), lineOffset);
-    if (localClassMap == NULL)
-    {
-        fprintf(stderr, "Memory allocation error.\n");
-        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
-    }
-
-    MPI_CHECK_RETURN(MPI_Waitall(2, reqs, MPI_STATUS_IGNORE));
-    do
+    if (rank == 0)
     {
-        // 1. Assign each point to a class and count the elements in each class
-        for (i = 0; i < lineOffset; i++)
+        #ifdef DEBUG
+        printf("%s", logText(&outputMsg));
+        printf("\nComputation: %f seconds", globalTime);
+        if (restarts > 1)
         {
-            cluster = 1, minDist = FLT_MAX;
-            for (j = 0; j < K; j++)
-            {
-                dist = euclideanDistance(&data[(startLine + i) * samples], &centroids[j * samples], samples);
-
-                if (dist < minDist)
-                {
-                    minDist = dist;
-                    cluster = j + 1;
-                }
-            }
-            if (localClassMap[i] != cluster)
-            {
-                changes++;
-                localClassMap[i] = cluster;
-            }
-
-            pointsPerClass[cluster - 1]++;
+            printf("\nRestarts: %d in %d groups, best %d with inertia %f", restarts, groups, run.restart, run.inertia);
         }
-
-        // 2. Compute the coordinates mean of all the point in the same class
-        MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, pointsPerClass, K, MPI_INT, MPI_SUM, MPI_COMM_WORLD, &req));
-        MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, &changes, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD, &reqs[0]));
-
-        for (i = 0; i < lineOffset; i++)
+        printf("\nReduction of the centroid sums: %d chunks, %f seconds waiting", input.chunks, run.reduceWait);
+        if (input.compress != COMPRESS_NONE)
         {
-            cluster = localClassMap[i] - 1;
-            for (j = 0; j < samples; j++)
+            printf("\nCompressed sums (%s): %.0f bytes per process per iteration, %.0f with floats",
+                   input.compress == COMPRESS_DELTA ? "delta" : "bf16", run.compressBytes,
+                   2.0 * (input.size - 1) / input.size * K * samples * sizeof(float));
+            if (input.compressVerify)
             {
-                localAuxCentroids[cluster * samples + j] += data[(startLine + i) * samples + j];
+                printf(", largest centroid drift %g", run.drift);
             }
         }
-
-        MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, localAuxCentroids, K * samples, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD));
-        MPI_CHECK_RETURN(MPI_Wait(&req, MPI_STATUS_IGNORE));
-
-        for (i = 0; i < centroidOffset; i++)
+        if (input.sharded)
         {
-            cluster = startCentroid + i;
-            for (j = 0; j < samples; j++)
-            {
-                localAuxCentroids[cluster * samples + j] /= pointsPerClass[cluster];
-            }
+            // Every process holds its shard, two shards in transit and three blocks of partial sums; the root
+            // also holds all the centroids, twice with restarts
+            printf("\nSharded centroids: %d of %d centroids per process at most, %.0f bytes of centroids and sums "
+                   "per process plus %.0f on the root, instead of %.0f, %f seconds waiting for the ring",
+                   (K + input.size - 1) / input.size, K,
+                   6.0 * ((K + input.size - 1) / input.size) * samples * sizeof(float),
+                   (restarts > 1 ? 2.0 : 1.0) * K * samples * sizeof(float), 3.0 * K * samples * sizeof(float),
+                   run.reduceWait);
         }
-
-        // no need for barrier, the rank will work only on the auxCentroids he computed
-        // so they will necessarily be ready
-        MPI_CHECK_RETURN(MPI_Iallgatherv(
-            localAuxCentroids + startCentroid * samples, centroidOffsetPerSamples, MPI_FLOAT,
-            auxCentroids, centroidsPerProcess, centroidsDispls,
-            MPI_FLOAT, MPI_COMM_WORLD, &reqs[2]));
-
-        // 3. Compute the maximum movement of a centroid compared to its previous position
-        for (i = 0; i < centroidOffset; i++)
+        if (input.staleness > 0)
         {
-            dist = euclideanDistance(
-                &centroids[(startCentroid + i) * samples],
-                &localAuxCentroids[(startCentroid + i) * samples],
-                samples
-            );
-
-            if (dist > maxDist)
-            {
-                maxDist = dist;
-            }
+            printf("\nBounded staleness: s=%d, %d iterations, %.2f iterations per second, inertia %f, "
+                   "%f seconds waiting for slower processes",
+                   input.staleness, run.iterations, run.iterations / globalTime, run.inertia, run.reduceWait);
         }
-
-        MPI_CHECK_RETURN(MPI_Iallreduce(MPI_IN_PLACE, &maxDist, 1, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD, &reqs[1]));
-
-        memset(pointsPerClass, 0, K * sizeof(int));
-        memset(localAuxCentroids, 0.0, K * samples * sizeof(float));
-
-        MPI_CHECK_RETURN(MPI_Waitall(2, reqs, MPI_STATUS_IGNORE));
-
-        #ifdef DEBUG
-            if(rank == 0)
+        if (input.persistent)
+        {
+            printf("\nPersistent collectives: %s", run.persistent ? "used" : "not supported, non-blocking calls used");
+        }
+        if (input.rebalance > 0.0f)
+        {
+            printf("\nLoad balance: %d rebalances, straggler gap %f seconds per iteration before the first, %f in "
+                   "the %d iterations after the last", run.rebalances, run.gapBefore, run.gapAfter, run.gapIterations);
+        }
+        if (sharedMemory)
+        {
+            // Ring estimate of the bytes sent by each node leader: allreduce of K x samples floats
+            printf("\nCentroid update traffic: %.0f bytes per node leader per iteration, %d nodes",
+                   2.0 * (input.nodes.nodes - 1) / input.nodes.nodes * K * samples * sizeof(float),
+                   input.nodes.nodes);
+        }
+        else
+        {
+            // Ring estimate of the bytes sent by each process: reduce-scatter and allgather of K x samples floats
+            printf("\nCentroid update traffic: %.0f bytes per process per iteration",
+                   2.0 * (input.size - 1) / input.size * K * samples * sizeof(float));
+        }
+        if (input.indexAssign)
+        {
+            printf("\nCentroid index: %d lists, %d probes on rank 0, final-assignment recall %.4f%%", run.indexLists,
+                   run.indexProbes, 100.0 - 100.0 * run.indexMismatches / lines);
+            if (run.lloydMismatches >= 0)
             {
-                sprintf(line, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", it, changes, maxDist);
-                outputMsg = strcat(outputMsg, line);
+                printf(", %.4f%% of labels differ from exact Lloyd", 100.0 * run.lloydMismatches / lines);
             }
-        #endif
-
-        anotherIteration = (changes > minChanges) && (it < maxIterations) && (maxDist > maxThreshold);
-        changes = 0;
-        maxDist = FLT_MIN;
-        it++;
-
-        MPI_CHECK_RETURN(MPI_Wait(&reqs[2], MPI_STATUS_IGNORE));
-        memcpy(centroids, auxCentroids, K * samples * sizeof(float));
-    }
-    while (anotherIteration);
-    it--;
-
-    // 5. Gather to the root process all the information that will be written in the output file
-    MPI_CHECK_RETURN(MPI_Waitall(2, workSplit, MPI_STATUS_IGNORE));
-    MPI_CHECK_RETURN(MPI_Igatherv(
-        localClassMap, lineOffset,
-        MPI_INT, classMap, linesPerProcess,
-        displacementPerProcess, MPI_INT, 0, MPI_COMM_WORLD, &req
-    ));
-
-    //END CLOCK*****************************************
-    end = MPI_Wtime();
-    localTime = end - start;
-    MPI_Reduce(&localTime, &globalTime, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
-    if (rank == 0)
-    {
-        #ifdef DEBUG
-        printf("%s", outputMsg);
-        printf("\nComputation: %f seconds", globalTime);
-        if (changes <= minChanges)
+        }
+        if (input.pdsAssign)
         {
-            printf("\n\nTermination condition:\nMinimum number of changes reached: %d [%d]", changes, minChanges);
+            printf("\nPartial distance search: %.2f%% of distance FLOPs avoided",
+                   100.0 * (1.0 - (double)run.pdsEvaluated / ((double)run.iterations * lines * K * samples)));
         }
-        else if (it >= maxIterations)
+        if (input.sketchAssign)
         {
-            printf("\n\nTermination condition:\nMaximum number of iterations reached: %d [%d]", it, maxIterations);
+            printf("\nRandom projection: %.2f%% of exact distances avoided, %d labels fixed by verification",
+                   100.0 * (1.0 - (double)run.sketchEvaluated / ((double)run.iterations * lines * K)),
+                   run.sketchMismatches);
+        }
+        if (run.changes <= minChanges)
+        {
+            printf("\n\nTermination condition:\nMinimum number of changes reached: %d [%d]", run.changes, minChanges);
+        }
+        else if (run.iterations >= maxIterations)
+        {
+            printf("\n\nTermination condition:\nMaximum number of iterations reached: %d [%d]", run.iterations,
+                   maxIterations);
         }
         else
         {
-            printf("\n\nTermination condition:\nCentroid update precision reached: %g [%g]", maxDist, maxThreshold);
+            printf("\n\nTermination condition:\nCentroid update precision reached: %g [%g]", run.maxDist, maxThreshold);
         }
-        free(outputMsg);
         #else
         printf("%f", globalTime);
         #endif
         fflush(stdout);
     }
+    free(outputMsg.text);
+    if (perfMode)
+    {
+        // On stderr, stdout keeps only the time
+        KMeansLog counters = { NULL, 0, 0 };
+        if (gatherPerf(&perf, lines, samples, K, &counters) != 0)
+        {
+            fprintf(stderr, "Memory allocation error.\n");
+        }
+        else if (rank == 0 && counters.length > 0)
+        {
+            fprintf(stderr, "%s\n", logText(&counters) + 1);
+            fflush(stderr);
+        }
+        free(counters.text);
+    }
     //**************************************************
     //START CLOCK***************************************
     MPI_Barrier(MPI_COMM_WORLD);
@@ -553,35 +2192,49 @@ int main(int argc, char* argv[])
 
     if (rank == 0)
     {
-        MPI_Wait(&req, MPI_STATUS_IGNORE);
         error = writeResult(classMap, lines, argv[6]);
         if (error != 0)
         {
             showFileError(error, argv[6]);
             MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
         }
-
-        free(linesPerProcess);
-        free(displacementPerProcess);
-        free(classMap);
+    }
+    if (traceFile != NULL)
+    {
+        trace.seconds[PHASE_LOAD] = loadSeconds;
+        trace.seconds[PHASE_INIT] = initSeconds;
+        trace.seconds[PHASE_WRITE] = MPI_Wtime() - start;
+        error = gatherTrace(&trace, traceFile);
+        if (error == -3)
+        {
+            showFileError(error, (char*)traceFile);
+        }
+        else if (error == -4)
+        {
+            fprintf(stderr, "Memory allocation error.\n");
+        }
+        freeTrace(&trace);
     }
 
     //Free memory
-    free(centroidsPerProcess);
-    free(centroidsDispls);
-    free(pointsPerClass);
-    free(auxCentroids);
-    free(localAuxCentroids);
-    free(localClassMap);
-    free(data);
+    freeInput(&input);
+    if (comm != MPI_COMM_WORLD)
+    {
+        MPI_Comm_free(&comm);
+    }
+    free(sweepClustersList);
+    free(classMap);
+    if (sharedMemory)
+    {
+        freeShared(&dataWin);
+        freeNodes(&nodes);
+    }
+    else
+    {
+        free(data);
+    }
     free(centroidPos);
     free(centroids);
-    MPI_Request_free(&req);
-    MPI_Request_free(&reqs[0]);
-    MPI_Request_free(&reqs[1]);
-    MPI_Request_free(&reqs[2]);
-    MPI_Request_free(&workSplit[0]);
-    MPI_Request_free(&workSplit[1]);
 
     //END CLOCK*****************************************
     #ifdef DEBUG
@@ -1,7 +1,7 @@
 /*
  * k-Means clustering algorithm
  *
- * OpenMP version
+ * OpenMP version (command line over libkmeans)
  *
  * Parallel computing (Degree in Computer Engineering)
  * 2022/2023
@@ -16,168 +16,10 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
-#include <math.h>
-#include <time.h>
 #include <string.h>
-#include <float.h>
 #include <omp.h>
-#include <assert.h>
-
-#define MAXLINE 2000
-#define MAXCAD 200
-
-//Macros
-#define MIN(a,b) ((a) < (b) ? (a) : (b))
-#define MAX(a,b) ((a) > (b) ? (a) : (b))
-
-/*
-Function showFileError: It displays the corresponding error during file reading.
-*/
-void showFileError(int error, char* filename)
-{
-    printf("Error\n");
-    switch (error)
-    {
-    case -1:
-        fprintf(stderr, "\tFile %s has too many columns.\n", filename);
-        fprintf(stderr, "\tThe maximum number of columns has been exceeded. MAXLINE: %d.\n", MAXLINE);
-        break;
-    case -2:
-        fprintf(stderr, "Error reading file: %s.\n", filename);
-        break;
-    case -3:
-        fprintf(stderr, "Error writing file: %s.\n", filename);
-        break;
-    }
-    fflush(stderr);
-}
-
-/*
-Function readInput: It reads the file to determine the number of rows and columns.
-*/
-int readInput(char* filename, int* lines, int* samples)
-{
-    FILE* fp;
-    char line[MAXLINE] = "";
-    char* ptr;
-    const char* delim = "\t";
-    int contlines, contsamples = 0;
-
-    contlines = 0;
-
-    if ((fp = fopen(filename, "r")) != NULL)
-    {
-        while (fgets(line, MAXLINE, fp) != NULL)
-        {
-            if (strchr(line, '\n') == NULL)
-            {
-                return -1;
-            }
-            contlines++;
-            ptr = strtok(line, delim);
-            contsamples = 0;
-            while (ptr != NULL)
-            {
-                contsamples++;
-                ptr = strtok(NULL, delim);
-            }
-        }
-        fclose(fp);
-        *lines = contlines;
-        *samples = contsamples;
-        return 0;
-    }
-    else
-    {
-        return -2;
-    }
-}
-
-/*
-Function readInput2: It loads data from file.
-*/
-int readInput2(char* filename, float* data)
-{
-    FILE* fp;
-    char line[MAXLINE] = "";
-    char* ptr;
-    const char* delim = "\t";
-    int i = 0;
-
-    if ((fp = fopen(filename, "rt")) != NULL)
-    {
-        while (fgets(line, MAXLINE, fp) != NULL)
-        {
-            ptr = strtok(line, delim);
-            while (ptr != NULL)
-            {
-                data[i] = atof(ptr);
-                i++;
-                ptr = strtok(NULL, delim);
-            }
-        }
-        fclose(fp);
-        return 0;
-    }
-    else
-    {
-        return -2; //No file found
-    }
-}
-
-/*
-Function writeResult: It writes in the output file the cluster of each sample (point).
-*/
-int writeResult(int* classMap, int lines, const char* filename)
-{
-    FILE* fp;
-
-    if ((fp = fopen(filename, "wt")) != NULL)
-    {
-        for (int i = 0; i < lines; i++)
-        {
-            fprintf(fp, "%d\n", classMap[i]);
-        }
-        fclose(fp);
-
-        return 0;
-    }
-    else
-    {
-        return -3; //No file found
-    }
-}
-
-/*
-
-Function initCentroids: This function copies the values of the initial centroids, using their
-position in the input data structure as a reference map.
-*/
-void initCentroids(const float* data, float* centroids, int* centroidPos, int samples, int K)
-{
-    int i;
-    int idx;
-    for (i = 0; i < K; i++)
-    {
-        idx = centroidPos[i];
-        memcpy(&centroids[i * samples], &data[idx * samples], (samples * sizeof(float)));
-    }
-}
-
-/*
-Function euclideanDistance: Euclidean distance
-This function could be modified
-*/
-float_t euclideanDistance(const float* point, const float* center, const int samples)
-{
-    float_t dist = 0.0;
-    for (int i = 0; i < samples; i++)
-    {
-        dist += (point[i] - center[i]) * (point[i] - center[i]);
-    }
-    return sqrt(dist);
-}
+#include "kmeans_common.h"
+#include "libkmeans.h"
 
 int main(int argc, char* argv[])
 {
@@ -185,11 +27,14 @@ int main(int argc, char* argv[])
     double start, end;
     start = omp_get_wtime();
     //**************************************************
+    // KMEANS_TRACE: seconds of the phases outside the library
+    double loadSeconds, initSeconds, writeSeconds, mark = start;
     /*
     * PARAMETERS
     *
     * argv[1]: Input data file
-    * argv[2]: Number of clusters
+    * argv[2]: Number of clusters. A list ("4,8,16") or a range ("2:10" or "2:10:2") runs one clustering
+    *          per number of clusters on the same input.
     * argv[3]: Maximum number of iterations of the method. Algorithm termination condition.
     * argv[4]: Minimum percentage of class changes. Algorithm termination condition.
     *          If between one iteration and the next, the percentage of class changes is less than
@@ -222,26 +67,52 @@ int main(int argc, char* argv[])
     }
 
     const int lines = tmpLines, samples = tmpSamples;
+    loadSeconds = omp_get_wtime() - mark;
 
-    float* data = (float*)calloc(lines * samples, sizeof(float));
-    if (data == NULL)
+    // Parameters
+    int sweepCount = 0;
+    int* sweepClustersList = parseClusters(argv[2], &sweepCount);
+    if (sweepClustersList == NULL)
+    {
+        fprintf(stderr, "EXECUTION ERROR K-MEANS: Wrong number of clusters: %s\n", argv[2]);
+        fflush(stderr);
+        exit(-1);
+    }
+    const int K = sweepClustersList[0];
+    KMeansParams params;
+    kmeansDefaultParams(&params);
+    params.maxIterations = atoi(argv[3]);
+    params.minChanges = (int)(lines * atof(argv[4]) / 100.0);
+    params.maxThreshold = atof(argv[5]);
+
+    // The rows are allocated by the context, so that they can be first touched by their thread
+    KMeansContext* context = kmeansContextCreate(NULL, lines, samples, &params);
+    if (context == NULL)
     {
         fprintf(stderr, "Memory allocation error.\n");
         exit(-4);
     }
+    float* data = kmeansContextRows(context);
+    mark = omp_get_wtime();
     error = readInput2(argv[1], data);
     if (error != 0)
     {
         showFileError(error, argv[1]);
         exit(error);
     }
+    loadSeconds += omp_get_wtime() - mark;
 
-    // Parameters
-    const int K = atoi(argv[2]);
-    int maxIterations = atoi(argv[3]);
-    int minChanges = (int)(lines * atof(argv[4]) / 100.0);
-    float maxThreshold = atof(argv[5]);
-
+    if (sweepCount > 1)
+    {
+        error = kmeansContextSweep(context, sweepClustersList, sweepCount, argv[6]);
+        if (error == -4)
+        {
+            fprintf(stderr, "Memory allocation error.\n");
+        }
+        kmeansContextFree(context);
+        free(sweepClustersList);
+        exit(error);
+    }
 
     int* centroidPos = (int*)calloc(K, sizeof(int));
     float* centroids = (float*)calloc(K * samples, sizeof(float));
@@ -262,150 +133,100 @@ int main(int argc, char* argv[])
     // The centroids are points stored in the data array.
     initCentroids(data, centroids, centroidPos, samples, K);
 
+    // KMEANS_PRIOR: classes of the first rows and centroids (KMEANS_PRIOR_CENTROIDS) of a previous run,
+    // before rows were appended to the input. The centroids alone replace the initial ones.
+    const char* RAW_KMEANS_PRIOR = getenv("KMEANS_PRIOR");
+    const char* RAW_KMEANS_PRIOR_CENTROIDS = getenv("KMEANS_PRIOR_CENTROIDS");
+    int priorLines = -1;
+    if (RAW_KMEANS_PRIOR != NULL || RAW_KMEANS_PRIOR_CENTROIDS != NULL)
+    {
+        int priorK = 0, priorSamples = 0;
+        if (RAW_KMEANS_PRIOR_CENTROIDS == NULL ||
+            (error = readInput((char*)RAW_KMEANS_PRIOR_CENTROIDS, &priorK, &priorSamples)) != 0 ||
+            (error = priorK != K || priorSamples != samples ? -1 : 0) != 0 ||
+            (error = readInput2((char*)RAW_KMEANS_PRIOR_CENTROIDS, centroids)) != 0)
+        {
+            fprintf(stderr, "EXECUTION ERROR K-MEANS: KMEANS_PRIOR_CENTROIDS must hold %d centroids of %d values.\n",
+                    K, samples);
+            exit(error != 0 ? error : -1);
+        }
+    }
+    if (RAW_KMEANS_PRIOR != NULL)
+    {
+        priorLines = readResult(classMap, lines, RAW_KMEANS_PRIOR);
+        if (priorLines < 0)
+        {
+            showFileError(priorLines, (char*)RAW_KMEANS_PRIOR);
+            exit(priorLines);
+        }
+    }
+
     #ifdef DEBUG
     printf("\n\tData file: %s \n\tPoints: %d\n\tDimensions: %d\n", argv[1], lines, samples);
     printf("\tNumber of clusters: %d\n", K);
-    printf("\tMaximum number of iterations: %d\n", maxIterations);
-    printf("\tMinimum number of changes: %d [%g%% of %d points]\n", minChanges, atof(argv[4]), lines);
-    printf("\tMaximum centroid precision: %f\n", maxThreshold);
+    printf("\tMaximum number of iterations: %d\n", params.maxIterations);
+    printf("\tMinimum number of changes: %d [%g%% of %d points]\n", params.minChanges, atof(argv[4]), lines);
+    printf("\tMaximum centroid precision: %f\n", params.maxThreshold);
 
     //END CLOCK*****************************************
     end = omp_get_wtime();
     printf("\nMemory allocation: %f seconds\n", end - start);
     fflush(stdout);
     //**************************************************
-
-    char* outputMsg = (char*)calloc(10000, sizeof(char));
-    char line[100];
     #endif
 
+    initSeconds = omp_get_wtime() - start - loadSeconds;
     //START CLOCK***************************************
     start = omp_get_wtime();
     //**************************************************
-    // Get the number of threads that will be spawned
-    const char* RAW_OMP_NUM_THREADS = getenv("OMP_NUM_THREADS");
-    const int OMP_NUM_THREADS = (RAW_OMP_NUM_THREADS != NULL) ? (atoi(RAW_OMP_NUM_THREADS)) : omp_get_max_threads();
-
-    int i, j, cluster;
-    int changes = 0;
-    int anotherIteration = 0;
-    int it = 1;
-    int auxCentroidsSize = K * samples;
-    float_t dist, minDist = FLT_MAX, maxDist = FLT_MIN;
-
-    // pointPerClass: number of points classified in each class
-    // auxCentroids: mean of the points in each class
-    int* pointsPerClass = calloc(K, sizeof(int));
-    float* auxCentroids = calloc(auxCentroidsSize, sizeof(float));
-    assert(pointsPerClass != NULL && auxCentroids != NULL);
-
-    memset(auxCentroids, 0.0, auxCentroidsSize * sizeof(float));
-    memset(pointsPerClass, 0, K * sizeof(int));
-
-    # pragma omp parallel num_threads(OMP_NUM_THREADS) private(i, j, cluster, dist, minDist)
+    error = priorLines >= 0 ? kmeansContextRefit(context, K, centroids, classMap, priorLines)
+                            : kmeansContextFit(context, K, centroids, classMap);
+    if (error == -1)
     {
-        do
-        {
-            // 1. Assign each point to a class and count the elements in each class
-            # pragma omp for nowait reduction(+:changes, pointsPerClass[:K])
-            for (i = 0; i < lines; i++)
-            {
-                cluster = 1, minDist = FLT_MAX;
-                for (j = 0; j < K; j++)
-                {
-                    dist = euclideanDistance(&data[i * samples], &centroids[j * samples], samples);
-
-                    if (dist < minDist)
-                    {
-                        minDist = dist;
-                        cluster = j + 1;
-                    }
-                }
-
-                if (classMap[i] != cluster)
-                {
-                    classMap[i] = cluster;
-                    changes++;
-                }
-                pointsPerClass[cluster - 1]++;
-            }
-            // No need of implicit barrier, each thread will work on the classMap section that it has calculated.
-
-            // 2. Compute the partial sum of all the coordinates of point within the same cluster
-            # pragma omp for reduction(+:auxCentroids[:auxCentroidsSize])
-            for (i = 0; i < lines; i++)
-            {
-                cluster = classMap[i] - 1;
-                for (j = 0; j < samples; j++)
-                {
-                    auxCentroids[cluster * samples + j] += data[i * samples + j];
-                }
-            }
-
-            # pragma omp for nowait
-            for (i = 0; i < K; i++)
-            {
-                for (j = 0; j < samples; j++)
-                {
-                    auxCentroids[i * samples + j] /= pointsPerClass[i];
-                }
-            }
-            // No need of implicit barrier, each thread will work on the auxCentroids section that it has calculated.
-
-            // 3. Get the maximum movement of a centroid compared to its previous position
-            # pragma omp for reduction(max:maxDist)
-            for (i = 0; i < K; i++)
-            {
-                dist = euclideanDistance(&centroids[i * samples], &auxCentroids[i * samples], samples);
-
-                if (dist > maxDist)
-                {
-                    maxDist = dist;
-                }
-                pointsPerClass[i] = 0;
-            }
-
-            // 4. Check termination conditions and clean memory for the next iteration
-            # pragma omp single
-            {
-                #ifdef DEBUG
-                sprintf(line, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", it, changes, maxDist);
-                outputMsg = strcat(outputMsg, line);
-                #endif
-
-                anotherIteration = (changes > minChanges) && (it < maxIterations) && (maxDist > maxThreshold);
-                maxDist = FLT_MIN;
-                changes = 0;
-                memcpy(centroids, auxCentroids, (auxCentroidsSize * sizeof(float)));
-                memset(auxCentroids, 0.0, auxCentroidsSize * sizeof(float));
-                it++;
-            }
-        }
-        while (anotherIteration);
+        fprintf(stderr, "EXECUTION ERROR K-MEANS: The classes of %s are not in 1..%d.\n", RAW_KMEANS_PRIOR, K);
+        exit(error);
+    }
+    if (error != 0)
+    {
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(-4);
     }
-    it--;
     //END CLOCK*****************************************
     end = omp_get_wtime();
     #ifdef DEBUG
-    printf("%s", outputMsg);
+    KMeansResult run;
+    char details[1000];
+    kmeansContextResult(context, &run);
+    kmeansContextDescribe(context, details, sizeof(details));
+    printf("%s", kmeansContextLog(context));
     printf("\nComputation: %f seconds", end - start);
-    if (changes <= minChanges)
+    printf("%s", details);
+    if (run.changes <= params.minChanges)
     {
-        printf("\n\nTermination condition:\nMinimum number of changes reached: %d [%d]", changes, minChanges);
+        printf("\n\nTermination condition:\nMinimum number of changes reached: %d [%d]", run.changes,
+               params.minChanges);
     }
-    else if (it >= maxIterations)
+    else if (run.iterations >= params.maxIterations)
     {
-        printf("\n\nTermination condition:\nMaximum number of iterations reached: %d [%d]", it, maxIterations);
+        printf("\n\nTermination condition:\nMaximum number of iterations reached: %d [%d]", run.iterations,
+               params.maxIterations);
     }
     else
     {
-        printf("\n\nTermination condition:\nCentroid update precision reached: %g [%g]", maxDist, maxThreshold);
+        printf("\n\nTermination condition:\nCentroid update precision reached: %g [%g]", run.maxDist,
+               params.maxThreshold);
     }
-    free(outputMsg);
     #else
     printf("%f", end - start);
     #endif
     fflush(stdout);
+    // KMEANS_PERF: summary of the counters on stderr, stdout keeps only the time
+    const char* counters = kmeansContextCounters(context);
+    if (counters[0] != '\0')
+    {
+        fprintf(stderr, "%s\n", counters + 1);
+        fflush(stderr);
+    }
     //**************************************************
     //START CLOCK***************************************
     start = omp_get_wtime();
@@ -418,14 +239,28 @@ int main(int argc, char* argv[])
         showFileError(error, argv[6]);
         exit(error);
     }
+    // KMEANS_CENTROIDS: the final centroids, in the input format, for KMEANS_predict
+    const char* RAW_KMEANS_CENTROIDS = getenv("KMEANS_CENTROIDS");
+    if (RAW_KMEANS_CENTROIDS != NULL && (error = writeCentroids(centroids, K, samples, RAW_KMEANS_CENTROIDS)) != 0)
+    {
+        showFileError(error, (char*)RAW_KMEANS_CENTROIDS);
+        exit(error);
+    }
+    writeSeconds = omp_get_wtime() - start;
+    const char* RAW_KMEANS_TRACE = getenv("KMEANS_TRACE");
+    if (RAW_KMEANS_TRACE != NULL && RAW_KMEANS_TRACE[0] != '\0' &&
+        kmeansContextWriteTrace(context, RAW_KMEANS_TRACE, loadSeconds, initSeconds, writeSeconds) == -3)
+    {
+        showFileError(-3, (char*)RAW_KMEANS_TRACE);
+        exit(-3);
+    }
 
     //Free memory
-    free(data);
+    kmeansContextFree(context);
+    free(sweepClustersList);
     free(classMap);
     free(centroidPos);
     free(centroids);
-    free(pointsPerClass);
-    free(auxCentroids);
     //END CLOCK*****************************************
     #ifdef DEBUG
     end = omp_get_wtime();
@@ -0,0 +1,366 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Predict version: labels streams of new points with trained centroids (command line over libkmeans),
+ * optionally updating the centroids with every batch (online k-means)
+ *
+ * Parallel computing (Degree in Computer Engineering)
+ * 2022/2023
+ *
+ * Version: 1.0
+ *
+ * (c) 2022 Diego García-Álvarez, Arturo Gonzalez-Escribano
+ * Grupo Trasgo, Universidad de Valladolid (Spain)
+ *
+ * This work is licensed under a Creative Commons Attribution-ShareAlike 4.0 International License.
+ * https://creativecommons.org/licenses/by-sa/4.0/
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <omp.h>
+#include "kmeans_common.h"
+#include "libkmeans.h"
+
+// Largest batch accepted, in points
+#define PREDICT_MAX_BATCH (1 << 24)
+
+/*
+ * Batches served by the process
+ */
+typedef struct
+{
+    double* latencies;    // seconds of each batch, from its last byte read to its last label written
+    int batches;
+    int capacity;
+    long points;
+} PredictStats;
+
+/*
+ * Online mode: centroids updated with the points of every batch, written out periodically
+ */
+typedef struct
+{
+    int enabled;                // KMEANS_ONLINE=1
+    float decay;                // KMEANS_ONLINE_DECAY: weight kept by the previous points at each batch
+    int every;                  // KMEANS_ONLINE_EVERY: batches between two writes of the outputs
+    const char* centroidsFile;  // KMEANS_CENTROIDS: rewritten with the current centroids
+    FILE* labels;               // KMEANS_LABELS: class of every point received, one per line
+} PredictOnline;
+
+/*
+Function readFull: Reads size bytes from fd. Returns 1 when all of them were read, 0 at the end of
+the stream or on error.
+*/
+static int readFull(int fd, void* buffer, size_t size)
+{
+    char* next = buffer;
+    ssize_t got;
+    while (size > 0)
+    {
+        if ((got = read(fd, next, size)) <= 0)
+        {
+            return 0;
+        }
+        next += got;
+        size -= got;
+    }
+    return 1;
+}
+
+/*
+Function writeFull: Writes size bytes to fd. Returns 1 when all of them were written, 0 on error.
+*/
+static int writeFull(int fd, const void* buffer, size_t size)
+{
+    const char* next = buffer;
+    ssize_t put;
+    while (size > 0)
+    {
+        if ((put = write(fd, next, size)) <= 0)
+        {
+            return 0;
+        }
+        next += put;
+        size -= put;
+    }
+    return 1;
+}
+
+/*
+Function compareSeconds: Order of two latencies for qsort.
+*/
+static int compareSeconds(const void* a, const void* b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+Function writeOutputs: Writes the current centroids to a temporary file that then replaces the
+centroids file, so that its readers never see a partial one, and flushes the labels file.
+Returns 0 on success and -3 if a file could not be written.
+*/
+static int writeOutputs(const KMeansContext* context, int samples, const PredictOnline* online)
+{
+    char temporary[MAXLINE];
+    int K;
+    const float* centroids = kmeansContextCentroids(context, &K);
+
+    if (online->labels != NULL && fflush(online->labels) != 0)
+    {
+        return -3;
+    }
+    if (!online->enabled || online->centroidsFile == NULL)
+    {
+        return 0;
+    }
+    snprintf(temporary, sizeof(temporary), "%s.tmp", online->centroidsFile);
+    if (writeCentroids(centroids, K, samples, temporary) != 0 || rename(temporary, online->centroidsFile) != 0)
+    {
+        return -3;
+    }
+    return 0;
+}
+
+/*
+Function serveStream: Labels the batches read from in and writes their labels to out. A batch is
+an int with its number of points followed by that many points of samples floats, and its answer
+is one int per point. A batch of 0 points (or the end of the stream) ends the stream, and a
+negative number of points also asks the server to stop. In the online mode every batch also
+updates the centroids, which are written every online->every batches.
+Returns 1 when asked to stop, 0 at the end of the stream, -3 if an output could not be written and
+-4 if the memory could not be allocated.
+*/
+static int serveStream(KMeansContext* context, int samples, int in, int out, const PredictOnline* online,
+                       PredictStats* stats)
+{
+    float* points = NULL;
+    int* labels = NULL;
+    int count, capacity = 0, error = 0;
+    double start;
+
+    while (error == 0 && readFull(in, &count, sizeof(int)) && count > 0 && count <= PREDICT_MAX_BATCH)
+    {
+        if (count > capacity)
+        {
+            free(points);
+            free(labels);
+            capacity = count;
+            points = malloc((long)capacity * samples * sizeof(float));
+            labels = malloc(capacity * sizeof(int));
+            if (points == NULL || labels == NULL)
+            {
+                error = -4;
+                break;
+            }
+        }
+        if (!readFull(in, points, (long)count * samples * sizeof(float)))
+        {
+            break;
+        }
+
+        start = omp_get_wtime();
+        error = online->enabled ? kmeansContextUpdate(context, points, count, online->decay, labels)
+                                : kmeansContextPredict(context, points, count, labels);
+        if (error != 0 || !writeFull(out, labels, count * sizeof(int)))
+        {
+            break;
+        }
+        for (int i = 0; online->labels != NULL && i < count; i++)
+        {
+            fprintf(online->labels, "%d\n", labels[i]);
+        }
+        if (stats->batches == stats->capacity)
+        {
+            stats->capacity = stats->capacity > 0 ? 2 * stats->capacity : 1024;
+            stats->latencies = realloc(stats->latencies, stats->capacity * sizeof(double));
+            if (stats->latencies == NULL)
+            {
+                error = -4;
+                break;
+            }
+        }
+        stats->latencies[stats->batches++] = omp_get_wtime() - start;
+        stats->points += count;
+
+        if (online->every > 0 && stats->batches % online->every == 0)
+        {
+            error = writeOutputs(context, samples, online);
+        }
+    }
+
+    free(points);
+    free(labels);
+    if (error != 0)
+    {
+        return error;
+    }
+    return count < 0 ? 1 : 0;
+}
+
+/*
+Function serveSocket: Listens on a Unix-domain socket at path and serves its connections one after
+another until a client asks to stop. Returns 0, -3 if the socket could not be opened or -4.
+*/
+static int serveSocket(KMeansContext* context, int samples, const char* path, const PredictOnline* online,
+                       PredictStats* stats)
+{
+    struct sockaddr_un address;
+    int server, client, result = 0;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path) || (server = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        return -3;
+    }
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(server, 4) != 0)
+    {
+        close(server);
+        return -3;
+    }
+
+    while (result == 0 && (client = accept(server, NULL, NULL)) >= 0)
+    {
+        result = serveStream(context, samples, client, client, online, stats);
+        close(client);
+    }
+    close(server);
+    unlink(path);
+    return result < 0 ? result : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    /*
+    * PARAMETERS
+    *
+    * argv[1]: Centroids file, one centroid per line in the input format (KMEANS_CENTROIDS of KMEANS_omp).
+    * argv[2]: Optional Unix-domain socket to listen on. Without it the batches are read from stdin
+    *          and the labels written to stdout.
+    * */
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "EXECUTION ERROR K-MEANS: Parameters are not correct.\n");
+        fprintf(stderr, "./KMEANS_predict [Centroids Filename] [Optional socket path]\n");
+        fflush(stderr);
+        exit(-1);
+    }
+
+    // Reading the centroids: K lines of samples values
+    int K = 0, samples = 0;
+    int error = readInput(argv[1], &K, &samples);
+    if (error != 0)
+    {
+        showFileError(error, argv[1]);
+        exit(error);
+    }
+    float* centroids = (float*)calloc((long)K * samples, sizeof(float));
+    if (centroids == NULL)
+    {
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(-4);
+    }
+    error = readInput2(argv[1], centroids);
+    if (error != 0)
+    {
+        showFileError(error, argv[1]);
+        exit(error);
+    }
+
+    // A context without rows, only for predicting
+    KMeansContext* context = kmeansContextCreate(NULL, 0, samples, NULL);
+    if (context == NULL || kmeansContextSetCentroids(context, K, centroids) != 0)
+    {
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(-4);
+    }
+
+    // Online mode: the centroids follow the points received
+    const char* RAW_KMEANS_ONLINE = getenv("KMEANS_ONLINE");
+    const char* RAW_KMEANS_ONLINE_DECAY = getenv("KMEANS_ONLINE_DECAY");
+    const char* RAW_KMEANS_ONLINE_EVERY = getenv("KMEANS_ONLINE_EVERY");
+    const char* RAW_KMEANS_LABELS = getenv("KMEANS_LABELS");
+    PredictOnline online;
+    online.enabled = (RAW_KMEANS_ONLINE != NULL) && (atoi(RAW_KMEANS_ONLINE) != 0);
+    online.decay = (RAW_KMEANS_ONLINE_DECAY != NULL) ? atof(RAW_KMEANS_ONLINE_DECAY) : 1.0f;
+    online.every = (RAW_KMEANS_ONLINE_EVERY != NULL) ? atoi(RAW_KMEANS_ONLINE_EVERY) : 100;
+    online.centroidsFile = getenv("KMEANS_CENTROIDS");
+    online.labels = NULL;
+    if (online.enabled && !(online.decay > 0.0f && online.decay <= 1.0f))
+    {
+        fprintf(stderr, "KMEANS_ONLINE_DECAY must be in (0, 1].\n");
+        exit(-1);
+    }
+    if (RAW_KMEANS_LABELS != NULL && (online.labels = fopen(RAW_KMEANS_LABELS, "a")) == NULL)
+    {
+        fprintf(stderr, "Error writing file: %s.\n", RAW_KMEANS_LABELS);
+        exit(-3);
+    }
+
+    // A client that goes away is the end of its stream, not of the process
+    signal(SIGPIPE, SIG_IGN);
+    PredictStats stats = { NULL, 0, 0, 0 };
+    double start = omp_get_wtime();
+    if (argc == 3)
+    {
+        error = serveSocket(context, samples, argv[2], &online, &stats);
+    }
+    else
+    {
+        error = serveStream(context, samples, STDIN_FILENO, STDOUT_FILENO, &online, &stats);
+        error = error < 0 ? error : 0;
+    }
+    if (error == 0)
+    {
+        error = writeOutputs(context, samples, &online);
+    }
+    double elapsed = omp_get_wtime() - start;
+    if (error == -3)
+    {
+        fprintf(stderr, "Error opening socket %s or writing the outputs.\n", argc == 3 ? argv[2] : "");
+    }
+    else if (error == -4)
+    {
+        fprintf(stderr, "Memory allocation error.\n");
+    }
+
+    // Throughput of the assignment and latency percentiles of the batches, on stderr
+    if (stats.batches > 0)
+    {
+        double busy = 0.0;
+        for (int i = 0; i < stats.batches; i++)
+        {
+            busy += stats.latencies[i];
+        }
+        qsort(stats.latencies, stats.batches, sizeof(double), compareSeconds);
+        fprintf(stderr, "Predict: %ld points in %d batches (%d clusters, %d dimensions), %f seconds\n", stats.points,
+                stats.batches, K, samples, elapsed);
+        fprintf(stderr, "Assignment: %.0f points per second, batch latency p50 %f ms, p99 %f ms\n",
+                stats.points / busy, 1000.0 * stats.latencies[(stats.batches - 1) / 2],
+                1000.0 * stats.latencies[(99 * stats.batches + 99) / 100 - 1]);
+        if (online.enabled)
+        {
+            char text[200];
+            kmeansContextDescribe(context, text, sizeof(text));
+            fprintf(stderr, "%s\n", text + (text[0] == '\n'));
+        }
+        fflush(stderr);
+    }
+
+    if (online.labels != NULL)
+    {
+        fclose(online.labels);
+    }
+    kmeansContextFree(context);
+    free(centroids);
+    free(stats.latencies);
+    return error;
+}
@@ -0,0 +1,85 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Triangle-inequality bounds for the incremental clustering of the OpenMP version
+ *
+ * When rows are appended to an input that was already clustered, most of the old rows keep their
+ * class. Every point keeps an upper bound of the distance to the centroid of its class and a lower
+ * bound of the distance to every other centroid (Hamerly's bounds). When a centroid moves by d the
+ * upper bound of its points grows by d, and the lower bounds of all the points shrink by the
+ * largest movement. A point cannot change class while its upper bound is below its lower bound or
+ * below half of the distance from its centroid to the nearest other one, so it is only compared
+ * with all the centroids when the bounds fail. New rows start without bounds, and the old rows
+ * with only the half distance test, so the classes are the ones of Lloyd's iterations started
+ * from the previous centroids.
+ */
+#ifndef KMEANS_BOUNDS_H
+#define KMEANS_BOUNDS_H
+
+#include <float.h>
+#include "kmeans_common.h"
+
+// Relative margin of the tests, for the rounding of the float distances and of the bounds
+#define BOUND_SLACK 1e-5f
+
+/*
+Function halfGap: Half of the distance from centroid c to the nearest other one of the K
+centroids (FLT_MAX when K is 1).
+*/
+static inline float halfGap(const float* centroids, int K, int samples, int c)
+{
+    float_t dist, minDist = FLT_MAX;
+    for (int j = 0; j < K; j++)
+    {
+        if (j == c)
+        {
+            continue;
+        }
+        dist = euclideanDistance(&centroids[(long)c * samples], &centroids[(long)j * samples], samples);
+        if (dist < minDist)
+        {
+            minDist = dist;
+        }
+    }
+    return K > 1 ? 0.5f * minDist : FLT_MAX;
+}
+
+/*
+Function boundsHold: 1 when a point with the given upper bound cannot be closer to another
+centroid than to the one of its class.
+*/
+static inline int boundsHold(float upper, float lower, float gap)
+{
+    const float limit = lower > gap ? lower : gap;
+    return upper < limit * (1.0f - BOUND_SLACK);
+}
+
+/*
+Function assignBounded: Nearest centroid of point (class 1..K, first minimum as in Lloyd's
+assignment), with the distance to it in upper and to the second nearest one in lower.
+*/
+static inline int assignBounded(const float* point, const float* centroids, int K, int samples, float* upper,
+                                float* lower)
+{
+    float_t dist, minDist = FLT_MAX, secondDist = FLT_MAX;
+    int cluster = 1;
+    for (int j = 0; j < K; j++)
+    {
+        dist = euclideanDistance(point, &centroids[(long)j * samples], samples);
+        if (dist < minDist)
+        {
+            secondDist = minDist;
+            minDist = dist;
+            cluster = j + 1;
+        }
+        else if (dist < secondDist)
+        {
+            secondDist = dist;
+        }
+    }
+    *upper = minDist;
+    *lower = secondDist;
+    return cluster;
+}
+
+#endif
@@ -0,0 +1,313 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Input and output helpers shared by all the versions (part of libkmeans)
+ *
+ * Parallel computing (Degree in Computer Engineering)
+ * 2022/2023
+ *
+ * Version: 1.0
+ *
+ * (c) 2022 Diego García-Álvarez, Arturo Gonzalez-Escribano
+ * Grupo Trasgo, Universidad de Valladolid (Spain)
+ *
+ * This work is licensed under a Creative Commons Attribution-ShareAlike 4.0 International License.
+ * https://creativecommons.org/licenses/by-sa/4.0/
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kmeans_common.h"
+
+/*
+Function showFileError: It displays the corresponding error during file reading.
+*/
+void showFileError(int error, char* filename)
+{
+    printf("Error\n");
+    switch (error)
+    {
+    case -1:
+        fprintf(stderr, "\tFile %s has too many columns.\n", filename);
+        fprintf(stderr, "\tThe maximum number of columns has been exceeded. MAXLINE: %d.\n", MAXLINE);
+        break;
+    case -2:
+        fprintf(stderr, "Error reading file: %s.\n", filename);
+        break;
+    case -3:
+        fprintf(stderr, "Error writing file: %s.\n", filename);
+        break;
+    }
+    fflush(stderr);
+}
+
+/*
+Function readInput: It reads the file to determine the number of rows and columns.
+*/
+int readInput(char* filename, int* lines, int* samples)
+{
+    FILE* fp;
+    char line[MAXLINE] = "";
+    char* ptr;
+    const char* delim = "\t";
+    int contlines, contsamples = 0;
+
+    contlines = 0;
+
+    if ((fp = fopen(filename, "r")) != NULL)
+    {
+        while (fgets(line, MAXLINE, fp) != NULL)
+        {
+            if (strchr(line, '\n') == NULL)
+            {
+                return -1;
+            }
+            contlines++;
+            ptr = strtok(line, delim);
+            contsamples = 0;
+            while (ptr != NULL)
+            {
+                contsamples++;
+                ptr = strtok(NULL, delim);
+            }
+        }
+        fclose(fp);
+        *lines = contlines;
+        *samples = contsamples;
+        return 0;
+    }
+    else
+    {
+        return -2;
+    }
+}
+
+/*
+Function readInput2: It loads data from file.
+*/
+int readInput2(char* filename, float* data)
+{
+    FILE* fp;
+    char line[MAXLINE] = "";
+    char* ptr;
+    const char* delim = "\t";
+    int i = 0;
+
+    if ((fp = fopen(filename, "rt")) != NULL)
+    {
+        while (fgets(line, MAXLINE, fp) != NULL)
+        {
+            ptr = strtok(line, delim);
+            while (ptr != NULL)
+            {
+                data[i] = atof(ptr);
+                i++;
+                ptr = strtok(NULL, delim);
+            }
+        }
+        fclose(fp);
+        return 0;
+    }
+    else
+    {
+        return -2; //No file found
+    }
+}
+
+/*
+Function writeResult: It writes in the output file the cluster of each sample (point).
+*/
+int writeResult(int* classMap, int lines, const char* filename)
+{
+    FILE* fp;
+
+    if ((fp = fopen(filename, "wt")) != NULL)
+    {
+        for (int i = 0; i < lines; i++)
+        {
+            fprintf(fp, "%d\n", classMap[i]);
+        }
+        fclose(fp);
+
+        return 0;
+    }
+    else
+    {
+        return -3; //No file found
+    }
+}
+
+/*
+Function readResult: It reads the classes written by writeResult, up to lines of them.
+Returns the number of classes read, or -2 if the file could not be read.
+*/
+int readResult(int* classMap, int lines, const char* filename)
+{
+    FILE* fp;
+    int read = 0;
+
+    if ((fp = fopen(filename, "r")) != NULL)
+    {
+        while (read < lines && fscanf(fp, "%d", &classMap[read]) == 1)
+        {
+            read++;
+        }
+        fclose(fp);
+
+        return read;
+    }
+    else
+    {
+        return -2;
+    }
+}
+
+/*
+Function writeCentroids: It writes the K centroids to a file in the input format, one per line with
+enough digits to read back the same floats.
+*/
+int writeCentroids(const float* centroids, int K, int samples, const char* filename)
+{
+    FILE* fp;
+
+    if ((fp = fopen(filename, "wt")) != NULL)
+    {
+        for (int i = 0; i < K; i++)
+        {
+            for (int j = 0; j < samples; j++)
+            {
+                fprintf(fp, j < samples - 1 ? "%.9g\t" : "%.9g\n", centroids[(long)i * samples + j]);
+            }
+        }
+        fclose(fp);
+
+        return 0;
+    }
+    else
+    {
+        return -3; //No file found
+    }
+}
+
+/*
+
+Function initCentroids: This function copies the values of the initial centroids, using their
+position in the input data structure as a reference map.
+*/
+void initCentroids(const float* data, float* centroids, int* centroidPos, int samples, int K)
+{
+    int i;
+    int idx;
+    for (i = 0; i < K; i++)
+    {
+        idx = centroidPos[i];
+        memcpy(&centroids[i * samples], &data[idx * samples], (samples * sizeof(float)));
+    }
+}
+
+/*
+Function drawCentroids: Initial centroids of a restart, K rows of data chosen after srand(seed).
+Seed 0 gives the initial centroids of the original code.
+*/
+void drawCentroids(const float* data, int lines, int samples, int K, unsigned int seed, float* centroids)
+{
+    srand(seed);
+    for (int i = 0; i < K; i++)
+        memcpy(&centroids[i * samples], &data[(rand() % lines) * samples], (samples * sizeof(float)));
+}
+
+/*
+Function parseClusters: Numbers of clusters given as "K", as a list "K1,K2,..." or as a range
+"first:last" or "first:last:step". Returns NULL if the argument is not valid or the memory could
+not be allocated.
+*/
+int* parseClusters(const char* arg, int* count)
+{
+    int* clusters;
+    int i, first, last, step = 1;
+    char* end;
+
+    if (strchr(arg, ':') != NULL)
+    {
+        if (sscanf(arg, "%d:%d:%d", &first, &last, &step) < 2 || first < 1 || last < first || step < 1)
+        {
+            return NULL;
+        }
+        *count = (last - first) / step + 1;
+        clusters = malloc(*count * sizeof(int));
+        for (i = 0; clusters != NULL && i < *count; i++)
+        {
+            clusters[i] = first + i * step;
+        }
+        return clusters;
+    }
+
+    *count = 1;
+    for (i = 0; arg[i] != '\0'; i++)
+    {
+        if (arg[i] == ',')
+        {
+            (*count)++;
+        }
+    }
+    clusters = malloc(*count * sizeof(int));
+    for (i = 0; clusters != NULL && i < *count; i++)
+    {
+        clusters[i] = (int)strtol(arg, &end, 10);
+        if (end == arg || clusters[i] < 1 || (*end != ',' && *end != '\0'))
+        {
+            free(clusters);
+            return NULL;
+        }
+        arg = end + 1;
+    }
+    return clusters;
+}
+
+/*
+Function appendLog: It appends a formatted message to the text of log, doubling its size when the
+message does not fit. Returns 0 on success and -4 if the memory could not be allocated, in which
+case the message is dropped.
+*/
+int appendLog(KMeansLog* log, const char* format, ...)
+{
+    va_list args;
+    int needed;
+
+    va_start(args, format);
+    needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (needed < 0)
+    {
+        return -4;
+    }
+    if (log->length + needed + 1 > log->capacity)
+    {
+        size_t capacity = log->capacity > 0 ? 2 * log->capacity : 1024;
+        while (log->length + needed + 1 > capacity)
+        {
+            capacity *= 2;
+        }
+        char* text = realloc(log->text, capacity);
+        if (text == NULL)
+        {
+            return -4;
+        }
+        log->text = text;
+        log->capacity = capacity;
+    }
+    va_start(args, format);
+    vsnprintf(log->text + log->length, log->capacity - log->length, format, args);
+    va_end(args);
+    log->length += needed;
+    return 0;
+}
+
+/*
+Function logText: The text of log, empty when nothing was appended.
+*/
+const char* logText(const KMeansLog* log)
+{
+    return log->text != NULL ? log->text : "";
+}
@@ -0,0 +1,114 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Input and output helpers shared by the sequential, OpenMP, MPI, MPI+OpenMP and CUDA versions
+ *
+ * The text files read and written by every version: one point per line with its coordinates
+ * separated by tabs, and one class per line in the output; the choice of the initial centroids and
+ * the list of numbers of clusters of a sweep. They are built once into libkmeans (kmeans_common.c)
+ * instead of being repeated in each version.
+ */
+#ifndef KMEANS_COMMON_H
+#define KMEANS_COMMON_H
+
+#include <math.h>
+#include <stddef.h>
+
+#define MAXLINE 2000
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Progress messages of the iterations, grown as needed
+ */
+typedef struct
+{
+    char* text;
+    size_t length;
+    size_t capacity;
+} KMeansLog;
+
+/*
+Function appendLog: It appends a formatted message to the text of log, growing it when needed.
+*/
+int appendLog(KMeansLog* log, const char* format, ...);
+
+/*
+Function logText: The text of log, empty when nothing was appended.
+*/
+const char* logText(const KMeansLog* log);
+
+/*
+Function showFileError: It displays the corresponding error during file reading.
+*/
+void showFileError(int error, char* filename);
+
+/*
+Function readInput: It reads the file to determine the number of rows and columns.
+*/
+int readInput(char* filename, int* lines, int* samples);
+
+/*
+Function readInput2: It loads data from file.
+*/
+int readInput2(char* filename, float* data);
+
+/*
+Function writeResult: It writes in the output file the cluster of each sample (point).
+*/
+int writeResult(int* classMap, int lines, const char* filename);
+
+/*
+Function readResult: It reads the classes written by writeResult, up to lines of them.
+*/
+int readResult(int* classMap, int lines, const char* filename);
+
+/*
+Function writeCentroids: It writes the K centroids to a file in the input format, one per line with
+enough digits to read back the same floats.
+*/
+int writeCentroids(const float* centroids, int K, int samples, const char* filename);
+
+/*
+Function initCentroids: This function copies the values of the initial centroids, using their
+position in the input data structure as a reference map.
+*/
+void initCentroids(const float* data, float* centroids, int* centroidPos, int samples, int K);
+
+/*
+Function drawCentroids: Initial centroids of a restart, K rows of data chosen after srand(seed).
+Seed 0 gives the initial centroids of the original code.
+*/
+void drawCentroids(const float* data, int lines, int samples, int K, unsigned int seed, float* centroids);
+
+/*
+Function parseClusters: Numbers of clusters given as "K", as a list "K1,K2,..." or as a range
+"first:last" or "first:last:step". Returns NULL if the argument is not valid or the memory could
+not be allocated.
+*/
+int* parseClusters(const char* arg, int* count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef __CUDACC__
+/*
+Function euclideanDistance: Euclidean distance
+Kept in the header so that the assignment loops of every version can inline it; the CUDA version
+has its own device function.
+*/
+static inline float_t euclideanDistance(const float* point, const float* center, const int samples)
+{
+    float_t dist = 0.0;
+    for (int i = 0; i < samples; i++)
+    {
+        dist += (point[i] - center[i]) * (point[i] - center[i]);
+    }
+    return sqrt(dist);
+}
+#endif
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Compressed reduction of the centroid sums for the MPI version
+ *
+ * With a large K x samples the reduction of the sums dominates the iteration on slow networks.
+ * Two encodings shrink it:
+ *  - delta: every process keeps the class of its rows at the last reduction and only the
+ *    classes that gained or lost rows somewhere are reduced, as the change of their sums. The
+ *    sums of all the classes are kept by every process between iterations, so no gather of the
+ *    new centroids is needed. After the first iterations only a few classes change.
+ *  - bf16: the local sums are rounded to bfloat16 (8 mantissa bits) and reduced with a bfloat16
+ *    sum, halving the bytes. The rounding error of each process is added to its next sums
+ *    (error feedback), so it is not lost but delayed.
+ * In verification mode the exact float sums are reduced too and the largest difference between
+ * the centroids of both paths is recorded.
+ * The including file must define MPI_CHECK_RETURN.
+ */
+#ifndef KMEANS_COMPRESS_H
+#define KMEANS_COMPRESS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#define COMPRESS_NONE 0
+#define COMPRESS_DELTA 1
+#define COMPRESS_BF16 2
+
+typedef struct
+{
+    int mode;                 // COMPRESS_NONE, COMPRESS_DELTA or COMPRESS_BF16
+    int verify;               // KMEANS_MPI_COMPRESS_VERIFY=1
+    float* globalSums;        // delta: K x samples sums of all the processes, kept between iterations
+    float* delta;             // delta: K x samples change of the local sums since the last reduction
+    int* lastClassMap;        // delta: class of each local row at the last reduction (0: none)
+    unsigned char* touched;   // delta: classes whose sums changed on some process
+    float* packed;            // delta: changes of the touched classes, one after the other
+    float* residual;          // bf16: K x samples rounding error carried to the next iteration
+    unsigned short* half;     // bf16: K x samples rounded local sums, then the owned part of the total
+    MPI_Op bf16Sum;
+    float* exact;             // verify: owned part of the exact float sums
+    double bytes;             // estimated bytes sent by this process, summed over the iterations
+    float drift;              // verify: largest difference between compressed and exact centroids
+} CompressedSums;
+
+/*
+Function compressMode: KMEANS_MPI_COMPRESS=delta|bf16.
+*/
+static int compressMode(void)
+{
+    const char* raw = getenv("KMEANS_MPI_COMPRESS");
+    if (raw != NULL && strcmp(raw, "delta") == 0)
+    {
+        return COMPRESS_DELTA;
+    }
+    if (raw != NULL && strcmp(raw, "bf16") == 0)
+    {
+        return COMPRESS_BF16;
+    }
+    return COMPRESS_NONE;
+}
+
+/*
+Function toBf16: Rounds a float to the nearest bfloat16 (ties to even).
+*/
+static inline unsigned short toBf16(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (unsigned short)(bits >> 16);
+}
+
+/*
+Function fromBf16: Exact float value of a bfloat16.
+*/
+static inline float fromBf16(unsigned short half)
+{
+    unsigned int bits = (unsigned int)half << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/*
+Function bf16SumOp: MPI reduction operator adding bfloat16 values (MPI_UNSIGNED_SHORT).
+*/
+static void bf16SumOp(void* in, void* inout, int* len, MPI_Datatype* type)
+{
+    const unsigned short* a = in;
+    unsigned short* b = inout;
+    (void)type;
+    for (int i = 0; i < *len; i++)
+    {
+        b[i] = toBf16(fromBf16(a[i]) + fromBf16(b[i]));
+    }
+}
+
+/*
+Function initCompressedSums: Allocates the buffers of the mode for K classes, rows local rows
+and an owned part of slice floats. Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int initCompressedSums(CompressedSums* c, int mode, int verify, int K, int samples, int rows, int slice)
+{
+    memset(c, 0, sizeof(*c));
+    c->mode = mode;
+    c->verify = verify && mode != COMPRESS_NONE;
+    c->bf16Sum = MPI_OP_NULL;
+    if (mode == COMPRESS_DELTA &&
+        ((c->globalSums = calloc((long)K * samples, sizeof(float))) == NULL ||
+         (c->delta = calloc((long)K * samples, sizeof(float))) == NULL ||
+         (c->lastClassMap = calloc(rows > 0 ? rows : 1, sizeof(int))) == NULL ||
+         (c->touched = malloc(K)) == NULL ||
+         (c->packed = malloc((long)K * samples * sizeof(float))) == NULL))
+    {
+        return -4;
+    }
+    if (mode == COMPRESS_BF16)
+    {
+        if ((c->residual = calloc((long)K * samples, sizeof(float))) == NULL ||
+            (c->half = malloc((long)K * samples * sizeof(unsigned short))) == NULL)
+        {
+            return -4;
+        }
+        MPI_CHECK_RETURN(MPI_Op_create(bf16SumOp, 1, &c->bf16Sum));
+    }
+    if (c->verify && (c->exact = malloc((slice > 0 ? slice : 1) * sizeof(float))) == NULL)
+    {
+        return -4;
+    }
+    return 0;
+}
+
+/*
+Function freeCompressedSums: Releases the buffers.
+*/
+static void freeCompressedSums(CompressedSums* c)
+{
+    free(c->globalSums);
+    free(c->delta);
+    free(c->lastClassMap);
+    free(c->touched);
+    free(c->packed);
+    free(c->residual);
+    free(c->half);
+    free(c->exact);
+    if (c->bf16Sum != MPI_OP_NULL)
+    {
+        MPI_Op_free(&c->bf16Sum);
+    }
+}
+
+/*
+Function reduceDelta: Adds to c->globalSums the change of the sums of every process since the
+last call and copies them to sums (K x samples). rows are the lines local rows and classMap their
+classes (1..K) in this iteration.
+*/
+static void reduceDelta(CompressedSums* c, const float* rows, const int* classMap, int lines, int K, int samples,
+                        float* sums, MPI_Comm comm)
+{
+    int i, j, cluster, count = 0, size;
+
+    memset(c->touched, 0, K);
+    for (i = 0; i < lines; i++)
+    {
+        int previous = c->lastClassMap[i] - 1;
+        cluster = classMap[i] - 1;
+        if (previous == cluster)
+        {
+            continue;
+        }
+        for (j = 0; j < samples; j++)
+        {
+            if (previous >= 0)
+            {
+                c->delta[previous * samples + j] -= rows[(long)i * samples + j];
+            }
+            c->delta[cluster * samples + j] += rows[(long)i * samples + j];
+        }
+        if (previous >= 0)
+        {
+            c->touched[previous] = 1;
+        }
+        c->touched[cluster] = 1;
+        c->lastClassMap[i] = cluster + 1;
+    }
+
+    // Classes changed on any process, then their changes packed in class order
+    MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, c->touched, K, MPI_UNSIGNED_CHAR, MPI_BOR, comm));
+    for (cluster = 0; cluster < K; cluster++)
+    {
+        if (c->touched[cluster])
+        {
+            memcpy(&c->packed[(long)count * samples], &c->delta[cluster * samples], samples * sizeof(float));
+            memset(&c->delta[cluster * samples], 0, samples * sizeof(float));
+            count++;
+        }
+    }
+    MPI_CHECK_RETURN(MPI_Allreduce(MPI_IN_PLACE, c->packed, count * samples, MPI_FLOAT, MPI_SUM, comm));
+
+    count = 0;
+    for (cluster = 0; cluster < K; cluster++)
+    {
+        if (c->touched[cluster])
+        {
+            for (j = 0; j < samples; j++)
+            {
+                c->globalSums[cluster * samples + j] += c->packed[(long)count * samples + j];
+            }
+            count++;
+        }
+    }
+    memcpy(sums, c->globalSums, (long)K * samples * sizeof(float));
+
+    // Ring allreduce of the packed changes plus the class flags
+    MPI_Comm_size(comm, &size);
+    c->bytes += K + 2.0 * (size - 1) / size * count * samples * sizeof(float);
+}
+
+/*
+Function reduceBf16: Reduces the local sums (K x samples, with the carried rounding error) in
+bfloat16 and writes the owned part of the total, counts[rank] floats, to slice.
+*/
+static void reduceBf16(CompressedSums* c, const float* localSums, float* slice, const int* counts, int K,
+                       int samples, MPI_Comm comm)
+{
+    int i, rank, size;
+    float value;
+
+    for (i = 0; i < K * samples; i++)
+    {
+        value = localSums[i] + c->residual[i];
+        c->half[i] = toBf16(value);
+        c->residual[i] = value - fromBf16(c->half[i]);
+    }
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_CHECK_RETURN(MPI_Reduce_scatter(MPI_IN_PLACE, c->half, counts, MPI_UNSIGNED_SHORT, c->bf16Sum, comm));
+    for (i = 0; i < counts[rank]; i++)
+    {
+        slice[i] = fromBf16(c->half[i]);
+    }
+
+    // Ring reduce-scatter of half the bytes plus the float gather of the new centroids
+    c->bytes += (size - 1.0) / size * K * samples * (sizeof(unsigned short) + sizeof(float));
+}
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Approximate centroid index (clustered inverted lists) shared by the OpenMP, MPI and
+ * MPI+OpenMP versions
+ *
+ * With tens of thousands of centroids every point scanning all of them dominates the run.
+ * Every iteration the centroids are grouped into about sqrt(K) inverted lists around coarse
+ * centers. A point computes its distance to the coarse centers, visits only the closest lists
+ * and compares itself with the centroids stored in them (plus its previous centroid).
+ * The number of visited lists is recalibrated every iteration on a sample of points, as the
+ * smallest value for which the recall target (fraction of sample points whose exact nearest
+ * centroid is found) is met.
+ *
+ * The build costs about K * sqrt(K) distances, much less than the lines * K of an assignment.
+ * The functions may be called from inside a parallel region (every thread must call them)
+ * or from sequential code.
+ */
+#ifndef KMEANS_INDEX_H
+#define KMEANS_INDEX_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#define INDEX_DEFAULT_RECALL 0.99f
+#define INDEX_SAMPLE 256
+
+typedef struct
+{
+    int lists;        // number of inverted lists
+    int probes;       // lists visited by each point, recalibrated every iteration
+    int sample;       // points used to calibrate probes
+    float recall;     // target fraction of sample points whose exact nearest centroid is found
+    float* coarse;    // lists x samples, center of each list
+    int* owner;       // list of each centroid
+    int* start;       // lists + 1 offsets of each list in members
+    int* members;     // centroids sorted by list
+    int* needed;      // lists a sample point must visit to find its exact nearest centroid
+} CentroidIndex;
+
+/*
+Function indexReference: KMEANS_INDEX_REFERENCE=1, the labels of an index clustering are also
+compared with those of the same clustering with the exact assignment.
+*/
+static inline int indexReference(void)
+{
+    const char* raw = getenv("KMEANS_INDEX_REFERENCE");
+    return raw != NULL && atoi(raw) == 1;
+}
+
+/*
+Function initCentroidIndex: Allocates the index. KMEANS_INDEX_LISTS and KMEANS_INDEX_RECALL
+override the number of lists (default sqrt(K)) and the recall target (default 0.99).
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int initCentroidIndex(CentroidIndex* index, int lines, int samples, int K)
+{
+    const char* rawLists = getenv("KMEANS_INDEX_LISTS");
+    const char* rawRecall = getenv("KMEANS_INDEX_RECALL");
+
+    index->lists = (rawLists != NULL && atoi(rawLists) > 0) ? atoi(rawLists) : (int)ceil(sqrt(K));
+    if (index->lists > K) index->lists = K;
+    index->recall = (rawRecall != NULL && atof(rawRecall) > 0.0) ? atof(rawRecall) : INDEX_DEFAULT_RECALL;
+    if (index->recall > 1.0f) index->recall = 1.0f;
+    index->sample = lines < INDEX_SAMPLE ? lines : INDEX_SAMPLE;
+    index->probes = index->lists;
+
+    index->coarse = malloc((long)index->lists * samples * sizeof(float));
+    index->owner = malloc(K * sizeof(int));
+    index->start = malloc((index->lists + 1) * sizeof(int));
+    index->members = malloc(K * sizeof(int));
+    index->needed = malloc((index->sample > 0 ? index->sample : 1) * sizeof(int));
+
+    if (index->coarse == NULL || index->owner == NULL || index->start == NULL || index->members == NULL ||
+        index->needed == NULL)
+    {
+        return -4;
+    }
+    return 0;
+}
+
+/*
+Function freeCentroidIndex: Releases the index.
+*/
+static void freeCentroidIndex(CentroidIndex* index)
+{
+    free(index->coarse);
+    free(index->owner);
+    free(index->start);
+    free(index->members);
+    free(index->needed);
+}
+
+/*
+Function indexSquared: Squared distance, only used to rank lists and coarse centers.
+*/
+static inline float indexSquared(const float* a, const float* b, int samples)
+{
+    float acc = 0.0f, diff;
+    for (int d = 0; d < samples; d++)
+    {
+        diff = a[d] - b[d];
+        acc += diff * diff;
+    }
+    return acc;
+}
+
+/*
+Function nearestList: Nearest coarse center of a row.
+*/
+static inline int nearestList(const CentroidIndex* index, const float* row, int samples)
+{
+    int p, best = 0;
+    float dist, minDist = FLT_MAX;
+    for (p = 0; p < index->lists; p++)
+    {
+        dist = indexSquared(row, &index->coarse[(long)p * samples], samples);
+        if (dist < minDist)
+        {
+            minDist = dist;
+            best = p;
+        }
+    }
+    return best;
+}
+
+/*
+Function buildCentroidIndex: Groups the centroids in inverted lists. The coarse centers start
+from evenly spaced centroids and are refined once with the mean of their members.
+*/
+static void buildCentroidIndex(CentroidIndex* index, const float* centroids, int K, int samples)
+{
+    int c, p, d;
+
+    #ifdef _OPENMP
+    # pragma omp single
+    #endif
+    for (p = 0; p < index->lists; p++)
+    {
+        memcpy(&index->coarse[(long)p * samples], &centroids[(long)(p * (long)K / index->lists) * samples],
+               samples * sizeof(float));
+    }
+
+    for (int round = 0; round < 2; round++)
+    {
+        #ifdef _OPENMP
+        # pragma omp for schedule(static)
+        #endif
+        for (c = 0; c < K; c++)
+        {
+            index->owner[c] = nearestList(index, &centroids[(long)c * samples], samples);
+        }
+
+        #ifdef _OPENMP
+        # pragma omp single
+        #endif
+        {
+            // Counting sort of the centroids by list
+            memset(index->start, 0, (index->lists + 1) * sizeof(int));
+            for (c = 0; c < K; c++)
+            {
+                index->start[index->owner[c] + 1]++;
+            }
+            for (p = 0; p < index->lists; p++)
+            {
+                index->start[p + 1] += index->start[p];
+            }
+            for (c = 0; c < K; c++)
+            {
+                index->members[index->start[index->owner[c]]++] = c;
+            }
+            for (p = index->lists; p > 0; p--)
+            {
+                index->start[p] = index->start[p - 1];
+            }
+            index->start[0] = 0;
+        }
+
+        if (round == 0)
+        {
+            #ifdef _OPENMP
+            # pragma omp for schedule(static)
+            #endif
+            for (p = 0; p < index->lists; p++)
+            {
+                int count = index->start[p + 1] - index->start[p];
+                float* center = &index->coarse[(long)p * samples];
+                if (count == 0)
+                {
+                    continue;
+                }
+                memset(center, 0, samples * sizeof(float));
+                for (int m = index->start[p]; m < index->start[p + 1]; m++)
+                {
+                    for (d = 0; d < samples; d++)
+                    {
+                        center[d] += centroids[(long)index->members[m] * samples + d];
+                    }
+                }
+                for (d = 0; d < samples; d++)
+                {
+                    center[d] /= count;
+                }
+            }
+        }
+    }
+}
+
+/*
+Function compareInt: qsort comparator for ints.
+*/
+static int compareInt(const void* a, const void* b)
+{
+    return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b);
+}
+
+/*
+Function calibrateCentroidIndex: Chooses the number of lists to visit on a sample of the rows.
+listDist is scratch space for index->lists floats (private to the calling thread).
+*/
+static void calibrateCentroidIndex(CentroidIndex* index, const float* rows, int lines, const float* centroids,
+                                   int K, int samples, float* listDist)
+{
+    int s, p, c;
+
+    #ifdef _OPENMP
+    # pragma omp for schedule(static)
+    #endif
+    for (s = 0; s < index->sample; s++)
+    {
+        const float* point = &rows[(long)(s * (long)lines / index->sample) * samples];
+        float dist, minDist = FLT_MAX;
+        int nearest = 0, rank = 1;
+
+        for (c = 0; c < K; c++)
+        {
+            dist = indexSquared(point, &centroids[(long)c * samples], samples);
+            if (dist < minDist)
+            {
+                minDist = dist;
+                nearest = c;
+            }
+        }
+        for (p = 0; p < index->lists; p++)
+        {
+            listDist[p] = indexSquared(point, &index->coarse[(long)p * samples], samples);
+        }
+        // Position of the list of the nearest centroid when lists are sorted by distance
+        for (p = 0; p < index->lists; p++)
+        {
+            if (listDist[p] < listDist[index->owner[nearest]] ||
+                (listDist[p] == listDist[index->owner[nearest]] && p < index->owner[nearest]))
+            {
+                rank++;
+            }
+        }
+        index->needed[s] = rank;
+    }
+
+    #ifdef _OPENMP
+    # pragma omp single
+    #endif
+    if (index->sample > 0)
+    {
+        int target = (int)ceil(index->recall * index->sample);
+        qsort(index->needed, index->sample, sizeof(int), compareInt);
+        index->probes = index->needed[(target > 0 ? target : 1) - 1];
+    }
+}
+
+/*
+Function searchCentroidIndex: Approximate nearest centroid of a point (class 1..K).
+previous is the class of the point in the last iteration (0 if none), always compared.
+listDist and order are scratch space for index->lists entries.
+*/
+static int searchCentroidIndex(const CentroidIndex* index, const float* point, const float* centroids, int K,
+                               int samples, int previous, float* listDist, int* order)
+{
+    int p, q, m, c, bestIdx = 0, tmp;
+    float_t dist, best = FLT_MAX;
+
+    for (p = 0; p < index->lists; p++)
+    {
+        listDist[p] = indexSquared(point, &index->coarse[(long)p * samples], samples);
+        order[p] = p;
+    }
+
+    if (previous > 0)
+    {
+        bestIdx = previous - 1;
+        best = sqrt(indexSquared(point, &centroids[(long)bestIdx * samples], samples));
+    }
+
+    for (q = 0; q < index->probes; q++)
+    {
+        // Partial selection sort: order[q] is the q-th closest list
+        for (p = q + 1; p < index->lists; p++)
+        {
+            if (listDist[order[p]] < listDist[order[q]])
+            {
+                tmp = order[q];
+                order[q] = order[p];
+                order[p] = tmp;
+            }
+        }
+
+        for (m = index->start[order[q]]; m < index->start[order[q] + 1]; m++)
+        {
+            c = index->members[m];
+            dist = sqrt(indexSquared(point, &centroids[(long)c * samples], samples));
+            if (dist < best || (dist == best && c < bestIdx))
+            {
+                best = dist;
+                bestIdx = c;
+            }
+        }
+    }
+
+    return bestIdx + 1;
+}
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Blocked (AoSoA) point layout shared by the OpenMP, MPI and MPI+OpenMP versions
+ *
+ * The row-major data array only lets SIMD work along the dimension axis, which wastes lanes
+ * for low-dimensional inputs. Here the points are stored in groups of AOSOA width points
+ * interleaved per dimension: group g keeps coordinate d of its points in one contiguous row,
+ * so the distance to a centroid is computed for the whole group with one vector per row.
+ * Groups are 64-byte aligned and padded; padding points are never reported to the caller.
+ * Each lane accumulates its dimensions in the same order as euclideanDistance(), so the
+ * classMap is the same as with the row-major kernel.
+ */
+#ifndef KMEANS_LAYOUT_H
+#define KMEANS_LAYOUT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#define AOSOA_ALIGN 64
+#define AOSOA_MAX_WIDTH 16
+// Lanes accumulated together in the distance kernel
+#define AOSOA_CHUNK 8
+
+typedef struct
+{
+    float* block;     // groups of width points, coordinate d of a group is block[g * stride + d * width + lane]
+    int width;        // points per group (8 or 16)
+    int groups;       // number of groups, the last one may be padded
+    int lines;        // number of real points
+    int samples;      // dimensions per point
+    long stride;      // floats between two consecutive groups (multiple of AOSOA_ALIGN bytes)
+} AoSoAData;
+
+/*
+Function layoutWidth: Group width requested with KMEANS_LAYOUT_WIDTH (8 or 16, default 8).
+*/
+static int layoutWidth(void)
+{
+    const char* rawWidth = getenv("KMEANS_LAYOUT_WIDTH");
+    return (rawWidth != NULL && atoi(rawWidth) == AOSOA_MAX_WIDTH) ? AOSOA_MAX_WIDTH : AOSOA_CHUNK;
+}
+
+/*
+Function fillAoSoA: Copies lines consecutive rows of data into a blocked layout whose block has room
+for at least that many points, reusing its memory.
+*/
+static void fillAoSoA(AoSoAData* layout, const float* data, int lines)
+{
+    const int width = layout->width, samples = layout->samples;
+    int g;
+
+    layout->lines = lines;
+    layout->groups = (lines + width - 1) / width;
+    // Each group is written by the thread that will process it under a static schedule
+    #ifdef _OPENMP
+    # pragma omp parallel for schedule(static)
+    #endif
+    for (g = 0; g < layout->groups; g++)
+    {
+        float* group = &layout->block[g * layout->stride];
+        memset(group, 0, layout->stride * sizeof(float));
+        for (int lane = 0; lane < width && g * width + lane < lines; lane++)
+        {
+            const float* point = &data[(long)(g * width + lane) * samples];
+            for (int d = 0; d < samples; d++)
+            {
+                group[d * width + lane] = point[d];
+            }
+        }
+    }
+}
+
+/*
+Function buildAoSoA: Copies lines consecutive rows of data into the blocked layout.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int buildAoSoA(AoSoAData* layout, const float* data, int lines, int samples, int width)
+{
+    long groupBytes = (long)samples * width * sizeof(float);
+    groupBytes = (groupBytes + AOSOA_ALIGN - 1) / AOSOA_ALIGN * AOSOA_ALIGN;
+    const int groups = (lines + width - 1) / width;
+
+    layout->width = width;
+    layout->samples = samples;
+    layout->stride = groupBytes / sizeof(float);
+    layout->block = aligned_alloc(AOSOA_ALIGN, groupBytes * (groups > 0 ? groups : 1));
+    if (layout->block == NULL)
+    {
+        return -4;
+    }
+    fillAoSoA(layout, data, lines);
+    return 0;
+}
+
+/*
+Function freeAoSoA: Releases the blocked layout.
+*/
+static void freeAoSoA(AoSoAData* layout)
+{
+    free(layout->block);
+    layout->block = NULL;
+}
+
+/*
+Function groupSize: Number of real (not padding) points in group g.
+*/
+static inline int groupSize(const AoSoAData* layout, int g)
+{
+    int remaining = layout->lines - g * layout->width;
+    return remaining < layout->width ? remaining : layout->width;
+}
+
+/*
+Function assignGroupWidth: Nearest centroid of every lane of a group, vectorized across points.
+Lanes are processed AOSOA_CHUNK at a time so that the accumulators stay in vector registers.
+The square root is only taken when the squared distance can improve the current minimum,
+which is exact because sqrt is monotonic.
+*/
+static inline void assignGroupWidth(const float* group, const float* centroids, int K, int samples,
+                                    const int width, int* cluster)
+{
+    float_t acc[AOSOA_MAX_WIDTH], best[AOSOA_MAX_WIDTH], bestAcc[AOSOA_MAX_WIDTH];
+    int lane, base, c, d;
+
+    for (lane = 0; lane < width; lane++)
+    {
+        best[lane] = FLT_MAX;
+        bestAcc[lane] = INFINITY;
+        cluster[lane] = 1;
+    }
+
+    for (c = 0; c < K; c++)
+    {
+        const float* center = &centroids[(long)c * samples];
+        for (lane = 0; lane < width; lane++)
+        {
+            acc[lane] = 0.0;
+        }
+        for (base = 0; base < width; base += AOSOA_CHUNK)
+        {
+            for (d = 0; d < samples; d++)
+            {
+                const float* row = &group[d * width + base];
+                const float coord = center[d];
+                // Keep the loop over lanes so that it is vectorized instead of the loop over dimensions
+                # pragma GCC unroll 1
+                for (lane = 0; lane < AOSOA_CHUNK; lane++)
+                {
+                    float_t diff = row[lane] - coord;
+                    acc[base + lane] += diff * diff;
+                }
+            }
+        }
+        for (lane = 0; lane < width; lane++)
+        {
+            if (acc[lane] < bestAcc[lane])
+            {
+                float_t dist = sqrt(acc[lane]);
+                if (dist < best[lane])
+                {
+                    best[lane] = dist;
+                    bestAcc[lane] = acc[lane];
+                    cluster[lane] = c + 1;
+                }
+            }
+        }
+    }
+}
+
+/*
+Function assignAoSoA: Assigns the points of group g; cluster receives one class per lane.
+*/
+static void assignAoSoA(const AoSoAData* layout, int g, const float* centroids, int K, int* cluster)
+{
+    const float* group = &layout->block[g * layout->stride];
+    if (layout->width == AOSOA_CHUNK)
+    {
+        assignGroupWidth(group, centroids, K, layout->samples, AOSOA_CHUNK, cluster);
+    }
+    else
+    {
+        assignGroupWidth(group, centroids, K, layout->samples, AOSOA_MAX_WIDTH, cluster);
+    }
+}
+
+/*
+Function accumulateAoSoA: Adds the coordinates of the points of group g to the sum of their class.
+classMap holds the class of the first point of the group.
+*/
+static void accumulateAoSoA(const AoSoAData* layout, int g, const int* classMap, float* auxCentroids)
+{
+    const float* group = &layout->block[g * layout->stride];
+    const int width = layout->width, samples = layout->samples, count = groupSize(layout, g);
+
+    for (int lane = 0; lane < count; lane++)
+    {
+        float* sum = &auxCentroids[(long)(classMap[lane] - 1) * samples];
+        for (int d = 0; d < samples; d++)
+        {
+            sum[d] += group[d * width + lane];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * NUMA-aware placement for the OpenMP version
+ *
+ * Linux places a page on the NUMA node of the thread that touches it first. The input rows are
+ * zeroed in parallel, with the same static split as the assignment loop, before the file is read,
+ * so every thread later finds its rows in the memory of its own node. Threads can be bound to
+ * cores explicitly (compact: consecutive cores; spread: round robin over the nodes), and every
+ * node can keep its own replica of the centroids, refreshed once per iteration by one of its
+ * threads, so that the K x samples centroid reads of the assignment step stay local too.
+ *
+ * The topology is read from sysfs; without it the machine is seen as a single node.
+ * The including file must define _GNU_SOURCE before its first system header.
+ */
+#ifndef KMEANS_NUMA_H
+#define KMEANS_NUMA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <omp.h>
+
+typedef struct
+{
+    int threads;      // number of threads placed
+    int nodes;        // number of NUMA nodes (highest node id + 1)
+    int* cpu;         // core of each thread number, -1 when threads are not bound
+    int* node;        // node of each thread number
+} ThreadPlacement;
+
+/*
+Function numaNodes: Number of NUMA nodes of the machine, 1 when unknown.
+*/
+static int numaNodes(void)
+{
+    int first = 0, last = 0;
+    FILE* fp = fopen("/sys/devices/system/node/possible", "r");
+    if (fp != NULL)
+    {
+        // "0" or "0-1"
+        if (fscanf(fp, "%d-%d", &first, &last) < 2)
+        {
+            last = first;
+        }
+        fclose(fp);
+    }
+    return last + 1;
+}
+
+/*
+Function numaNodeOfCpu: NUMA node of a core, read from the nodeN entry of its sysfs directory.
+*/
+static int numaNodeOfCpu(int cpu)
+{
+    char path[100];
+    struct dirent* entry;
+    int node = 0;
+    DIR* dir;
+
+    sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+    if ((dir = opendir(path)) != NULL)
+    {
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strncmp(entry->d_name, "node", 4) == 0 && sscanf(entry->d_name + 4, "%d", &node) == 1)
+            {
+                break;
+            }
+        }
+        closedir(dir);
+    }
+    return node;
+}
+
+/*
+Function planPlacement: Chooses the core of each thread among the cores the process may run on.
+mode is "compact" (consecutive cores), "spread" (round robin over the nodes) or NULL (threads are
+not bound, the node of each thread is the node it runs on when the placement is planned).
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int planPlacement(ThreadPlacement* placement, int threads, const char* mode)
+{
+    cpu_set_t allowed;
+    int c, t, n, count = 0;
+
+    placement->threads = threads;
+    placement->nodes = numaNodes();
+    placement->cpu = malloc(threads * sizeof(int));
+    placement->node = malloc(threads * sizeof(int));
+    int* cpus = malloc(CPU_SETSIZE * sizeof(int));
+    int* used = calloc(CPU_SETSIZE, sizeof(int));
+    if (placement->cpu == NULL || placement->node == NULL || cpus == NULL || used == NULL)
+    {
+        free(cpus);
+        free(used);
+        return -4;
+    }
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (c = 0; c < CPU_SETSIZE; c++)
+        {
+            if (CPU_ISSET(c, &allowed))
+            {
+                cpus[count++] = c;
+            }
+        }
+    }
+
+    if (mode == NULL || count == 0)
+    {
+        // Not bound: record where each thread is running now
+        # pragma omp parallel num_threads(threads)
+        {
+            int cpu = sched_getcpu();
+            placement->cpu[omp_get_thread_num()] = -1;
+            placement->node[omp_get_thread_num()] = cpu >= 0 ? numaNodeOfCpu(cpu) : 0;
+        }
+    }
+    else if (strcmp(mode, "spread") == 0)
+    {
+        // Take one free core of each node in turn
+        for (t = 0; t < threads; t++)
+        {
+            int found = -1;
+            for (n = 0; n < placement->nodes && found < 0; n++)
+            {
+                int node = (t + n) % placement->nodes;
+                for (c = 0; c < count && found < 0; c++)
+                {
+                    if (!used[c] && numaNodeOfCpu(cpus[c]) == node)
+                    {
+                        found = c;
+                    }
+                }
+            }
+            if (found < 0)
+            {
+                // More threads than cores: start again from the first one
+                memset(used, 0, count * sizeof(int));
+                found = t % count;
+            }
+            used[found] = 1;
+            placement->cpu[t] = cpus[found];
+        }
+    }
+    else
+    {
+        for (t = 0; t < threads; t++)
+        {
+            placement->cpu[t] = cpus[t % count];
+        }
+    }
+
+    for (t = 0; t < threads && placement->cpu[0] >= 0; t++)
+    {
+        placement->node[t] = numaNodeOfCpu(placement->cpu[t]);
+    }
+    for (t = 0; t < threads; t++)
+    {
+        if (placement->node[t] >= placement->nodes)
+        {
+            placement->nodes = placement->node[t] + 1;
+        }
+    }
+
+    free(cpus);
+    free(used);
+    return 0;
+}
+
+/*
+Function freePlacement: Releases the placement.
+*/
+static void freePlacement(ThreadPlacement* placement)
+{
+    free(placement->cpu);
+    free(placement->node);
+}
+
+/*
+Function pinThreads: Binds every thread of a team of placement->threads threads to its core.
+The OpenMP runtime keeps the same threads for the later teams of the same size.
+*/
+static void pinThreads(const ThreadPlacement* placement)
+{
+    # pragma omp parallel num_threads(placement->threads)
+    {
+        int cpu = placement->cpu[omp_get_thread_num()];
+        if (cpu >= 0)
+        {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            CPU_SET(cpu, &mask);
+            sched_setaffinity(0, sizeof(mask), &mask);
+        }
+    }
+}
+
+/*
+Function firstTouchRows: Zeroes lines rows with threads threads and the static split of the
+assignment loop, so that each page is placed on the node of the thread that will use it.
+*/
+static void firstTouchRows(float* data, int lines, int samples, int threads)
+{
+    int i;
+    # pragma omp parallel for num_threads(threads) schedule(static)
+    for (i = 0; i < lines; i++)
+    {
+        memset(&data[(long)i * samples], 0, samples * sizeof(float));
+    }
+}
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Partial distance search shared by the OpenMP, MPI and MPI+OpenMP versions
+ *
+ * For high-dimensional points most centroids are already farther than the current best one
+ * after a few dimensions. The squared distance is accumulated in blocks of PDS_BLOCK
+ * dimensions and the centroid is abandoned as soon as the running sum exceeds the best
+ * squared distance found so far. The centroid the point had in the previous iteration is
+ * tested first, so the bound is tight from the start.
+ *
+ * Without reordering the dimensions are summed in the same order as euclideanDistance() and
+ * ties are resolved towards the lowest centroid, so the classMap is the same as Lloyd's.
+ * Reordering the dimensions by decreasing variance abandons earlier, but changes the rounding
+ * of the sums.
+ */
+#ifndef KMEANS_PDS_H
+#define KMEANS_PDS_H
+
+#include <stdlib.h>
+#include <math.h>
+
+// Dimensions accumulated between two checks of the bound
+#define PDS_BLOCK 8
+
+/*
+Function varianceOrder: Dimensions sorted by decreasing variance over lines rows of data.
+Returns NULL if the memory could not be allocated.
+*/
+static int* varianceOrder(const float* data, int lines, int samples)
+{
+    int* order = malloc(samples * sizeof(int));
+    double* sum = calloc(samples, sizeof(double));
+    double* sumSq = calloc(samples, sizeof(double));
+    double* variance = malloc(samples * sizeof(double));
+    int i, d;
+
+    if (order == NULL || sum == NULL || sumSq == NULL || variance == NULL)
+    {
+        free(order);
+        order = NULL;
+    }
+    else
+    {
+        for (i = 0; i < lines; i++)
+        {
+            for (d = 0; d < samples; d++)
+            {
+                sum[d] += data[(long)i * samples + d];
+                sumSq[d] += (double)data[(long)i * samples + d] * data[(long)i * samples + d];
+            }
+        }
+
+        // Insertion sort, samples is small
+        for (d = 0; d < samples; d++)
+        {
+            double mean = sum[d] / lines;
+            variance[d] = sumSq[d] / lines - mean * mean;
+
+            i = d;
+            while (i > 0 && variance[order[i - 1]] < variance[d])
+            {
+                order[i] = order[i - 1];
+                i--;
+            }
+            order[i] = d;
+        }
+    }
+
+    free(sum);
+    free(sumSq);
+    free(variance);
+    return order;
+}
+
+/*
+Function pdsAccumulate: Adds the squared differences of dimensions [from, to) to acc.
+order is the permutation of the dimensions, or NULL to follow the natural order.
+*/
+static inline float_t pdsAccumulate(float_t acc, const float* point, const float* center, int from, int to,
+                                    const int* order)
+{
+    int d;
+    float_t diff;
+
+    if (order == NULL)
+    {
+        for (d = from; d < to; d++)
+        {
+            diff = point[d] - center[d];
+            acc += diff * diff;
+        }
+    }
+    else
+    {
+        for (d = from; d < to; d++)
+        {
+            diff = point[order[d]] - center[order[d]];
+            acc += diff * diff;
+        }
+    }
+    return acc;
+}
+
+/*
+Function assignPDS: Nearest centroid of a point (class 1..K) using partial distance search.
+previous is the class of the point in the last iteration (0 if none).
+evaluated is increased by the number of dimensions actually accumulated.
+*/
+static int assignPDS(const float* point, const float* centroids, int K, int samples, int previous,
+                     const int* order, long* evaluated)
+{
+    const int first = previous > 0 ? previous - 1 : 0;
+    int bestIdx = first;
+    float_t bestAcc = pdsAccumulate(0.0, point, &centroids[(long)bestIdx * samples], 0, samples, order);
+    float_t best = sqrt(bestAcc), acc, dist;
+    long count = samples;
+    int c, d, abandoned;
+
+    for (c = 0; c < K; c++)
+    {
+        if (c == first)
+        {
+            continue;
+        }
+
+        const float* center = &centroids[(long)c * samples];
+        acc = 0.0;
+        abandoned = 0;
+        for (d = 0; d + PDS_BLOCK <= samples && !abandoned; d += PDS_BLOCK)
+        {
+            acc = pdsAccumulate(acc, point, center, d, d + PDS_BLOCK, order);
+
+            // Sums of squares only grow, so the final distance can not become smaller.
+            // A centroid before the current best is kept while its distance may still tie.
+            abandoned = acc > bestAcc && (c > bestIdx || (float_t)sqrt(acc) > best);
+        }
+        if (!abandoned && d < samples)
+        {
+            acc = pdsAccumulate(acc, point, center, d, samples, order);
+            d = samples;
+        }
+        count += d;
+
+        if (!abandoned)
+        {
+            dist = sqrt(acc);
+            if (dist < best || (dist == best && c < bestIdx))
+            {
+                best = dist;
+                bestAcc = acc;
+                bestIdx = c;
+            }
+        }
+    }
+
+    *evaluated += count;
+    return bestIdx + 1;
+}
+
+#endif
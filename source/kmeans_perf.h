@@ -0,0 +1,292 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Hardware counters of the assignment and update loops of the OpenMP and MPI versions
+ *
+ * With KMEANS_PERF=1 every thread (OpenMP) or process (MPI) opens a perf_event_open group with the
+ * cycles, the instructions and the last-level cache misses of its own user-space code. The group
+ * is read when the assignment of an iteration ends and when its update ends (sums, means, movement
+ * of the centroids and the new centroids made visible), and the difference is added to that phase
+ * with its time: one system call per phase and no synchronization. At the end the counters of all
+ * the threads or processes are added up into IPC, memory traffic (a cache line per miss), bytes per
+ * point and the GFLOP/s of the operations of Lloyd's algorithm, and placed on a roofline when the
+ * peaks of the machine are given in KMEANS_PERF_PEAK=<GFLOP/s>,<GB/s>.
+ *
+ * Without a PMU (most virtual machines) or with a perf_event_paranoid above 2 the group cannot be
+ * opened; the times and the GFLOP/s are still reported. The MPI version gathers the counters of all
+ * the processes with gatherPerf; the including file must then define MPI_CHECK_RETURN.
+ */
+#ifndef KMEANS_PERF_H
+#define KMEANS_PERF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "kmeans_common.h"
+
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_LLC_MISSES 2
+#define PERF_EVENTS 3
+
+#define PERF_ASSIGN 0
+#define PERF_UPDATE 1
+#define PERF_PHASES 2
+
+// Bytes brought from memory by a last-level cache miss
+#define PERF_LINE_BYTES 64
+
+typedef struct
+{
+    int fd[PERF_EVENTS];                      // group leader first, -1 for the events not opened
+    int error;                                // errno of the leader when the group could not be opened
+    int iterations;                           // updates counted
+    double last[PERF_EVENTS];                 // counts and time at the last read
+    double lastTime;
+    double counts[PERF_PHASES][PERF_EVENTS];
+    double seconds[PERF_PHASES];
+} PerfCounters;
+
+/*
+Function perfRequested: KMEANS_PERF=1.
+*/
+static inline int perfRequested(void)
+{
+    const char* raw = getenv("KMEANS_PERF");
+    return raw != NULL && atoi(raw) == 1;
+}
+
+/*
+Function perfRead: Current counts of the group, scaled by the fraction of the time it was
+scheduled when the PMU is shared. Zero for the events that are not counted.
+*/
+static inline void perfRead(const PerfCounters* counters, double* values)
+{
+    uint64_t buffer[3 + PERF_EVENTS];
+    int e, n = 0;
+
+    memset(values, 0, PERF_EVENTS * sizeof(double));
+    if (counters->fd[0] < 0 || read(counters->fd[0], buffer, sizeof(buffer)) < (ssize_t)(3 * sizeof(uint64_t)))
+    {
+        return;
+    }
+    // buffer: number of events, time enabled, time running and the value of each event
+    const double scale = buffer[2] > 0 ? (double)buffer[1] / buffer[2] : 0.0;
+    for (e = 0; e < PERF_EVENTS && n < (int)buffer[0]; e++)
+    {
+        if (counters->fd[e] >= 0)
+        {
+            values[e] = buffer[3 + n++] * scale;
+        }
+    }
+}
+
+/*
+Function perfOpen: Starts the counters of the calling thread at time now. An event the CPU does
+not have is left out of the group; without its leader (the cycles) nothing is counted and error
+keeps the reason. Returns 0 when the group was opened and -1 otherwise.
+*/
+static inline int perfOpen(PerfCounters* counters, double now)
+{
+    static const uint64_t configs[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                   PERF_COUNT_HW_CACHE_MISSES };
+    struct perf_event_attr attr;
+    int e;
+
+    memset(counters, 0, sizeof(*counters));
+    for (e = 0; e < PERF_EVENTS; e++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[e];
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = e == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters->fd[e] = syscall(__NR_perf_event_open, &attr, 0, -1, e == 0 ? -1 : counters->fd[0], 0);
+        if (counters->fd[0] < 0)
+        {
+            counters->error = errno;
+            counters->fd[1] = counters->fd[2] = -1;
+            break;
+        }
+    }
+    if (counters->fd[0] >= 0)
+    {
+        ioctl(counters->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    perfRead(counters, counters->last);
+    counters->lastTime = now;
+    return counters->fd[0] >= 0 ? 0 : -1;
+}
+
+/*
+Function perfPhase: Adds the counts and the time since the last read to phase. Nothing is done
+without counters.
+*/
+static inline void perfPhase(PerfCounters* counters, int phase, double now)
+{
+    double values[PERF_EVENTS];
+    int e;
+
+    if (counters == NULL)
+    {
+        return;
+    }
+    perfRead(counters, values);
+    for (e = 0; e < PERF_EVENTS; e++)
+    {
+        counters->counts[phase][e] += values[e] - counters->last[e];
+        counters->last[e] = values[e];
+    }
+    counters->seconds[phase] += now - counters->lastTime;
+    counters->lastTime = now;
+    counters->iterations += phase == PERF_UPDATE;
+}
+
+/*
+Function perfClose: Stops the counters, keeping what they counted.
+*/
+static inline void perfClose(PerfCounters* counters)
+{
+    for (int e = 0; counters != NULL && e < PERF_EVENTS; e++)
+    {
+        if (counters->fd[e] >= 0)
+        {
+            close(counters->fd[e]);
+            counters->fd[e] = -1;
+        }
+    }
+}
+
+/*
+Function describePerf: Appends to text the summary of the counters of count threads or processes
+(unitName) that clustered lines rows of samples values in K classes, skipping the units that did
+not take part. The operations are those of Lloyd's algorithm: 3 per value of every point and
+centroid in the assignment, and in the update 1 per value of every point plus 4 per value of
+every centroid (mean and movement). The time of a phase is the one of its slowest unit.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static inline int describePerf(const PerfCounters* units, int count, const char* unitName, int lines, int samples,
+                               int K, KMeansLog* text)
+{
+    static const char* const names[PERF_PHASES] = { "assign", "update" };
+    double counts[PERF_PHASES][PERF_EVENTS] = { { 0.0 } }, seconds[PERF_PHASES] = { 0.0 };
+    double minIpc[PERF_PHASES], maxIpc[PERF_PHASES], intensity[PERF_PHASES], gflops[PERF_PHASES];
+    int active = 0, counted = 0, iterations = 0, reason = 0, failed = 0, u, p, e;
+
+    for (p = 0; p < PERF_PHASES; p++)
+    {
+        minIpc[p] = 1e30;
+        maxIpc[p] = 0.0;
+    }
+    for (u = 0; u < count; u++)
+    {
+        if (units[u].iterations == 0)
+        {
+            continue;
+        }
+        active++;
+        counted += units[u].error == 0;
+        reason = units[u].error != 0 ? units[u].error : reason;
+        iterations = iterations > units[u].iterations ? iterations : units[u].iterations;
+        for (p = 0; p < PERF_PHASES; p++)
+        {
+            for (e = 0; e < PERF_EVENTS; e++)
+            {
+                counts[p][e] += units[u].counts[p][e];
+            }
+            seconds[p] = seconds[p] > units[u].seconds[p] ? seconds[p] : units[u].seconds[p];
+            if (units[u].counts[p][PERF_CYCLES] > 0.0)
+            {
+                const double ipc = units[u].counts[p][PERF_INSTRUCTIONS] / units[u].counts[p][PERF_CYCLES];
+                minIpc[p] = ipc < minIpc[p] ? ipc : minIpc[p];
+                maxIpc[p] = ipc > maxIpc[p] ? ipc : maxIpc[p];
+            }
+        }
+    }
+    if (active == 0)
+    {
+        return 0;
+    }
+
+    const double points = (double)lines * iterations;
+    const double flops[PERF_PHASES] = { 3.0 * points * K * samples, (points + 4.0 * K * iterations) * samples };
+    if (counted > 0)
+    {
+        failed |= appendLog(text, "\nCounters: cycles, instructions and last-level cache misses, every %s on its own "
+                            "(%d of %d opened)", unitName, counted, active);
+    }
+    else
+    {
+        failed |= appendLog(text, "\nCounters: not available (perf_event_open: %s), times only", strerror(reason));
+    }
+    for (p = 0; p < PERF_PHASES; p++)
+    {
+        const double bytes = counts[p][PERF_LLC_MISSES] * PERF_LINE_BYTES;
+        gflops[p] = seconds[p] > 0.0 ? flops[p] / seconds[p] * 1e-9 : 0.0;
+        intensity[p] = bytes > 0.0 ? flops[p] / bytes : 0.0;
+        failed |= appendLog(text, "\n  %s: %f seconds, %.2f GFLOP/s", names[p], seconds[p], gflops[p]);
+        if (counted > 0 && counts[p][PERF_CYCLES] > 0.0)
+        {
+            failed |= appendLog(text, ", IPC %.2f (%.2f to %.2f per %s), %.1f bytes per point from memory, "
+                                "%.2f GB/s, %.2f FLOP/byte",
+                                counts[p][PERF_INSTRUCTIONS] / counts[p][PERF_CYCLES], minIpc[p], maxIpc[p], unitName,
+                                bytes / points, seconds[p] > 0.0 ? bytes / seconds[p] * 1e-9 : 0.0, intensity[p]);
+        }
+    }
+
+    // Roofline: the attainable GFLOP/s of a phase is the lowest of the peak and intensity x bandwidth
+    const char* raw = getenv("KMEANS_PERF_PEAK");
+    double peakFlops = 0.0, peakBandwidth = 0.0;
+    if (raw == NULL || sscanf(raw, "%lf,%lf", &peakFlops, &peakBandwidth) != 2 || peakFlops <= 0.0 ||
+        peakBandwidth <= 0.0 || counted == 0)
+    {
+        return failed != 0 ? -4 : 0;
+    }
+    const double ridge = peakFlops / peakBandwidth;
+    failed |= appendLog(text, "\nRoofline: peaks %.1f GFLOP/s and %.1f GB/s, ridge at %.2f FLOP/byte", peakFlops,
+                        peakBandwidth, ridge);
+    for (p = 0; p < PERF_PHASES; p++)
+    {
+        const double attainable = intensity[p] > 0.0 && intensity[p] < ridge ? intensity[p] * peakBandwidth
+                                                                              : peakFlops;
+        failed |= appendLog(text, "\n  %s: %s bound, %.2f of %.2f attainable GFLOP/s (%.0f%%)", names[p],
+                            intensity[p] > 0.0 && intensity[p] < ridge ? "memory" : "compute", gflops[p], attainable,
+                            100.0 * gflops[p] / attainable);
+    }
+    return failed != 0 ? -4 : 0;
+}
+
+#ifdef MPI_VERSION
+/*
+Function gatherPerf: Collects the counters of every process of MPI_COMM_WORLD on rank 0, which
+appends their summary to text. Returns 0 on success and -4 if the memory could not be allocated
+(on rank 0).
+*/
+static inline int gatherPerf(const PerfCounters* counters, int lines, int samples, int K, KMeansLog* text)
+{
+    int rank, size, error = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    PerfCounters* units = rank == 0 ? malloc(size * sizeof(PerfCounters)) : NULL;
+
+    MPI_CHECK_RETURN(MPI_Gather(counters, sizeof(PerfCounters), MPI_BYTE, units, sizeof(PerfCounters), MPI_BYTE, 0,
+                                MPI_COMM_WORLD));
+    if (rank == 0)
+    {
+        error = units == NULL ? -4 : describePerf(units, size, "process", lines, samples, K, text);
+    }
+    free(units);
+    return error;
+}
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Persistent collectives for the MPI and MPI+OpenMP versions
+ *
+ * Every iteration posts the same collectives on the same buffers: the reduction of the class
+ * counts, of the number of changes and of the maximum movement, the reduce-scatter of the sums
+ * and the gather of the new centroids. With persistent collectives (MPI-4 MPI_Allreduce_init and
+ * friends, or the MPIX_ versions of Open MPI 4 in mpi-ext.h) the schedules are built once and
+ * every iteration only starts and waits on them. Without library support, or when any process
+ * fails to create them, the versions fall back to the usual non-blocking calls.
+ */
+#ifndef KMEANS_PERSISTENT_H
+#define KMEANS_PERSISTENT_H
+
+#include <stdlib.h>
+#include <mpi.h>
+#if MPI_VERSION < 4 && defined(OPEN_MPI) && OPEN_MPI
+#include <mpi-ext.h>
+#endif
+
+#if MPI_VERSION >= 4
+#define PERSISTENT_COLLECTIVES 1
+#define allreduceInit MPI_Allreduce_init
+#define reduceScatterInit MPI_Reduce_scatter_init
+#define allgathervInit MPI_Allgatherv_init
+#elif defined(OMPI_HAVE_MPI_EXT_PCOLLREQ)
+#define PERSISTENT_COLLECTIVES 1
+#define allreduceInit MPIX_Allreduce_init
+#define reduceScatterInit MPIX_Reduce_scatter_init
+#define allgathervInit MPIX_Allgatherv_init
+#else
+#define PERSISTENT_COLLECTIVES 0
+#endif
+
+/*
+Function persistentRequested: KMEANS_MPI_PERSISTENT=1 asks for persistent collectives.
+*/
+static int persistentRequested(void)
+{
+    const char* raw = getenv("KMEANS_MPI_PERSISTENT");
+    return raw != NULL && atoi(raw) == 1;
+}
+
+/*
+Function initIterationCollectives: Creates the persistent collectives of one iteration on comm.
+The class counts, changes and maxDist are reduced in place; the sums of localAuxCentroids are
+scattered to auxCentroids + displs[rank] and gathered back in place with counts and displs
+(floats of each process). sums may be NULL when the sums are reduced another way.
+Returns 1 when every process created all of them, otherwise 0 and none is left allocated.
+*/
+static int initIterationCollectives(int* pointsPerClass, int K, int* changes, float* maxDist,
+                                    float* localAuxCentroids, float* auxCentroids, const int* counts,
+                                    const int* displs, MPI_Comm comm, MPI_Request* classCounts,
+                                    MPI_Request* changeCount, MPI_Request* maxMovement, MPI_Request* gather,
+                                    MPI_Request* sums)
+{
+    MPI_Request* all[5] = { classCounts, changeCount, maxMovement, gather, sums };
+    int created = 0, rank, i;
+
+    for (i = 0; i < 5; i++)
+    {
+        if (all[i] != NULL)
+        {
+            *all[i] = MPI_REQUEST_NULL;
+        }
+    }
+    MPI_Comm_rank(comm, &rank);
+    #if PERSISTENT_COLLECTIVES
+    created = allreduceInit(MPI_IN_PLACE, pointsPerClass, K, MPI_INT, MPI_SUM, comm, MPI_INFO_NULL,
+                            classCounts) == MPI_SUCCESS &&
+              allreduceInit(MPI_IN_PLACE, changes, 1, MPI_INT, MPI_SUM, comm, MPI_INFO_NULL,
+                            changeCount) == MPI_SUCCESS &&
+              allreduceInit(MPI_IN_PLACE, maxDist, 1, MPI_FLOAT, MPI_MAX, comm, MPI_INFO_NULL,
+                            maxMovement) == MPI_SUCCESS &&
+              allgathervInit(MPI_IN_PLACE, counts[rank], MPI_FLOAT, auxCentroids, counts, displs, MPI_FLOAT, comm,
+                             MPI_INFO_NULL, gather) == MPI_SUCCESS &&
+              (sums == NULL || reduceScatterInit(localAuxCentroids, auxCentroids + displs[rank], counts, MPI_FLOAT,
+                                                 MPI_SUM, comm, MPI_INFO_NULL, sums) == MPI_SUCCESS);
+    #endif
+    MPI_Allreduce(MPI_IN_PLACE, &created, 1, MPI_INT, MPI_MIN, comm);
+
+    for (i = 0; i < 5 && !created; i++)
+    {
+        if (all[i] != NULL && *all[i] != MPI_REQUEST_NULL)
+        {
+            MPI_Request_free(all[i]);
+        }
+    }
+    return created;
+}
+
+/*
+Function freeIterationCollectives: Releases the requests of initIterationCollectives (sums may be NULL).
+*/
+static void freeIterationCollectives(MPI_Request* classCounts, MPI_Request* changeCount, MPI_Request* maxMovement,
+                                     MPI_Request* gather, MPI_Request* sums)
+{
+    MPI_Request_free(classCounts);
+    MPI_Request_free(changeCount);
+    MPI_Request_free(maxMovement);
+    MPI_Request_free(gather);
+    if (sums != NULL)
+    {
+        MPI_Request_free(sums);
+    }
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Centroids sharded among the processes for the MPI version
+ *
+ * When K x samples floats do not fit in every process next to its rows, each process keeps only a
+ * shard of the centroids. The shards travel around a ring of the processes: in size steps every
+ * process meets every centroid once, comparing its rows with the shard it holds while the next one
+ * is being received. The sums travel the same ring, each process adding its rows to the shard it
+ * holds, so that every shard arrives at its owner with the sums of all the processes.
+ * The including file must define MPI_CHECK_RETURN.
+ */
+#ifndef KMEANS_RING_H
+#define KMEANS_RING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+/*
+Function shardedRequested: KMEANS_MPI_SHARDED=1 splits the centroids among the processes.
+*/
+static int shardedRequested(void)
+{
+    const char* raw = getenv("KMEANS_MPI_SHARDED");
+    return raw != NULL && atoi(raw) == 1;
+}
+
+/*
+Function splitShards: First centroid and number of centroids of each of the size processes, the
+first K % size processes get one more.
+*/
+static void splitShards(int K, int size, int* shardStart, int* shardSize)
+{
+    int r;
+    for (r = 0; r < size; r++)
+    {
+        shardSize[r] = K / size + (r < K % size ? 1 : 0);
+        shardStart[r] = r * (K / size) + (r < K % size ? r : K % size);
+    }
+}
+
+/*
+Function ringShift: Starts sending sendCount floats of send to the next process of the ring and
+receiving recvCount floats from the previous one into recv. reqs receives both requests.
+*/
+static void ringShift(const float* send, int sendCount, float* recv, int recvCount, int previous, int next,
+                      MPI_Comm comm, MPI_Request* reqs)
+{
+    MPI_CHECK_RETURN(MPI_Irecv(recv, recvCount, MPI_FLOAT, previous, 0, comm, &reqs[0]));
+    MPI_CHECK_RETURN(MPI_Isend(send, sendCount, MPI_FLOAT, next, 0, comm, &reqs[1]));
+}
+
+/*
+Function shardSums: Sums of the lines rows (samples floats each) whose class (1..K in classMap)
+belongs to the shard of count centroids from first, written to sums.
+*/
+static void shardSums(const float* rows, const int* classMap, int lines, int samples, int first, int count,
+                      float* sums)
+{
+    int i, j, cluster;
+
+    memset(sums, 0, (long)count * samples * sizeof(float));
+    for (i = 0; i < lines; i++)
+    {
+        cluster = classMap[i] - 1 - first;
+        if (cluster < 0 || cluster >= count)
+        {
+            continue;
+        }
+        for (j = 0; j < samples; j++)
+        {
+            sums[cluster * samples + j] += rows[(long)i * samples + j];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Node-shared arrays for the MPI and MPI+OpenMP versions
+ *
+ * The processes of a communicator are grouped by host. Large read-mostly arrays (the input rows,
+ * the centroids and their sums) are allocated once per node with MPI_Win_allocate_shared: the
+ * first process of the node owns the memory and the others map the same pages, so the memory used
+ * on a node does not grow with the number of processes it runs. Only the first process of every
+ * node (the node leader) takes part in the reductions between nodes.
+ *
+ * The windows stay in a passive epoch (MPI_Win_lock_all) for their whole life and the processes
+ * of a node synchronize with nodeSync before reading what the others wrote.
+ * The including file must define MPI_CHECK_RETURN.
+ */
+#ifndef KMEANS_SHARED_H
+#define KMEANS_SHARED_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+typedef struct
+{
+    MPI_Comm node;     // processes of the same host, MPI_COMM_NULL when the arrays are not shared
+    MPI_Comm leaders;  // first process of every node, MPI_COMM_NULL on the other processes
+    int rank;          // rank in node
+    int size;          // processes in node
+    int nodes;         // number of nodes
+} NodeComms;
+
+#define NO_NODE_COMMS { MPI_COMM_NULL, MPI_COMM_NULL, 0, 1, 1 }
+
+/*
+Function sharedMemoryRequested: KMEANS_MPI_SHARED=1 keeps one copy of the arrays per node.
+*/
+static int sharedMemoryRequested(void)
+{
+    const char* raw = getenv("KMEANS_MPI_SHARED");
+    return raw != NULL && atoi(raw) == 1;
+}
+
+/*
+Function splitNodes: Groups the processes of comm by host and builds the communicator of the
+node leaders. Collective on comm.
+*/
+static void splitNodes(MPI_Comm comm, NodeComms* nodes)
+{
+    int rank, leader;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_CHECK_RETURN(MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodes->node));
+    MPI_Comm_rank(nodes->node, &nodes->rank);
+    MPI_Comm_size(nodes->node, &nodes->size);
+    MPI_CHECK_RETURN(MPI_Comm_split(comm, nodes->rank == 0 ? 0 : MPI_UNDEFINED, rank, &nodes->leaders));
+    leader = nodes->rank == 0;
+    MPI_CHECK_RETURN(MPI_Allreduce(&leader, &nodes->nodes, 1, MPI_INT, MPI_SUM, comm));
+}
+
+/*
+Function freeNodes: Releases the communicators built by splitNodes.
+*/
+static void freeNodes(NodeComms* nodes)
+{
+    if (nodes->leaders != MPI_COMM_NULL)
+    {
+        MPI_Comm_free(&nodes->leaders);
+    }
+    if (nodes->node != MPI_COMM_NULL)
+    {
+        MPI_Comm_free(&nodes->node);
+    }
+}
+
+/*
+Function allocateShared: Allocates bytes once per node, owned by the node leader, and returns
+the address where the calling process sees them. Collective on node.
+*/
+static void* allocateShared(long bytes, MPI_Comm node, MPI_Win* win)
+{
+    int rank, dispUnit;
+    MPI_Aint size;
+    void* base;
+
+    MPI_Comm_rank(node, &rank);
+    MPI_CHECK_RETURN(MPI_Win_allocate_shared(rank == 0 ? bytes : 0, 1, MPI_INFO_NULL, node, &base, win));
+    MPI_CHECK_RETURN(MPI_Win_shared_query(*win, 0, &size, &dispUnit, &base));
+    MPI_CHECK_RETURN(MPI_Win_lock_all(MPI_MODE_NOCHECK, *win));
+    return base;
+}
+
+/*
+Function freeShared: Releases a window of allocateShared. Collective on its node.
+*/
+static void freeShared(MPI_Win* win)
+{
+    MPI_CHECK_RETURN(MPI_Win_unlock_all(*win));
+    MPI_CHECK_RETURN(MPI_Win_free(win));
+}
+
+/*
+Function nodeSync: Makes the writes of every process of the node to win visible to the others.
+*/
+static void nodeSync(MPI_Win win, MPI_Comm node)
+{
+    MPI_CHECK_RETURN(MPI_Win_sync(win));
+    MPI_CHECK_RETURN(MPI_Barrier(node));
+    MPI_CHECK_RETURN(MPI_Win_sync(win));
+}
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Random-projection pre-filter shared by the OpenMP, MPI and MPI+OpenMP versions
+ *
+ * Points and centroids are projected on a few random directions (a Johnson-Lindenstrauss
+ * sketch). The random directions are orthonormalized, so the distance between two sketches
+ * is a lower bound of the full-dimensional distance. For every point the bound is computed
+ * against all the centroids, and the exact distance is only computed for the shortlist of
+ * centroids whose bound does not exceed the best exact distance found so far. The previous
+ * centroid of the point is evaluated first to make the shortlist small.
+ *
+ * The sketch of the data is computed once; the sketch of the centroids every iteration.
+ * Ties are resolved towards the lowest centroid as in Lloyd. A final verification pass
+ * compares the labels with a brute-force assignment and fixes any difference.
+ */
+#ifndef KMEANS_SKETCH_H
+#define KMEANS_SKETCH_H
+
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+
+#define SKETCH_DEFAULT_DIMS 16
+// Relative slack applied to the lower bounds to absorb the rounding of the projections
+#define SKETCH_SLACK 1e-3f
+#define SKETCH_SEED 0x2545F4914F6CDD1DULL
+
+/*
+Function sketchRandom: xorshift64* generator, independent of rand() so the initial centroids do not change.
+*/
+static double sketchRandom(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+Function sketchDims: Number of projected dimensions, KMEANS_SKETCH_DIMS or SKETCH_DEFAULT_DIMS, at most samples.
+*/
+static int sketchDims(int samples)
+{
+    const char* rawDims = getenv("KMEANS_SKETCH_DIMS");
+    int dims = (rawDims != NULL && atoi(rawDims) > 0) ? atoi(rawDims) : SKETCH_DEFAULT_DIMS;
+    return dims < samples ? dims : samples;
+}
+
+/*
+Function sketchBasis: dims x samples matrix with orthonormal rows drawn from a Gaussian.
+Every process builds the same basis. Returns NULL if the memory could not be allocated.
+*/
+static float* sketchBasis(int samples, int dims)
+{
+    double* basis = malloc((long)dims * samples * sizeof(double));
+    float* result = malloc((long)dims * samples * sizeof(float));
+    unsigned long long state = SKETCH_SEED;
+    int r, q, d;
+
+    if (basis == NULL || result == NULL)
+    {
+        free(basis);
+        free(result);
+        return NULL;
+    }
+
+    for (r = 0; r < dims; r++)
+    {
+        double* row = &basis[(long)r * samples];
+        double norm;
+        do
+        {
+            // Box-Muller
+            for (d = 0; d < samples; d++)
+            {
+                double u = sketchRandom(&state), v = sketchRandom(&state);
+                row[d] = sqrt(-2.0 * log(u + 1e-300)) * cos(2.0 * M_PI * v);
+            }
+            // Gram-Schmidt against the previous rows
+            for (q = 0; q < r; q++)
+            {
+                double dot = 0.0;
+                for (d = 0; d < samples; d++)
+                {
+                    dot += row[d] * basis[(long)q * samples + d];
+                }
+                for (d = 0; d < samples; d++)
+                {
+                    row[d] -= dot * basis[(long)q * samples + d];
+                }
+            }
+            norm = 0.0;
+            for (d = 0; d < samples; d++)
+            {
+                norm += row[d] * row[d];
+            }
+        }
+        while (norm < 1e-12);
+
+        norm = sqrt(norm);
+        for (d = 0; d < samples; d++)
+        {
+            row[d] /= norm;
+            result[(long)r * samples + d] = row[d];
+        }
+    }
+
+    free(basis);
+    return result;
+}
+
+/*
+Function projectRow: Sketch of one row.
+*/
+static inline void projectRow(const float* row, const float* basis, int samples, int dims, float* sketch)
+{
+    for (int r = 0; r < dims; r++)
+    {
+        double dot = 0.0;
+        for (int d = 0; d < samples; d++)
+        {
+            dot += (double)row[d] * basis[(long)r * samples + d];
+        }
+        sketch[r] = dot;
+    }
+}
+
+/*
+Function projectRows: Sketch of lines consecutive rows, computed in parallel when OpenMP is enabled.
+*/
+static void projectRows(const float* rows, int lines, const float* basis, int samples, int dims, float* sketch)
+{
+    int i;
+    #ifdef _OPENMP
+    # pragma omp parallel for schedule(static)
+    #endif
+    for (i = 0; i < lines; i++)
+    {
+        projectRow(&rows[(long)i * samples], basis, samples, dims, &sketch[(long)i * dims]);
+    }
+}
+
+/*
+Function exactSquared: Squared distance accumulated in the same order as euclideanDistance().
+*/
+static inline float_t exactSquared(const float* point, const float* center, int samples)
+{
+    float_t acc = 0.0, diff;
+    for (int d = 0; d < samples; d++)
+    {
+        diff = point[d] - center[d];
+        acc += diff * diff;
+    }
+    return acc;
+}
+
+/*
+Function assignSketch: Nearest centroid of a point (class 1..K) using the sketch lower bounds.
+previous is the class of the point in the last iteration (0 if none), bound is scratch space for K floats.
+evaluated is increased by the number of exact distances computed.
+*/
+static int assignSketch(const float* point, const float* pointSketch, const float* centroids,
+                        const float* centroidSketch, int K, int samples, int dims, int previous,
+                        float* bound, long* evaluated)
+{
+    int c, r, first = 0;
+    float_t acc, dist, diff;
+
+    for (c = 0; c < K; c++)
+    {
+        acc = 0.0;
+        for (r = 0; r < dims; r++)
+        {
+            diff = pointSketch[r] - centroidSketch[(long)c * dims + r];
+            acc += diff * diff;
+        }
+        bound[c] = acc * (1.0f - SKETCH_SLACK);
+        if (bound[c] < bound[first])
+        {
+            first = c;
+        }
+    }
+    if (previous > 0)
+    {
+        first = previous - 1;
+    }
+
+    float_t bestAcc = exactSquared(point, &centroids[(long)first * samples], samples);
+    float_t best = sqrt(bestAcc);
+    int bestIdx = first;
+    long count = 1;
+
+    for (c = 0; c < K; c++)
+    {
+        // Outside the shortlist: the full distance is larger than the best one.
+        // A centroid before the current best is kept while its distance may still tie.
+        if (c == first || (bound[c] > bestAcc && (c > bestIdx || (float_t)sqrt(bound[c]) > best)))
+        {
+            continue;
+        }
+
+        acc = exactSquared(point, &centroids[(long)c * samples], samples);
+        count++;
+        dist = sqrt(acc);
+        if (dist < best || (dist == best && c < bestIdx))
+        {
+            best = dist;
+            bestAcc = acc;
+            bestIdx = c;
+        }
+    }
+
+    *evaluated += count;
+    return bestIdx + 1;
+}
+
+/*
+Function assignExact: Brute-force nearest centroid (class 1..K), used by the verification pass.
+*/
+static int assignExact(const float* point, const float* centroids, int K, int samples)
+{
+    float_t dist, minDist = FLT_MAX;
+    int c, cluster = 1;
+    for (c = 0; c < K; c++)
+    {
+        dist = sqrt(exactSquared(point, &centroids[(long)c * samples], samples));
+        if (dist < minDist)
+        {
+            minDist = dist;
+            cluster = c + 1;
+        }
+    }
+    return cluster;
+}
+
+#endif
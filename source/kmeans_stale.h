@@ -0,0 +1,197 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Bounded-staleness model for the MPI version
+ *
+ * Instead of a collective reduction that every process has to reach, the sums and class counts
+ * of all the rows live in memory of the root of the communicator, attached to a dynamic window of
+ * MPI_COMM_WORLD. The window is created once by all the processes, so the groups of a split can
+ * run their clusterings at different times, each one attaching its model to it. After each iteration a process
+ * adds there the change of its own sums (the rows that changed class), its number of changes and
+ * the movement of its centroids after the previous iteration, and records the iteration it finished; before
+ * the next one it reads the whole model and computes the centroids from it. A process only waits
+ * when the slowest one is more than s iterations behind. Publishing takes an exclusive lock on the
+ * window and reading a shared one, so every read sees the complete contributions of each process.
+ * The changes of an iteration are added up and the movements reduced to their maximum in a record
+ * per iteration, complete once every process finished the next iteration: the stop condition is
+ * checked on these records, in order, so every process stops after the same iteration. A process
+ * that has to wait polls the model with a growing pause, otherwise its shared locks could keep the
+ * exclusive lock of the process it waits for from being granted.
+ * The including file must define MPI_CHECK_RETURN.
+ */
+#ifndef KMEANS_STALE_H
+#define KMEANS_STALE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+
+typedef struct
+{
+    MPI_Win win;            // dynamic window of MPI_COMM_WORLD (openStaleWindow)
+    MPI_Comm comm;
+    void* base;             // memory of the model on the root, NULL elsewhere
+    int root;               // rank of the root in MPI_COMM_WORLD
+    int K;
+    int samples;
+    int size;
+    MPI_Aint sumsDisp;      // addresses on the root: K x samples sums, K counts,
+    MPI_Aint countsDisp;
+    MPI_Aint progressDisp;  // the last iteration finished by each process,
+    MPI_Aint changesDisp;   // the changes of all the processes in each iteration (1..iterations)
+    MPI_Aint movedDisp;     // and the largest movement of a centroid after each iteration
+    long bytes;
+} StaleModel;
+
+/*
+Function openStaleWindow: Creates the dynamic window the models are attached to. Collective on
+MPI_COMM_WORLD, released with MPI_Win_free.
+*/
+static void openStaleWindow(MPI_Win* win)
+{
+    MPI_CHECK_RETURN(MPI_Win_create_dynamic(MPI_INFO_NULL, MPI_COMM_WORLD, win));
+}
+
+/*
+Function initStaleModel: Attaches a zeroed model for up to iterations iterations, on rank 0 of comm,
+to win. Collective on comm. Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int initStaleModel(StaleModel* model, MPI_Win win, int K, int samples, int iterations, MPI_Comm comm)
+{
+    int rank, error = 0;
+    MPI_Aint address = 0;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &model->size);
+    model->win = win;
+    model->comm = comm;
+    model->K = K;
+    model->samples = samples;
+    model->countsDisp = (MPI_Aint)K * samples * sizeof(float);
+    model->progressDisp = model->countsDisp + K * sizeof(int);
+    model->changesDisp = model->progressDisp + model->size * sizeof(int);
+    model->movedDisp = model->changesDisp + (iterations + 1) * sizeof(int);
+    model->bytes = model->movedDisp + (iterations + 1) * sizeof(float);
+    model->base = NULL;
+    MPI_Comm_rank(MPI_COMM_WORLD, &model->root);
+    if (rank == 0)
+    {
+        if ((model->base = calloc(model->bytes, 1)) == NULL)
+        {
+            error = -4;
+        }
+        else
+        {
+            MPI_CHECK_RETURN(MPI_Win_attach(win, model->base, model->bytes));
+            MPI_CHECK_RETURN(MPI_Get_address(model->base, &address));
+        }
+    }
+    // Every process of comm learns the error, the root and the address of the model
+    MPI_CHECK_RETURN(MPI_Bcast(&error, 1, MPI_INT, 0, comm));
+    MPI_CHECK_RETURN(MPI_Bcast(&model->root, 1, MPI_INT, 0, comm));
+    MPI_CHECK_RETURN(MPI_Bcast(&address, 1, MPI_AINT, 0, comm));
+    model->sumsDisp = address;
+    model->countsDisp += address;
+    model->progressDisp += address;
+    model->changesDisp += address;
+    model->movedDisp += address;
+    return error;
+}
+
+/*
+Function freeStaleModel: Detaches the model once no process of its communicator uses it. Collective
+on its communicator.
+*/
+static void freeStaleModel(StaleModel* model)
+{
+    MPI_CHECK_RETURN(MPI_Barrier(model->comm));
+    if (model->base != NULL)
+    {
+        MPI_CHECK_RETURN(MPI_Win_detach(model->win, model->base));
+        free(model->base);
+    }
+}
+
+/*
+Function publishStale: Adds the change of the local sums and class counts (NULL when no row changed
+class), the changes of process rank in iteration and the movement moved of its centroids after
+iteration - 1, and records that the process finished iteration.
+*/
+static void publishStale(StaleModel* model, const float* deltaSums, const int* deltaCounts, int rank, int iteration,
+                         int changes, float moved)
+{
+    const int root = model->root, floats = model->K * model->samples;
+
+    MPI_CHECK_RETURN(MPI_Win_lock(MPI_LOCK_EXCLUSIVE, root, 0, model->win));
+    if (deltaSums != NULL)
+    {
+        MPI_CHECK_RETURN(MPI_Accumulate(deltaSums, floats, MPI_FLOAT, root, model->sumsDisp, floats, MPI_FLOAT,
+                                        MPI_SUM, model->win));
+        MPI_CHECK_RETURN(MPI_Accumulate(deltaCounts, model->K, MPI_INT, root, model->countsDisp, model->K, MPI_INT,
+                                        MPI_SUM, model->win));
+    }
+    MPI_CHECK_RETURN(MPI_Accumulate(&changes, 1, MPI_INT, root, model->changesDisp + iteration * sizeof(int), 1,
+                                    MPI_INT, MPI_SUM, model->win));
+    MPI_CHECK_RETURN(MPI_Accumulate(&moved, 1, MPI_FLOAT, root, model->movedDisp + (iteration - 1) * sizeof(float),
+                                    1, MPI_FLOAT, MPI_MAX, model->win));
+    MPI_CHECK_RETURN(MPI_Put(&iteration, 1, MPI_INT, root, model->progressDisp + rank * sizeof(int), 1, MPI_INT,
+                             model->win));
+    MPI_CHECK_RETURN(MPI_Win_unlock(root, model->win));
+}
+
+/*
+Function readStale: Copies the sums and counts (when sums is not NULL), the progress of every
+process (size ints) and the changes and movement recorded for iteration (when changes is not NULL).
+*/
+static void readStale(StaleModel* model, float* sums, int* counts, int* progress, int iteration, int* changes,
+                      float* moved)
+{
+    const int root = model->root, floats = model->K * model->samples;
+
+    MPI_CHECK_RETURN(MPI_Win_lock(MPI_LOCK_SHARED, root, 0, model->win));
+    if (sums != NULL)
+    {
+        MPI_CHECK_RETURN(MPI_Get(sums, floats, MPI_FLOAT, root, model->sumsDisp, floats, MPI_FLOAT, model->win));
+        MPI_CHECK_RETURN(MPI_Get(counts, model->K, MPI_INT, root, model->countsDisp, model->K, MPI_INT, model->win));
+    }
+    MPI_CHECK_RETURN(MPI_Get(progress, model->size, MPI_INT, root, model->progressDisp, model->size, MPI_INT,
+                             model->win));
+    if (changes != NULL)
+    {
+        MPI_CHECK_RETURN(MPI_Get(changes, 1, MPI_INT, root, model->changesDisp + iteration * sizeof(int), 1, MPI_INT,
+                                 model->win));
+        MPI_CHECK_RETURN(MPI_Get(moved, 1, MPI_FLOAT, root, model->movedDisp + iteration * sizeof(float), 1,
+                                 MPI_FLOAT, model->win));
+    }
+    MPI_CHECK_RETURN(MPI_Win_unlock(root, model->win));
+}
+
+/*
+Function waitStale: Reads the progress of the model until every process finished iteration needed.
+Returns the seconds waited.
+*/
+static double waitStale(StaleModel* model, int needed, int* progress)
+{
+    struct timespec pause = { 0, 1000 };
+    double start = MPI_Wtime();
+    int slowest, r;
+
+    for (;;)
+    {
+        readStale(model, NULL, NULL, progress, 0, NULL, NULL);
+        slowest = needed;
+        for (r = 0; r < model->size; r++)
+        {
+            slowest = progress[r] < slowest ? progress[r] : slowest;
+        }
+        if (slowest >= needed)
+        {
+            return MPI_Wtime() - start;
+        }
+        nanosleep(&pause, NULL);
+        pause.tv_nsec = pause.tv_nsec < 1000000 ? 2 * pause.tv_nsec : pause.tv_nsec;
+    }
+}
+
+#endif
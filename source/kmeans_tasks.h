@@ -0,0 +1,89 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Two-dimensional task decomposition of the assignment step for the OpenMP version
+ *
+ * Splitting only the points gives every thread lines / threads points, which is little work
+ * when there are a few thousand points but thousands of centroids. The grid mode splits the
+ * points and the centroids in blocks and runs one task per pair of blocks; each task leaves the
+ * partial minimum of its points over its centroids, and a combine pass keeps, for every point,
+ * the first minimum over the centroid blocks in increasing order. The partial minima are
+ * computed with assignTiled(), so the resulting classMap is the same as point by point.
+ */
+#ifndef KMEANS_TASKS_H
+#define KMEANS_TASKS_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DECOMPOSITION_AUTO 0
+#define DECOMPOSITION_POINTS 1
+#define DECOMPOSITION_GRID 2
+// Automatic choice: the grid is used when there are fewer points than this many times K
+#define GRID_LINES_PER_CENTROID 8
+// Tasks created per thread and iteration, and minimum points of a block
+#define GRID_TASKS_PER_THREAD 4
+#define GRID_MIN_POINTS 32
+
+typedef struct
+{
+    int pointBlock;      // points per block
+    int centroidBlock;   // centroids per block
+    int pointBlocks;
+    int centroidBlocks;
+} TaskGrid;
+
+/*
+Function decompositionMode: KMEANS_DECOMPOSITION=points|grid forces the decomposition of the
+assignment step, otherwise it is chosen from the number of points per centroid.
+*/
+static int decompositionMode(void)
+{
+    const char* raw = getenv("KMEANS_DECOMPOSITION");
+    if (raw != NULL && strcmp(raw, "points") == 0)
+    {
+        return DECOMPOSITION_POINTS;
+    }
+    if (raw != NULL && strcmp(raw, "grid") == 0)
+    {
+        return DECOMPOSITION_GRID;
+    }
+    return DECOMPOSITION_AUTO;
+}
+
+/*
+Function useTaskGrid: 1 when the assignment of lines points to K centroids with threads threads
+should use the grid of tasks in the given mode.
+*/
+static int useTaskGrid(int mode, int lines, int K, int threads)
+{
+    if (mode != DECOMPOSITION_AUTO)
+    {
+        return mode == DECOMPOSITION_GRID;
+    }
+    return threads > 1 && (long)lines < (long)GRID_LINES_PER_CENTROID * K;
+}
+
+/*
+Function chooseTaskGrid: Blocks of the grid: up to one block of points per thread (of at least
+GRID_MIN_POINTS points), and as many blocks of centroids as needed for a few tasks per thread.
+*/
+static TaskGrid chooseTaskGrid(int lines, int K, int threads)
+{
+    TaskGrid grid;
+    int pointBlocks = (lines + GRID_MIN_POINTS - 1) / GRID_MIN_POINTS;
+    int centroidBlocks;
+
+    pointBlocks = pointBlocks < threads ? pointBlocks : threads;
+    pointBlocks = pointBlocks > 0 ? pointBlocks : 1;
+    centroidBlocks = (GRID_TASKS_PER_THREAD * threads + pointBlocks - 1) / pointBlocks;
+    centroidBlocks = centroidBlocks < K ? centroidBlocks : K;
+
+    grid.pointBlock = (lines + pointBlocks - 1) / pointBlocks;
+    grid.centroidBlock = (K + centroidBlocks - 1) / centroidBlocks;
+    grid.pointBlocks = (lines + grid.pointBlock - 1) / grid.pointBlock;
+    grid.centroidBlocks = (K + grid.centroidBlock - 1) / grid.centroidBlock;
+    return grid;
+}
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Cache-tiled assignment step shared by the OpenMP, MPI and MPI+OpenMP versions
+ *
+ * The assignment step is split in blocks of points and blocks of centroids. A block of
+ * centroids is sized to stay resident in L1 while the block of points (sized for L2) is
+ * streamed against it, and the partial minimum of every point is kept across centroid blocks.
+ * Distances are accumulated dimension by dimension exactly like euclideanDistance(), and
+ * centroid blocks are visited in increasing order, so the resulting classMap is the same.
+ */
+#ifndef KMEANS_TILING_H
+#define KMEANS_TILING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <unistd.h>
+
+#define TILING_DEFAULT_L1 (32 * 1024)
+#define TILING_DEFAULT_L2 (1024 * 1024)
+// Number of centroids compared against a point at the same time (register tile)
+#define TILING_MICRO 4
+// Minimum number of point blocks that each worker should receive
+#define TILING_BLOCKS_PER_WORKER 4
+
+typedef struct
+{
+    int pointTile;    // points per block
+    int centroidTile; // centroids per block
+    long l1Size;      // detected L1 data cache size in bytes
+    long l2Size;      // detected L2 cache size in bytes
+} TileSizes;
+
+/*
+Function readCacheSize: Size in bytes of the data cache of the given level (1 or 2).
+It uses sysconf when available and falls back to sysfs, returning 0 when unknown.
+*/
+static long readCacheSize(int level)
+{
+    long size = 0;
+    #if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+    size = sysconf(level == 1 ? _SC_LEVEL1_DCACHE_SIZE : _SC_LEVEL2_CACHE_SIZE);
+    #endif
+    if (size > 0)
+    {
+        return size;
+    }
+
+    // index0 is the L1 data cache and index2 the unified L2 on Linux
+    char path[100], unit = 'K';
+    FILE* fp;
+    sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", level == 1 ? 0 : 2);
+    if ((fp = fopen(path, "r")) != NULL)
+    {
+        if (fscanf(fp, "%ld%c", &size, &unit) < 1)
+        {
+            size = 0;
+        }
+        fclose(fp);
+        if (unit == 'K')
+        {
+            size *= 1024;
+        }
+        else if (unit == 'M')
+        {
+            size *= 1024 * 1024;
+        }
+    }
+
+    return size > 0 ? size : 0;
+}
+
+/*
+Function chooseTileSizes: Picks the block sizes from the cache sizes of the machine.
+Half of L1 is reserved to a block of centroids and half of L2 to a block of points.
+The point block is also bounded so that every worker receives a few blocks.
+KMEANS_TILE_POINTS and KMEANS_TILE_CENTROIDS override the automatic choice.
+*/
+static TileSizes chooseTileSizes(int lines, int samples, int K, int workers)
+{
+    TileSizes tiles;
+    long rowBytes = (long)samples * sizeof(float);
+    const char* rawPoints = getenv("KMEANS_TILE_POINTS");
+    const char* rawCentroids = getenv("KMEANS_TILE_CENTROIDS");
+
+    tiles.l1Size = readCacheSize(1);
+    tiles.l2Size = readCacheSize(2);
+    if (tiles.l1Size == 0) tiles.l1Size = TILING_DEFAULT_L1;
+    if (tiles.l2Size == 0) tiles.l2Size = TILING_DEFAULT_L2;
+
+    long centroidTile = (tiles.l1Size / 2) / rowBytes;
+    if (centroidTile >= TILING_MICRO)
+    {
+        centroidTile -= centroidTile % TILING_MICRO;
+    }
+    if (centroidTile > K) centroidTile = K;
+    if (centroidTile < 1) centroidTile = 1;
+
+    long pointTile = (tiles.l2Size / 2) / rowBytes;
+    long perWorker = (lines + (long)workers * TILING_BLOCKS_PER_WORKER - 1) / ((long)workers * TILING_BLOCKS_PER_WORKER);
+    if (pointTile > perWorker) pointTile = perWorker;
+    if (pointTile < 1) pointTile = 1;
+
+    tiles.pointTile = (rawPoints != NULL && atoi(rawPoints) > 0) ? atoi(rawPoints) : (int)pointTile;
+    tiles.centroidTile = (rawCentroids != NULL && atoi(rawCentroids) > 0) ? atoi(rawCentroids) : (int)centroidTile;
+
+    return tiles;
+}
+
+/*
+Function assignTiled: Assigns a block of consecutive points to their nearest centroid.
+points is the first row of the block and count the number of rows.
+minDist and cluster have one entry per point; cluster gets the class (1..K) of each point.
+*/
+static void assignTiled(const float* points, int count, const float* centroids, int K, int samples,
+                        int centroidTile, float* minDist, int* cluster)
+{
+    int p, c, d, first, last;
+
+    for (p = 0; p < count; p++)
+    {
+        minDist[p] = FLT_MAX;
+        cluster[p] = 1;
+    }
+
+    for (first = 0; first < K; first += centroidTile)
+    {
+        last = first + centroidTile < K ? first + centroidTile : K;
+
+        for (p = 0; p < count; p++)
+        {
+            const float* point = &points[(long)p * samples];
+            float_t best = minDist[p];
+            int bestCluster = cluster[p];
+
+            // Micro tile: TILING_MICRO independent accumulators over the same point row
+            for (c = first; c + TILING_MICRO <= last; c += TILING_MICRO)
+            {
+                const float* c0 = &centroids[(long)c * samples];
+                const float* c1 = c0 + samples;
+                const float* c2 = c1 + samples;
+                const float* c3 = c2 + samples;
+                float_t d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0, diff;
+                for (d = 0; d < samples; d++)
+                {
+                    diff = point[d] - c0[d];
+                    d0 += diff * diff;
+                    diff = point[d] - c1[d];
+                    d1 += diff * diff;
+                    diff = point[d] - c2[d];
+                    d2 += diff * diff;
+                    diff = point[d] - c3[d];
+                    d3 += diff * diff;
+                }
+                d0 = sqrt(d0);
+                d1 = sqrt(d1);
+                d2 = sqrt(d2);
+                d3 = sqrt(d3);
+                if (d0 < best) { best = d0; bestCluster = c + 1; }
+                if (d1 < best) { best = d1; bestCluster = c + 2; }
+                if (d2 < best) { best = d2; bestCluster = c + 3; }
+                if (d3 < best) { best = d3; bestCluster = c + 4; }
+            }
+
+            for (; c < last; c++)
+            {
+                const float* center = &centroids[(long)c * samples];
+                float_t dist = 0.0, diff;
+                for (d = 0; d < samples; d++)
+                {
+                    diff = point[d] - center[d];
+                    dist += diff * diff;
+                }
+                dist = sqrt(dist);
+                if (dist < best)
+                {
+                    best = dist;
+                    bestCluster = c + 1;
+                }
+            }
+
+            minDist[p] = best;
+            cluster[p] = bestCluster;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Per-phase timing of the OpenMP, MPI and MPI+OpenMP versions
+ *
+ * With KMEANS_TRACE=<file> every thread of every process adds the time it spends in each phase
+ * of each iteration to a table allocated before the loop, so that recording costs two clock reads
+ * per phase and no synchronization. The time of a phase includes the wait at its closing barrier
+ * or collective, which shows the imbalance between threads and processes. The phases outside the
+ * loop (load, init, write) are recorded by the first thread of each process as iteration 0. The
+ * table is written as CSV, one row per process, thread, iteration and phase:
+ *
+ *     rank,thread,iteration,phase,seconds
+ *
+ * assign: labelling of the points. accumulate: sums of the coordinates of every class (in the
+ * OpenMP version including the combination of the partial sums of the threads). reduce: the sums
+ * and counts combined between processes, and the means. converge: movement of the centroids,
+ * termination check and the new centroids made visible to everybody.
+ *
+ * The MPI versions gather the tables of all the processes with gatherTrace; the including file must
+ * then define MPI_CHECK_RETURN.
+ */
+#ifndef KMEANS_TRACE_H
+#define KMEANS_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PHASE_LOAD 0
+#define PHASE_INIT 1
+#define PHASE_ASSIGN 2
+#define PHASE_ACCUMULATE 3
+#define PHASE_REDUCE 4
+#define PHASE_CONVERGE 5
+#define PHASE_WRITE 6
+#define PHASE_COUNT 7
+
+typedef struct
+{
+    int threads;
+    int iterations;       // iterations that fit in seconds
+    int recorded;         // iterations run, set after the loop
+    double* seconds;      // (iterations + 1) x threads x PHASE_COUNT, iteration 0 holds load, init and write
+} PhaseTrace;
+
+/*
+Function tracePath: KMEANS_TRACE, NULL when the phases are not timed.
+*/
+static inline const char* tracePath(void)
+{
+    const char* raw = getenv("KMEANS_TRACE");
+    return raw != NULL && raw[0] != '\0' ? raw : NULL;
+}
+
+/*
+Function initTrace: Empty table for up to iterations iterations of threads threads.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static inline int initTrace(PhaseTrace* trace, int iterations, int threads)
+{
+    trace->threads = threads;
+    trace->iterations = iterations;
+    trace->recorded = 0;
+    trace->seconds = calloc((long)(iterations + 1) * threads * PHASE_COUNT, sizeof(double));
+    return trace->seconds != NULL ? 0 : -4;
+}
+
+/*
+Function freeTrace: Releases the table.
+*/
+static inline void freeTrace(PhaseTrace* trace)
+{
+    free(trace->seconds);
+    trace->seconds = NULL;
+}
+
+/*
+Function tracePhase: Adds now - *mark to the phase of iteration for thread and moves the mark to
+now. Nothing is recorded without a trace or beyond its iterations.
+*/
+static inline void tracePhase(PhaseTrace* trace, int iteration, int thread, int phase, double* mark, double now)
+{
+    if (trace != NULL && iteration <= trace->iterations && thread < trace->threads)
+    {
+        trace->seconds[((long)iteration * trace->threads + thread) * PHASE_COUNT + phase] += now - *mark;
+    }
+    *mark = now;
+}
+
+/*
+Function writeTrace: Writes the tables of processes processes, stored one after another and shaped
+like the one of trace, to a CSV file. Only the first recorded iterations are written.
+Returns 0 on success and -3 if the file could not be written.
+*/
+static inline int writeTrace(const PhaseTrace* trace, const double* tables, int processes, int recorded,
+                             const char* filename)
+{
+    static const char* const names[PHASE_COUNT] = { "load", "init", "assign", "accumulate", "reduce", "converge",
+                                                    "write" };
+    const long tableSize = (long)(trace->iterations + 1) * trace->threads * PHASE_COUNT;
+    FILE* fp = fopen(filename, "wt");
+    int rank, it, thread, phase;
+
+    if (fp == NULL)
+    {
+        return -3;
+    }
+    fprintf(fp, "rank,thread,iteration,phase,seconds\n");
+    for (rank = 0; rank < processes; rank++)
+    {
+        for (it = 0; it <= recorded && it <= trace->iterations; it++)
+        {
+            for (thread = 0; thread < trace->threads; thread++)
+            {
+                const double* row = &tables[rank * tableSize + ((long)it * trace->threads + thread) * PHASE_COUNT];
+                for (phase = 0; phase < PHASE_COUNT; phase++)
+                {
+                    // Iteration 0 only has the phases outside the loop, the others only the ones inside
+                    if ((it == 0) == (phase == PHASE_LOAD || phase == PHASE_INIT || phase == PHASE_WRITE) &&
+                        (it > 0 || thread == 0))
+                    {
+                        fprintf(fp, "%d,%d,%d,%s,%.9f\n", rank, thread, it, names[phase], row[phase]);
+                    }
+                }
+            }
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+#ifdef MPI_VERSION
+/*
+Function gatherTrace: Collects the tables of every process of MPI_COMM_WORLD on rank 0, which
+writes them to filename. Returns 0 on success, -3 if the file could not be written and -4 if the
+memory could not be allocated (on rank 0).
+*/
+static inline int gatherTrace(const PhaseTrace* trace, const char* filename)
+{
+    int rank, size, recorded, error = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    const int tableSize = (trace->iterations + 1) * trace->threads * PHASE_COUNT;
+    double* tables = rank == 0 ? malloc((long)size * tableSize * sizeof(double)) : NULL;
+
+    MPI_CHECK_RETURN(MPI_Gather(trace->seconds, tableSize, MPI_DOUBLE, tables, tableSize, MPI_DOUBLE, 0,
+                                MPI_COMM_WORLD));
+    MPI_CHECK_RETURN(MPI_Reduce(&trace->recorded, &recorded, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD));
+    if (rank == 0)
+    {
+        error = tables == NULL ? -4 : writeTrace(trace, tables, size, recorded, filename);
+    }
+    free(tables);
+    return error;
+}
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * Autotuning of the OpenMP version
+ *
+ * The best number of threads, loop schedule and block sizes depend on the shape of the input
+ * (points, dimensions, clusters) and on the machine. The tuner runs a few short probe clusterings
+ * over candidate settings, one knob at a time, and keeps the fastest. Every choice is appended to a
+ * text cache file, one line per machine and shape, so that later runs on the same shape start with
+ * the tuned settings without probing again.
+ */
+#ifndef KMEANS_TUNE_H
+#define KMEANS_TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <omp.h>
+
+// Iterations of every probe clustering
+#define TUNE_PROBE_ITERATIONS 2
+// Chunk of the dynamic and guided schedules, in points
+#define TUNE_CHUNK 64
+#define TUNE_KEY_SIZE 300
+
+typedef struct
+{
+    int threads;
+    omp_sched_t schedule;  // schedule of the assignment loops
+    int chunk;             // 0: default chunk of the schedule
+    int pointTile;         // blocks of the tiled assignment, 0: chosen from the cache sizes
+    int centroidTile;
+    double seconds;        // time of the probe that chose these settings
+} TuneChoice;
+
+/*
+Function autotuneMode: KMEANS_AUTOTUNE=1 uses the cached choice of the shape or probes when there
+is none (1), KMEANS_AUTOTUNE=refresh always probes (2). 0 when not requested.
+*/
+static int autotuneMode(void)
+{
+    const char* raw = getenv("KMEANS_AUTOTUNE");
+    if (raw != NULL && strcmp(raw, "refresh") == 0)
+    {
+        return 2;
+    }
+    return raw != NULL && atoi(raw) == 1 ? 1 : 0;
+}
+
+/*
+Function tuneCachePath: KMEANS_TUNE_CACHE, or .kmeans_tune in the home directory, or in the
+current directory when there is no home.
+*/
+static void tuneCachePath(char* path, int size)
+{
+    const char* raw = getenv("KMEANS_TUNE_CACHE");
+    const char* home = getenv("HOME");
+    if (raw != NULL)
+    {
+        snprintf(path, size, "%s", raw);
+    }
+    else
+    {
+        snprintf(path, size, "%s/.kmeans_tune", home != NULL ? home : ".");
+    }
+}
+
+/*
+Function tuneKey: Key of a shape on this machine: CPU model (spaces replaced), available threads,
+assignment kernel, points, dimensions and clusters, separated by tabs.
+*/
+static void tuneKey(char* key, int lines, int samples, int K, int maxThreads, const char* kernel)
+{
+    char line[256], model[128] = "unknown";
+    char* value;
+    int i;
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (strncmp(line, "model name", 10) == 0 && (value = strchr(line, ':')) != NULL)
+        {
+            snprintf(model, sizeof(model), "%s", value + 2);
+            break;
+        }
+    }
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+    for (i = 0; model[i] != '\0'; i++)
+    {
+        if (model[i] == '\n')
+        {
+            model[i] = '\0';
+            break;
+        }
+        if (isspace((unsigned char)model[i]))
+        {
+            model[i] = '_';
+        }
+    }
+    snprintf(key, TUNE_KEY_SIZE, "%s\t%d\t%s\t%d\t%d\t%d", model, maxThreads, kernel, lines, samples, K);
+}
+
+/*
+Function readTuneCache: Looks for key in the cache file, the last line of the key wins.
+Returns 1 and fills choice when found, 0 otherwise.
+*/
+static int readTuneCache(const char* path, const char* key, TuneChoice* choice)
+{
+    char line[TUNE_KEY_SIZE + 100];
+    size_t keyLength = strlen(key);
+    int found = 0, schedule;
+    TuneChoice read;
+    FILE* fp = fopen(path, "r");
+
+    if (fp == NULL)
+    {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (strncmp(line, key, keyLength) == 0 && line[keyLength] == '\t' &&
+            sscanf(line + keyLength + 1, "%d %d %d %d %d %lf", &read.threads, &schedule, &read.chunk,
+                   &read.pointTile, &read.centroidTile, &read.seconds) == 6 && read.threads > 0)
+        {
+            read.schedule = (omp_sched_t)schedule;
+            *choice = read;
+            found = 1;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/*
+Function writeTuneCache: Appends the choice of key to the cache file.
+Returns 0 on success and -3 if the file could not be written.
+*/
+static int writeTuneCache(const char* path, const char* key, const TuneChoice* choice)
+{
+    FILE* fp = fopen(path, "a");
+    if (fp == NULL)
+    {
+        return -3;
+    }
+    fprintf(fp, "%s\t%d\t%d\t%d\t%d\t%d\t%f\n", key, choice->threads, (int)choice->schedule, choice->chunk,
+            choice->pointTile, choice->centroidTile, choice->seconds);
+    fclose(fp);
+    return 0;
+}
+
+/*
+Function scheduleName: Name of an OpenMP schedule kind.
+*/
+static inline const char* scheduleName(omp_sched_t schedule)
+{
+    switch (schedule)
+    {
+    case omp_sched_dynamic:
+        return "dynamic";
+    case omp_sched_guided:
+        return "guided";
+    default:
+        return "static";
+    }
+}
+
+#endif
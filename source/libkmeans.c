@@ -0,0 +1,1942 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * OpenMP version, built as libkmeans behind the C API of libkmeans.h
+ *
+ * Parallel computing (Degree in Computer Engineering)
+ * 2022/2023
+ *
+ * Version: 1.0
+ *
+ * (c) 2022 Diego García-Álvarez, Arturo Gonzalez-Escribano
+ * Grupo Trasgo, Universidad de Valladolid (Spain)
+ *
+ * This work is licensed under a Creative Commons Attribution-ShareAlike 4.0 International License.
+ * https://creativecommons.org/licenses/by-sa/4.0/
+ */
+// Thread binding (sched_setaffinity, sched_getcpu)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <string.h>
+#include <float.h>
+#include <omp.h>
+#include <assert.h>
+#include "kmeans_common.h"
+#include "kmeans_tiling.h"
+#include "kmeans_layout.h"
+#include "kmeans_pds.h"
+#include "kmeans_sketch.h"
+#include "kmeans_index.h"
+#include "kmeans_numa.h"
+#include "kmeans_tune.h"
+#include "kmeans_tasks.h"
+#include "kmeans_bounds.h"
+#include "kmeans_trace.h"
+#include "kmeans_perf.h"
+#include "libkmeans.h"
+
+// Below this number of lines per thread the restarts run at the same time instead of one after another
+#define RESTART_LINES_PER_THREAD 4096
+
+//Macros
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+/*
+ * Input rows shared by all the clusterings of a run, with the structures derived from them
+ */
+typedef struct
+{
+    const float* data;    // lines x samples input rows
+    int lines;
+    int samples;
+    int aosoaLayout;      // KMEANS_LAYOUT=aosoa
+    int tiledAssign;      // KMEANS_ASSIGN=tiled
+    int pdsAssign;        // KMEANS_ASSIGN=pds
+    int sketchAssign;     // KMEANS_ASSIGN=sketch
+    int indexAssign;      // KMEANS_ASSIGN=index
+    AoSoAData layout;     // blocked copy of data
+    int* pdsOrder;        // dimensions sorted by decreasing variance, or NULL
+    float* sketchRows;    // sketchDim x samples projection basis
+    float* dataSketch;    // lines x sketchDim projection of data
+    int sketchDim;
+    const ThreadPlacement* placement; // node of each thread with KMEANS_NUMA, NULL otherwise
+    omp_sched_t schedule; // schedule of the assignment loops
+    int chunk;            // chunk of the schedule, 0: its default
+    int pointTile;        // blocks of the tiled assignment, 0: chosen from the cache sizes
+    int centroidTile;
+    int decomposition;    // KMEANS_DECOMPOSITION: DECOMPOSITION_AUTO, _POINTS or _GRID
+} KMeansInput;
+
+/*
+ * Outcome of one clustering
+ */
+typedef struct
+{
+    int iterations;
+    int changes;          // class changes left when the loop stopped
+    float maxDist;        // centroid movement left when the loop stopped
+    double inertia;       // sum of the squared distances of the points to the centroid of their class
+    long pdsEvaluated;
+    long sketchEvaluated;
+    int sketchMismatches;
+    int indexLists;
+    int indexProbes;
+    int indexMismatches;  // labels that differ from a brute-force assignment to the last centroids
+    int lloydMismatches;  // labels that differ from exact Lloyd (KMEANS_INDEX_REFERENCE), -1 when not compared
+    int gridPointBlocks;  // blocks of the task grid, 0 when the assignment is split by points
+    int gridCentroidBlocks;
+    int restart;          // restart that produced the result
+    int refitLines;       // new rows of an incremental clustering, 0 otherwise
+    long boundEvaluated;  // distances computed by the incremental clustering
+} KMeansRun;
+
+/*
+Function prepareInput: Reads the assignment options and builds the structures that only depend on
+the input rows (the blocked layout is built by prepareContext right before).
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int prepareInput(KMeansInput* in)
+{
+    // Assignment kernel: default one centroid at a time, "tiled" for blocks of points x blocks of centroids
+    const char* RAW_KMEANS_ASSIGN = getenv("KMEANS_ASSIGN");
+    in->tiledAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "tiled") == 0);
+    // "pds": partial distance search, optionally over the dimensions sorted by variance
+    in->pdsAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "pds") == 0);
+    const char* RAW_KMEANS_PDS_ORDER = getenv("KMEANS_PDS_ORDER");
+    in->pdsOrder = NULL;
+    if (in->pdsAssign && RAW_KMEANS_PDS_ORDER != NULL && strcmp(RAW_KMEANS_PDS_ORDER, "variance") == 0)
+    {
+        in->pdsOrder = varianceOrder(in->data, in->lines, in->samples);
+        if (in->pdsOrder == NULL)
+        {
+            return -4;
+        }
+    }
+    // "sketch": random-projection lower bounds shortlist the centroids compared exactly
+    in->sketchAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "sketch") == 0);
+    in->sketchDim = sketchDims(in->samples);
+    in->sketchRows = NULL;
+    in->dataSketch = NULL;
+    if (in->sketchAssign)
+    {
+        // The sketch of the input rows is computed once and kept next to data
+        in->sketchRows = sketchBasis(in->samples, in->sketchDim);
+        in->dataSketch = malloc((long)in->lines * in->sketchDim * sizeof(float));
+        if (in->sketchRows == NULL || in->dataSketch == NULL)
+        {
+            return -4;
+        }
+        projectRows(in->data, in->lines, in->sketchRows, in->samples, in->sketchDim, in->dataSketch);
+    }
+    // "index": search the nearest centroid in inverted lists of centroids rebuilt every iteration
+    in->indexAssign = (RAW_KMEANS_ASSIGN != NULL) && (strcmp(RAW_KMEANS_ASSIGN, "index") == 0);
+
+    // Static split of the lines and automatic block sizes until the autotuner says otherwise
+    in->schedule = omp_sched_static;
+    in->chunk = 0;
+    in->pointTile = 0;
+    in->centroidTile = 0;
+    // Points only or points x centroids for the default assignment, chosen per clustering from N/K
+    in->decomposition = decompositionMode();
+
+    return 0;
+}
+
+/*
+Function freeInput: Releases the structures built by prepareInput and the blocked layout.
+*/
+static void freeInput(KMeansInput* in)
+{
+    free(in->pdsOrder);
+    free(in->sketchRows);
+    free(in->dataSketch);
+    freeAoSoA(&in->layout);
+}
+
+/*
+Function kmeansFit: Runs the clustering of the input in K classes with threads threads.
+centroids holds the initial centroids and receives the final ones; classMap (lines entries, zeroed)
+receives the class of each point. In debug mode the progress of each iteration is appended to
+outputMsg when it is not NULL, the time of the phases of every thread is added to trace when it
+is not NULL, and the hardware counters of the assignment and the update of every thread to
+perf[thread] when perf is not NULL.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int kmeansFit(const KMeansInput* in, int K, float* centroids, int* classMap, int maxIterations, int minChanges,
+                     float maxThreshold, int threads, KMeansLog* outputMsg, PhaseTrace* trace, PerfCounters* perf,
+                     KMeansRun* run)
+{
+    const float* data = in->data;
+    const int lines = in->lines, samples = in->samples, sketchDim = in->sketchDim;
+    const int aosoaLayout = in->aosoaLayout, tiledAssign = in->tiledAssign, pdsAssign = in->pdsAssign;
+    const int sketchAssign = in->sketchAssign, indexAssign = in->indexAssign;
+    const AoSoAData layout = in->layout;
+
+    long pdsEvaluated = 0, sketchEvaluated = 0;
+    int sketchMismatches = 0;
+    float *centroidSketch = NULL, *prevCentroids = NULL;
+    if (sketchAssign && ((centroidSketch = malloc((long)K * sketchDim * sizeof(float))) == NULL ||
+                         (prevCentroids = malloc((long)K * samples * sizeof(float))) == NULL))
+    {
+        free(centroidSketch);
+        return -4;
+    }
+    CentroidIndex centroidIndex = { 0, 0, 0, 0.0f, NULL, NULL, NULL, NULL, NULL };
+    if (indexAssign && (initCentroidIndex(&centroidIndex, lines, samples, K) != 0 ||
+                        (prevCentroids = malloc((long)K * samples * sizeof(float))) == NULL))
+    {
+        freeCentroidIndex(&centroidIndex);
+        return -4;
+    }
+    TileSizes tiles = chooseTileSizes(lines, samples, K, threads);
+    if (in->pointTile > 0)
+    {
+        tiles.pointTile = in->pointTile;
+        tiles.centroidTile = in->centroidTile;
+    }
+    // The assignment loops use schedule(runtime); only the static split lets step 2 skip the barrier
+    const int staticSplit = in->schedule == omp_sched_static;
+    omp_set_schedule(in->schedule, in->chunk);
+
+    // Task grid of the default assignment: partial minimum of each point in every centroid block
+    const int grid = !aosoaLayout && !tiledAssign && !pdsAssign && !sketchAssign && !indexAssign &&
+                     useTaskGrid(in->decomposition, lines, K, threads);
+    const TaskGrid taskGrid = chooseTaskGrid(lines, K, threads);
+    float* gridDist = NULL;
+    int* gridCluster = NULL;
+
+    int i, j, cluster;
+    int changes = 0, lastChanges = 0;
+    int anotherIteration = 0;
+    int it = 1;
+    int auxCentroidsSize = K * samples;
+    float_t dist, minDist = FLT_MAX, maxDist = FLT_MIN, lastMaxDist = FLT_MIN;
+
+    // pointPerClass: number of points classified in each class
+    // auxCentroids: mean of the points in each class
+    int* pointsPerClass = calloc(K, sizeof(int));
+    float* auxCentroids = calloc(auxCentroidsSize, sizeof(float));
+    // movement: squared difference of every coordinate of the centroids in the grid mode
+    float* movement = grid ? malloc(auxCentroidsSize * sizeof(float)) : NULL;
+    if (grid)
+    {
+        gridDist = malloc((long)taskGrid.centroidBlocks * lines * sizeof(float));
+        gridCluster = malloc((long)taskGrid.centroidBlocks * lines * sizeof(int));
+    }
+    // replicas: copy of the centroids in the memory of each NUMA node, only for the team the threads were placed for
+    const ThreadPlacement* placement = in->placement;
+    const int replicate = placement != NULL && placement->nodes > 1 && placement->threads == threads &&
+                          omp_get_active_level() == 0;
+    float** replicas = replicate ? calloc(placement->nodes, sizeof(float*)) : NULL;
+    if (pointsPerClass == NULL || auxCentroids == NULL || (replicate && replicas == NULL) ||
+        (grid && (movement == NULL || gridDist == NULL || gridCluster == NULL)))
+    {
+        free(pointsPerClass);
+        free(auxCentroids);
+        free(movement);
+        free(gridDist);
+        free(gridCluster);
+        free(replicas);
+        free(centroidSketch);
+        free(prevCentroids);
+        freeCentroidIndex(&centroidIndex);
+        return -4;
+    }
+
+    # pragma omp parallel num_threads(threads) private(i, j, cluster, dist, minDist)
+    {
+        // Per-thread partial minimum of the points in the current block
+        float* tileMinDist = NULL;
+        int* tileCluster = NULL;
+        if (tiledAssign)
+        {
+            tileMinDist = malloc(tiles.pointTile * sizeof(float));
+            tileCluster = malloc(tiles.pointTile * sizeof(int));
+            assert(tileMinDist != NULL && tileCluster != NULL);
+        }
+
+        int groupCluster[AOSOA_MAX_WIDTH];
+        float* sketchBound = NULL;
+        float* indexListDist = NULL;
+        int* indexOrder = NULL;
+        if (indexAssign)
+        {
+            indexListDist = malloc(centroidIndex.lists * sizeof(float));
+            indexOrder = malloc(centroidIndex.lists * sizeof(int));
+            assert(indexListDist != NULL && indexOrder != NULL);
+        }
+        if (sketchAssign)
+        {
+            sketchBound = malloc(K * sizeof(float));
+            assert(sketchBound != NULL);
+        }
+
+        // The first thread of each node allocates (and so places) the replica of its node and refreshes it
+        const int node = replicate ? placement->node[omp_get_thread_num()] : 0;
+        const float* nodeCentroids = centroids;
+        int replicaLeader = 0;
+        if (replicate)
+        {
+            # pragma omp critical
+            if (replicas[node] == NULL)
+            {
+                replicas[node] = malloc(auxCentroidsSize * sizeof(float));
+                replicaLeader = 1;
+            }
+            assert(!replicaLeader || replicas[node] != NULL);
+        }
+
+        // Phases of every iteration of this thread
+        const int thread = omp_get_thread_num();
+        int iteration;
+        double mark;
+        PerfCounters* const counters = perf != NULL ? &perf[thread] : NULL;
+        if (counters != NULL)
+        {
+            perfOpen(counters, omp_get_wtime());
+        }
+
+        do
+        {
+            iteration = it;
+            mark = omp_get_wtime();
+            if (replicate)
+            {
+                if (replicaLeader)
+                {
+                    memcpy(replicas[node], centroids, (auxCentroidsSize * sizeof(float)));
+                }
+                # pragma omp barrier
+                nodeCentroids = replicas[node];
+            }
+
+            if (sketchAssign)
+            {
+                # pragma omp for
+                for (i = 0; i < K; i++)
+                {
+                    projectRow(&centroids[i * samples], in->sketchRows, samples, sketchDim, &centroidSketch[i * sketchDim]);
+                }
+            }
+
+            if (indexAssign)
+            {
+                buildCentroidIndex(&centroidIndex, centroids, K, samples);
+                calibrateCentroidIndex(&centroidIndex, data, lines, centroids, K, samples, indexListDist);
+            }
+
+            // 1. Assign each point to a class and count the elements in each class
+            if (aosoaLayout)
+            {
+                # pragma omp for nowait schedule(runtime) reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < layout.groups; i++)
+                {
+                    int count = groupSize(&layout, i);
+                    assignAoSoA(&layout, i, nodeCentroids, K, groupCluster);
+
+                    for (j = 0; j < count; j++)
+                    {
+                        cluster = groupCluster[j];
+                        if (classMap[i * layout.width + j] != cluster)
+                        {
+                            classMap[i * layout.width + j] = cluster;
+                            changes++;
+                        }
+                        pointsPerClass[cluster - 1]++;
+                    }
+                }
+                // No need of implicit barrier, step 2 walks the same groups with the same static split.
+            }
+            else if (sketchAssign)
+            {
+                # pragma omp for nowait schedule(runtime) reduction(+:changes, pointsPerClass[:K], sketchEvaluated)
+                for (i = 0; i < lines; i++)
+                {
+                    cluster = assignSketch(&data[i * samples], &in->dataSketch[i * sketchDim], nodeCentroids,
+                                           centroidSketch, K, samples, sketchDim, classMap[i], sketchBound,
+                                           &sketchEvaluated);
+
+                    if (classMap[i] != cluster)
+                    {
+                        classMap[i] = cluster;
+                        changes++;
+                    }
+                    pointsPerClass[cluster - 1]++;
+                }
+                // No need of implicit barrier, the lines are split as in step 2.
+            }
+            else if (indexAssign)
+            {
+                # pragma omp for nowait schedule(runtime) reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < lines; i++)
+                {
+                    cluster = searchCentroidIndex(&centroidIndex, &data[i * samples], nodeCentroids, K, samples,
+                                                  classMap[i], indexListDist, indexOrder);
+
+                    if (classMap[i] != cluster)
+                    {
+                        classMap[i] = cluster;
+                        changes++;
+                    }
+                    pointsPerClass[cluster - 1]++;
+                }
+                // No need of implicit barrier, the lines are split as in step 2.
+            }
+            else if (pdsAssign)
+            {
+                # pragma omp for nowait schedule(runtime) reduction(+:changes, pointsPerClass[:K], pdsEvaluated)
+                for (i = 0; i < lines; i++)
+                {
+                    cluster = assignPDS(&data[i * samples], nodeCentroids, K, samples, classMap[i], in->pdsOrder,
+                                        &pdsEvaluated);
+
+                    if (classMap[i] != cluster)
+                    {
+                        classMap[i] = cluster;
+                        changes++;
+                    }
+                    pointsPerClass[cluster - 1]++;
+                }
+                // No need of implicit barrier, the lines are split as in step 2.
+            }
+            else if (tiledAssign)
+            {
+                # pragma omp for schedule(runtime) reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < lines; i += tiles.pointTile)
+                {
+                    int count = MIN(tiles.pointTile, lines - i);
+                    assignTiled(&data[i * samples], count, nodeCentroids, K, samples, tiles.centroidTile,
+                                tileMinDist, tileCluster);
+
+                    for (j = 0; j < count; j++)
+                    {
+                        if (classMap[i + j] != tileCluster[j])
+                        {
+                            classMap[i + j] = tileCluster[j];
+                            changes++;
+                        }
+                        pointsPerClass[tileCluster[j] - 1]++;
+                    }
+                }
+                // Blocks are not split like the lines of step 2, so the implicit barrier is kept.
+            }
+            else if (grid)
+            {
+                # pragma omp single
+                {
+                    for (int p = 0; p < taskGrid.pointBlocks; p++)
+                    {
+                        for (int c = 0; c < taskGrid.centroidBlocks; c++)
+                        {
+                            # pragma omp task firstprivate(p, c)
+                            {
+                                const int first = p * taskGrid.pointBlock;
+                                const int firstCentroid = c * taskGrid.centroidBlock;
+                                assignTiled(&data[(long)first * samples], MIN(taskGrid.pointBlock, lines - first),
+                                            &nodeCentroids[(long)firstCentroid * samples],
+                                            MIN(taskGrid.centroidBlock, K - firstCentroid), samples,
+                                            tiles.centroidTile, &gridDist[(long)c * lines + first],
+                                            &gridCluster[(long)c * lines + first]);
+                            }
+                        }
+                    }
+                }
+                // The implicit barrier of single waits for all the tasks
+
+                // Combine: first minimum over the centroid blocks, whose classes start at 1 in each block
+                # pragma omp for nowait schedule(runtime) reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < lines; i++)
+                {
+                    cluster = gridCluster[i], minDist = gridDist[i];
+                    for (j = 1; j < taskGrid.centroidBlocks; j++)
+                    {
+                        if (gridDist[(long)j * lines + i] < minDist)
+                        {
+                            minDist = gridDist[(long)j * lines + i];
+                            cluster = gridCluster[(long)j * lines + i] + j * taskGrid.centroidBlock;
+                        }
+                    }
+
+                    if (classMap[i] != cluster)
+                    {
+                        classMap[i] = cluster;
+                        changes++;
+                    }
+                    pointsPerClass[cluster - 1]++;
+                }
+                // No need of implicit barrier, the lines are split as in step 2.
+            }
+            else
+            {
+                # pragma omp for nowait schedule(runtime) reduction(+:changes, pointsPerClass[:K])
+                for (i = 0; i < lines; i++)
+                {
+                    cluster = 1, minDist = FLT_MAX;
+                    for (j = 0; j < K; j++)
+                    {
+                        dist = euclideanDistance(&data[i * samples], &nodeCentroids[j * samples], samples);
+
+                        if (dist < minDist)
+                        {
+                            minDist = dist;
+                            cluster = j + 1;
+                        }
+                    }
+
+                    if (classMap[i] != cluster)
+                    {
+                        classMap[i] = cluster;
+                        changes++;
+                    }
+                    pointsPerClass[cluster - 1]++;
+                }
+                // No need of implicit barrier, each thread will work on the classMap section that it has calculated.
+            }
+
+            if (!staticSplit)
+            {
+                # pragma omp barrier
+            }
+            tracePhase(trace, iteration, thread, PHASE_ASSIGN, &mark, omp_get_wtime());
+            perfPhase(counters, PERF_ASSIGN, mark);
+
+            // 2. Compute the partial sum of all the coordinates of point within the same cluster
+            if (aosoaLayout)
+            {
+                # pragma omp for reduction(+:auxCentroids[:auxCentroidsSize])
+                for (i = 0; i < layout.groups; i++)
+                {
+                    accumulateAoSoA(&layout, i, &classMap[i * layout.width], auxCentroids);
+                }
+            }
+            else
+            {
+                # pragma omp for reduction(+:auxCentroids[:auxCentroidsSize])
+                for (i = 0; i < lines; i++)
+                {
+                    cluster = classMap[i] - 1;
+                    for (j = 0; j < samples; j++)
+                    {
+                        auxCentroids[cluster * samples + j] += data[i * samples + j];
+                    }
+                }
+            }
+            tracePhase(trace, iteration, thread, PHASE_ACCUMULATE, &mark, omp_get_wtime());
+
+            if (grid)
+            {
+                // With few centroids per thread the means and their movement are split by coordinates
+                # pragma omp for collapse(2)
+                for (i = 0; i < K; i++)
+                {
+                    for (j = 0; j < samples; j++)
+                    {
+                        auxCentroids[i * samples + j] /= pointsPerClass[i];
+                        movement[i * samples + j] = (centroids[i * samples + j] - auxCentroids[i * samples + j]) *
+                                                    (centroids[i * samples + j] - auxCentroids[i * samples + j]);
+                    }
+                }
+                tracePhase(trace, iteration, thread, PHASE_REDUCE, &mark, omp_get_wtime());
+
+                // 3. Get the maximum movement of a centroid, adding the coordinates in the order of euclideanDistance
+                # pragma omp for reduction(max:maxDist)
+                for (i = 0; i < K; i++)
+                {
+                    dist = 0.0;
+                    for (j = 0; j < samples; j++)
+                    {
+                        dist += movement[i * samples + j];
+                    }
+                    dist = sqrt(dist);
+
+                    if (dist > maxDist)
+                    {
+                        maxDist = dist;
+                    }
+                    pointsPerClass[i] = 0;
+                }
+            }
+            else
+            {
+                # pragma omp for nowait
+                for (i = 0; i < K; i++)
+                {
+                    for (j = 0; j < samples; j++)
+                    {
+                        auxCentroids[i * samples + j] /= pointsPerClass[i];
+                    }
+                }
+                // No need of implicit barrier, each thread will work on the auxCentroids section that it has calculated.
+                tracePhase(trace, iteration, thread, PHASE_REDUCE, &mark, omp_get_wtime());
+
+                // 3. Get the maximum movement of a centroid compared to its previous position
+                # pragma omp for reduction(max:maxDist)
+                for (i = 0; i < K; i++)
+                {
+                    dist = euclideanDistance(&centroids[i * samples], &auxCentroids[i * samples], samples);
+
+                    if (dist > maxDist)
+                    {
+                        maxDist = dist;
+                    }
+                    pointsPerClass[i] = 0;
+                }
+            }
+
+            // 4. Check termination conditions and clean memory for the next iteration
+            # pragma omp single
+            {
+                #ifdef DEBUG
+                if (outputMsg != NULL)
+                {
+                    appendLog(outputMsg, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", it, changes,
+                              maxDist);
+                }
+                #endif
+
+                anotherIteration = (changes > minChanges) && (it < maxIterations) && (maxDist > maxThreshold);
+                // Kept for the result, the reduction variables start again from zero
+                lastChanges = changes;
+                lastMaxDist = maxDist;
+                maxDist = FLT_MIN;
+                changes = 0;
+                if (prevCentroids != NULL)
+                {
+                    memcpy(prevCentroids, centroids, (auxCentroidsSize * sizeof(float)));
+                }
+                memcpy(centroids, auxCentroids, (auxCentroidsSize * sizeof(float)));
+                memset(auxCentroids, 0.0, auxCentroidsSize * sizeof(float));
+                it++;
+            }
+            tracePhase(trace, iteration, thread, PHASE_CONVERGE, &mark, omp_get_wtime());
+            perfPhase(counters, PERF_UPDATE, mark);
+        }
+        while (anotherIteration);
+
+        perfClose(counters);
+        free(tileMinDist);
+        free(tileCluster);
+        free(sketchBound);
+        free(indexListDist);
+        free(indexOrder);
+    }
+    it--;
+    if (trace != NULL)
+    {
+        trace->recorded = it;
+    }
+    for (i = 0; replicate && i < placement->nodes; i++)
+    {
+        free(replicas[i]);
+    }
+    free(replicas);
+
+    // Verification pass: the labels must be the ones of a brute-force assignment to the last centroids used
+    if (sketchAssign)
+    {
+        # pragma omp parallel for num_threads(threads) private(cluster) reduction(+:sketchMismatches)
+        for (i = 0; i < lines; i++)
+        {
+            cluster = assignExact(&data[i * samples], prevCentroids, K, samples);
+            if (classMap[i] != cluster)
+            {
+                classMap[i] = cluster;
+                sketchMismatches++;
+            }
+        }
+    }
+
+    // Within-cluster sum of squares of the final classes
+    double inertia = 0.0;
+    # pragma omp parallel for num_threads(threads) reduction(+:inertia)
+    for (i = 0; i < lines; i++)
+    {
+        inertia += exactSquared(&data[i * samples], &centroids[(classMap[i] - 1) * samples], samples);
+    }
+
+    run->indexMismatches = 0;
+    if (indexAssign)
+    {
+        // Final-assignment recall: labels compared with a brute-force assignment to the centroids of the last
+        // iteration
+        int indexMismatches = 0;
+        # pragma omp parallel for num_threads(threads) reduction(+:indexMismatches)
+        for (i = 0; i < lines; i++)
+        {
+            if (assignExact(&data[i * samples], prevCentroids, K, samples) != classMap[i])
+            {
+                indexMismatches++;
+            }
+        }
+        run->indexMismatches = indexMismatches;
+    }
+
+    run->iterations = it;
+    run->restart = 0;
+    run->changes = lastChanges;
+    run->maxDist = lastMaxDist;
+    run->inertia = inertia;
+    run->pdsEvaluated = pdsEvaluated;
+    run->sketchEvaluated = sketchEvaluated;
+    run->sketchMismatches = sketchMismatches;
+    run->indexLists = centroidIndex.lists;
+    run->indexProbes = centroidIndex.probes;
+    run->gridPointBlocks = grid ? taskGrid.pointBlocks : 0;
+    run->gridCentroidBlocks = grid ? taskGrid.centroidBlocks : 0;
+    run->refitLines = 0;
+    run->boundEvaluated = 0;
+    run->lloydMismatches = -1;
+
+    free(centroidSketch);
+    free(prevCentroids);
+    freeCentroidIndex(&centroidIndex);
+    free(pointsPerClass);
+    free(auxCentroids);
+    free(movement);
+    free(gridDist);
+    free(gridCluster);
+    return 0;
+}
+
+/*
+Function kmeansRefit: Lloyd's iterations from the centroids of a previous clustering of the first
+priorLines rows, whose classes are in classMap (the other entries are 0). The new rows are
+compared with every centroid in the first assignment, and the other rows only when the bounds of
+kmeans_bounds.h say that they could change class. Always uses the default assignment. outputMsg,
+trace and perf as in kmeansFit.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int kmeansRefit(const KMeansInput* in, int K, float* centroids, int* classMap, int priorLines,
+                       int maxIterations, int minChanges, float maxThreshold, int threads, KMeansLog* outputMsg,
+                       PhaseTrace* trace, PerfCounters* perf, KMeansRun* run)
+{
+    const float* data = in->data;
+    const int lines = in->lines, samples = in->samples;
+    const int auxCentroidsSize = K * samples;
+    int i, j, cluster;
+    int changes = 0;
+    int anotherIteration = 0;
+    int it = 1;
+    long evaluated = 0;
+    float_t dist, maxDist = FLT_MIN;
+
+    // upper: distance to the centroid of the class, lower: to any other centroid
+    // gap: half of the distance of each centroid to the nearest other one, drift: its last movement
+    int* pointsPerClass = calloc(K, sizeof(int));
+    float* auxCentroids = calloc(auxCentroidsSize, sizeof(float));
+    float* upper = malloc(lines * sizeof(float));
+    float* lower = malloc(lines * sizeof(float));
+    float* gap = malloc(K * sizeof(float));
+    float* drift = malloc(K * sizeof(float));
+    if (pointsPerClass == NULL || auxCentroids == NULL || upper == NULL || lower == NULL || gap == NULL ||
+        drift == NULL)
+    {
+        free(pointsPerClass);
+        free(auxCentroids);
+        free(upper);
+        free(lower);
+        free(gap);
+        free(drift);
+        return -4;
+    }
+
+    # pragma omp parallel num_threads(threads) private(i, j, cluster, dist)
+    {
+        const int thread = omp_get_thread_num();
+        int iteration;
+        double mark;
+
+        // The previous classes come without bounds: the upper one is computed when first needed
+        # pragma omp for
+        for (i = 0; i < lines; i++)
+        {
+            upper[i] = FLT_MAX;
+            lower[i] = 0.0f;
+        }
+        PerfCounters* const counters = perf != NULL ? &perf[thread] : NULL;
+        if (counters != NULL)
+        {
+            perfOpen(counters, omp_get_wtime());
+        }
+
+        do
+        {
+            iteration = it;
+            mark = omp_get_wtime();
+            # pragma omp for
+            for (i = 0; i < K; i++)
+            {
+                gap[i] = halfGap(centroids, K, samples, i);
+            }
+
+            // 1. Assign each point whose bounds do not hold and count the elements in each class
+            # pragma omp for nowait reduction(+:changes, pointsPerClass[:K], evaluated)
+            for (i = 0; i < lines; i++)
+            {
+                cluster = classMap[i];
+                if (cluster > 0 && !boundsHold(upper[i], lower[i], gap[cluster - 1]))
+                {
+                    upper[i] = euclideanDistance(&data[i * samples], &centroids[(cluster - 1) * samples], samples);
+                    evaluated++;
+                }
+                if (cluster == 0 || !boundsHold(upper[i], lower[i], gap[cluster - 1]))
+                {
+                    cluster = assignBounded(&data[i * samples], centroids, K, samples, &upper[i], &lower[i]);
+                    evaluated += K;
+                }
+
+                if (classMap[i] != cluster)
+                {
+                    classMap[i] = cluster;
+                    changes++;
+                }
+                pointsPerClass[cluster - 1]++;
+            }
+            // No need of implicit barrier, the lines are split as in step 2.
+            tracePhase(trace, iteration, thread, PHASE_ASSIGN, &mark, omp_get_wtime());
+            perfPhase(counters, PERF_ASSIGN, mark);
+
+            // 2. Compute the partial sum of all the coordinates of point within the same cluster
+            # pragma omp for reduction(+:auxCentroids[:auxCentroidsSize])
+            for (i = 0; i < lines; i++)
+            {
+                cluster = classMap[i] - 1;
+                for (j = 0; j < samples; j++)
+                {
+                    auxCentroids[cluster * samples + j] += data[i * samples + j];
+                }
+            }
+            tracePhase(trace, iteration, thread, PHASE_ACCUMULATE, &mark, omp_get_wtime());
+
+            # pragma omp for nowait
+            for (i = 0; i < K; i++)
+            {
+                for (j = 0; j < samples; j++)
+                {
+                    auxCentroids[i * samples + j] /= pointsPerClass[i];
+                }
+            }
+            // No need of implicit barrier, each thread will work on the auxCentroids section that it has calculated.
+            tracePhase(trace, iteration, thread, PHASE_REDUCE, &mark, omp_get_wtime());
+
+            // 3. Get the movement of every centroid and the maximum one
+            # pragma omp for reduction(max:maxDist)
+            for (i = 0; i < K; i++)
+            {
+                dist = euclideanDistance(&centroids[i * samples], &auxCentroids[i * samples], samples);
+                drift[i] = dist;
+
+                if (dist > maxDist)
+                {
+                    maxDist = dist;
+                }
+                pointsPerClass[i] = 0;
+            }
+
+            // 4. Check termination conditions and clean memory for the next iteration
+            # pragma omp single
+            {
+                #ifdef DEBUG
+                if (outputMsg != NULL)
+                {
+                    appendLog(outputMsg, "\n[%d] Cluster changes: %d\tMax. centroid distance: %f", it, changes,
+                              maxDist);
+                }
+                #endif
+
+                anotherIteration = (changes > minChanges) && (it < maxIterations) && (maxDist > maxThreshold);
+                memcpy(centroids, auxCentroids, (auxCentroidsSize * sizeof(float)));
+                memset(auxCentroids, 0.0, auxCentroidsSize * sizeof(float));
+                it++;
+            }
+
+            // 5. Move the bounds with the centroids
+            if (anotherIteration)
+            {
+                # pragma omp for
+                for (i = 0; i < lines; i++)
+                {
+                    upper[i] += drift[classMap[i] - 1];
+                    lower[i] -= maxDist;
+                }
+            }
+
+            # pragma omp single
+            {
+                if (anotherIteration)
+                {
+                    maxDist = FLT_MIN;
+                    changes = 0;
+                }
+            }
+            tracePhase(trace, iteration, thread, PHASE_CONVERGE, &mark, omp_get_wtime());
+            perfPhase(counters, PERF_UPDATE, mark);
+        }
+        while (anotherIteration);
+        perfClose(counters);
+    }
+    it--;
+    if (trace != NULL)
+    {
+        trace->recorded = it;
+    }
+
+    // Within-cluster sum of squares of the final classes
+    double inertia = 0.0;
+    # pragma omp parallel for num_threads(threads) reduction(+:inertia)
+    for (i = 0; i < lines; i++)
+    {
+        inertia += exactSquared(&data[i * samples], &centroids[(classMap[i] - 1) * samples], samples);
+    }
+
+    memset(run, 0, sizeof(KMeansRun));
+    run->lloydMismatches = -1;
+    run->iterations = it;
+    run->changes = changes;
+    run->maxDist = maxDist;
+    run->inertia = inertia;
+    run->refitLines = lines - priorLines;
+    run->boundEvaluated = evaluated;
+
+    free(pointsPerClass);
+    free(auxCentroids);
+    free(upper);
+    free(lower);
+    free(gap);
+    free(drift);
+    return 0;
+}
+
+/*
+Function fitRestarts: Runs restarts independent clusterings in K classes and keeps the one with the
+lowest inertia. The first restart starts from centroids, restart r from drawCentroids(r).
+With few lines per thread the restarts run at the same time, each one with its share of the
+threads; otherwise they run one after another with all the threads. KMEANS_N_INIT_MODE=restarts
+or points forces the choice. Inside a sweep group the restarts always run one after another.
+centroids and classMap (zeroed) receive the result of the best restart; outputMsg, trace and perf
+get the progress, the phases and the counters of the first one.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int fitRestarts(const KMeansInput* in, int K, int restarts, float* centroids, int* classMap, int maxIterations,
+                       int minChanges, float maxThreshold, int threads, KMeansLog* outputMsg, PhaseTrace* trace,
+                       PerfCounters* perf, KMeansRun* run)
+{
+    if (restarts <= 1)
+    {
+        return kmeansFit(in, K, centroids, classMap, maxIterations, minChanges, maxThreshold, threads, outputMsg,
+                         trace, perf, run);
+    }
+
+    const char* RAW_KMEANS_N_INIT_MODE = getenv("KMEANS_N_INIT_MODE");
+    int concurrent = in->lines < threads * RESTART_LINES_PER_THREAD;
+    if (RAW_KMEANS_N_INIT_MODE != NULL)
+    {
+        concurrent = strcmp(RAW_KMEANS_N_INIT_MODE, "restarts") == 0;
+    }
+    const int groups = (concurrent && omp_get_active_level() == 0) ? MIN(restarts, threads) : 1;
+    const long size = (long)K * in->samples;
+
+    // One class map per restart when they run at the same time, a single candidate otherwise
+    float* starts = malloc(restarts * size * sizeof(float));
+    int* candidates = calloc((long)(groups > 1 ? restarts : 1) * in->lines, sizeof(int));
+    KMeansRun* runs = malloc(restarts * sizeof(KMeansRun));
+    int* errors = calloc(restarts, sizeof(int));
+    int r, best = 0, error = 0;
+
+    if (starts == NULL || candidates == NULL || runs == NULL || errors == NULL)
+    {
+        error = -4;
+    }
+    else
+    {
+        memcpy(starts, centroids, size * sizeof(float));
+        for (r = 1; r < restarts; r++)
+        {
+            drawCentroids(in->data, in->lines, in->samples, K, r, &starts[r * size]);
+        }
+    }
+
+    if (error == 0 && groups > 1)
+    {
+        // Each restart opens its own team inside the team of the restarts
+        omp_set_max_active_levels(2);
+        # pragma omp parallel for num_threads(groups) schedule(dynamic, 1)
+        for (r = 0; r < restarts; r++)
+        {
+            errors[r] = kmeansFit(in, K, &starts[r * size], &candidates[(long)r * in->lines], maxIterations,
+                                  minChanges, maxThreshold, MAX(threads / groups, 1), r == 0 ? outputMsg : NULL,
+                                  r == 0 ? trace : NULL, r == 0 ? perf : NULL, &runs[r]);
+        }
+        for (r = 0; r < restarts && error == 0; r++)
+        {
+            error = errors[r];
+            if (runs[r].inertia < runs[best].inertia)
+            {
+                best = r;
+            }
+        }
+        if (error == 0)
+        {
+            memcpy(classMap, &candidates[(long)best * in->lines], in->lines * sizeof(int));
+        }
+    }
+    else if (error == 0)
+    {
+        for (r = 0; r < restarts && error == 0; r++)
+        {
+            memset(candidates, 0, in->lines * sizeof(int));
+            error = kmeansFit(in, K, &starts[r * size], candidates, maxIterations, minChanges, maxThreshold, threads,
+                              r == 0 ? outputMsg : NULL, r == 0 ? trace : NULL, r == 0 ? perf : NULL, &runs[r]);
+            if (error == 0 && (r == 0 || runs[r].inertia < runs[best].inertia))
+            {
+                best = r;
+                memcpy(classMap, candidates, in->lines * sizeof(int));
+            }
+        }
+    }
+
+    if (error == 0)
+    {
+        memcpy(centroids, &starts[best * size], size * sizeof(float));
+        *run = runs[best];
+        run->restart = best;
+    }
+
+    free(starts);
+    free(candidates);
+    free(runs);
+    free(errors);
+    return error;
+}
+
+/*
+Function sweepClusters: Clusters the same input once for each number of clusters of the list.
+KMEANS_SWEEP_GROUPS clusterings run at the same time, each one with its share of the threads.
+Every clustering starts from the centroids a run with only that K would use, and keeps the best
+of restarts restarts. The classes are written to <output>.k<K> and one CSV line per K is printed
+to stdout.
+Returns 0 on success or the error code.
+*/
+static int sweepClusters(const KMeansInput* in, const int* clusters, int count, int restarts, int maxIterations,
+                         int minChanges, float maxThreshold, int threads, const char* outputFile)
+{
+    const char* RAW_KMEANS_SWEEP_GROUPS = getenv("KMEANS_SWEEP_GROUPS");
+    int groups = (RAW_KMEANS_SWEEP_GROUPS != NULL && atoi(RAW_KMEANS_SWEEP_GROUPS) > 0) ? atoi(RAW_KMEANS_SWEEP_GROUPS) : 1;
+    groups = MIN(groups, MIN(count, threads));
+    if (groups < 1) groups = 1;
+
+    float** centroids = calloc(count, sizeof(float*));
+    int** classMaps = calloc(count, sizeof(int*));
+    KMeansRun* runs = calloc(count, sizeof(KMeansRun));
+    double* times = calloc(count, sizeof(double));
+    int* errors = calloc(count, sizeof(int));
+    char* filename = malloc(strlen(outputFile) + 16);
+    int k, i, error = 0;
+
+    if (centroids == NULL || classMaps == NULL || runs == NULL || times == NULL || errors == NULL || filename == NULL)
+    {
+        error = -4;
+    }
+
+    // Initial centroids, drawn sequentially as in a run with a single K
+    for (k = 0; k < count && error == 0; k++)
+    {
+        int* centroidPos = calloc(clusters[k], sizeof(int));
+        centroids[k] = calloc((long)clusters[k] * in->samples, sizeof(float));
+        classMaps[k] = calloc(in->lines, sizeof(int));
+        if (centroidPos == NULL || centroids[k] == NULL || classMaps[k] == NULL)
+        {
+            error = -4;
+        }
+        else
+        {
+            srand(0);
+            for (i = 0; i < clusters[k]; i++)
+                centroidPos[i] = rand() % in->lines;
+            initCentroids(in->data, centroids[k], centroidPos, in->samples, clusters[k]);
+        }
+        free(centroidPos);
+    }
+
+    if (error == 0)
+    {
+        // Each clustering opens its own team inside the team of the sweep
+        if (groups > 1)
+        {
+            omp_set_max_active_levels(2);
+        }
+        # pragma omp parallel for num_threads(groups) schedule(dynamic, 1) if(groups > 1)
+        for (k = 0; k < count; k++)
+        {
+            double begin = omp_get_wtime();
+            errors[k] = fitRestarts(in, clusters[k], restarts, centroids[k], classMaps[k], maxIterations, minChanges,
+                                    maxThreshold, MAX(threads / groups, 1), NULL, NULL, NULL, &runs[k]);
+            times[k] = omp_get_wtime() - begin;
+        }
+
+        printf("K,iterations,inertia,seconds\n");
+        for (k = 0; k < count && error == 0; k++)
+        {
+            error = errors[k];
+            if (error == 0)
+            {
+                printf("%d,%d,%f,%f\n", clusters[k], runs[k].iterations, runs[k].inertia, times[k]);
+                sprintf(filename, "%s.k%d", outputFile, clusters[k]);
+                error = writeResult(classMaps[k], in->lines, filename);
+                if (error != 0)
+                {
+                    showFileError(error, filename);
+                }
+            }
+        }
+        fflush(stdout);
+    }
+
+    for (k = 0; k < count && centroids != NULL && classMaps != NULL; k++)
+    {
+        free(centroids[k]);
+        free(classMaps[k]);
+    }
+    free(centroids);
+    free(classMaps);
+    free(runs);
+    free(times);
+    free(errors);
+    free(filename);
+    return error;
+}
+
+/*
+Function probeChoice: Seconds of a short clustering of the input from centroids with the settings of
+choice, which are left in in. probeCentroids and probeMap are scratch space for the clustering.
+Returns a negative time if the memory could not be allocated.
+*/
+static double probeChoice(KMeansInput* in, int K, const float* centroids, float* probeCentroids, int* probeMap,
+                          const TuneChoice* choice)
+{
+    KMeansRun run;
+    in->schedule = choice->schedule;
+    in->chunk = choice->chunk;
+    in->pointTile = choice->pointTile;
+    in->centroidTile = choice->centroidTile;
+    memcpy(probeCentroids, centroids, (long)K * in->samples * sizeof(float));
+    memset(probeMap, 0, in->lines * sizeof(int));
+
+    // No stop condition but the number of iterations
+    double start = omp_get_wtime();
+    if (kmeansFit(in, K, probeCentroids, probeMap, TUNE_PROBE_ITERATIONS, -1, -1.0f, choice->threads, NULL, NULL,
+                  NULL, &run) != 0)
+    {
+        return -1.0;
+    }
+    return omp_get_wtime() - start;
+}
+
+/*
+Function tuneSettings: Chooses the threads (up to maxThreads), the schedule of the assignment and,
+for the tiled kernel, the block sizes for the clustering of the input in K classes, and leaves them
+in in. With mode 1 the choice cached for the shape on this machine is used when there is one;
+otherwise short probe clusterings from centroids try one knob at a time (threads with a static
+split, then dynamic and guided schedules, then halving and doubling each block size) and the
+fastest settings are appended to the cache. *cached tells which case happened.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int tuneSettings(KMeansInput* in, int K, const float* centroids, int maxThreads, int mode, TuneChoice* choice,
+                        int* cached)
+{
+    char path[1000], key[TUNE_KEY_SIZE];
+    const char* kernel = in->aosoaLayout ? "aosoa" : in->tiledAssign ? "tiled" : in->pdsAssign ? "pds"
+                       : in->sketchAssign ? "sketch" : in->indexAssign ? "index" : "default";
+    tuneCachePath(path, sizeof(path));
+    tuneKey(key, in->lines, in->samples, K, maxThreads, kernel);
+
+    *cached = mode == 1 && readTuneCache(path, key, choice);
+    if (!*cached)
+    {
+        float* probeCentroids = malloc((long)K * in->samples * sizeof(float));
+        int* probeMap = malloc(in->lines * sizeof(int));
+        TuneChoice best = { maxThreads, omp_sched_static, 0, 0, 0, DBL_MAX }, candidate;
+        const omp_sched_t schedules[2] = { omp_sched_dynamic, omp_sched_guided };
+        int t, i, error = 0;
+        if (probeCentroids == NULL || probeMap == NULL)
+        {
+            error = -4;
+        }
+
+        // Warm-up: the first clustering pays for the page faults of the input
+        if (error == 0 && probeChoice(in, K, centroids, probeCentroids, probeMap, &best) < 0.0)
+        {
+            error = -4;
+        }
+
+        // Threads: powers of two and the maximum, with the static split
+        for (t = 1; error == 0; t = MIN(2 * t, maxThreads))
+        {
+            candidate = best;
+            candidate.threads = t;
+            candidate.seconds = probeChoice(in, K, centroids, probeCentroids, probeMap, &candidate);
+            error = candidate.seconds < 0.0 ? -4 : 0;
+            if (error == 0 && candidate.seconds < best.seconds)
+            {
+                best = candidate;
+            }
+            if (t >= maxThreads)
+            {
+                break;
+            }
+        }
+
+        // Schedules of the assignment loops
+        for (i = 0; i < 2 && error == 0; i++)
+        {
+            candidate = best;
+            candidate.schedule = schedules[i];
+            candidate.chunk = TUNE_CHUNK;
+            candidate.seconds = probeChoice(in, K, centroids, probeCentroids, probeMap, &candidate);
+            error = candidate.seconds < 0.0 ? -4 : 0;
+            if (error == 0 && candidate.seconds < best.seconds)
+            {
+                best = candidate;
+            }
+        }
+
+        // Block sizes of the tiled kernel around the ones chosen from the cache sizes
+        if (in->tiledAssign && error == 0)
+        {
+            const TileSizes tiles = chooseTileSizes(in->lines, in->samples, K, best.threads);
+            const int pointTiles[4] = { MAX(tiles.pointTile / 2, 1), 2 * tiles.pointTile, tiles.pointTile,
+                                        tiles.pointTile };
+            const int centroidTiles[4] = { tiles.centroidTile, tiles.centroidTile, MAX(tiles.centroidTile / 2, 1),
+                                           MIN(2 * tiles.centroidTile, K) };
+            for (i = 0; i < 4 && error == 0; i++)
+            {
+                candidate = best;
+                candidate.pointTile = pointTiles[i];
+                candidate.centroidTile = centroidTiles[i];
+                candidate.seconds = probeChoice(in, K, centroids, probeCentroids, probeMap, &candidate);
+                error = candidate.seconds < 0.0 ? -4 : 0;
+                if (error == 0 && candidate.seconds < best.seconds)
+                {
+                    best = candidate;
+                }
+            }
+        }
+
+        free(probeCentroids);
+        free(probeMap);
+        if (error != 0)
+        {
+            return error;
+        }
+        *choice = best;
+        // A cache that cannot be written only costs the probes of the next run
+        writeTuneCache(path, key, choice);
+    }
+
+    in->schedule = choice->schedule;
+    in->chunk = choice->chunk;
+    in->pointTile = choice->pointTile;
+    in->centroidTile = choice->centroidTile;
+    return 0;
+}
+
+
+/*
+ * State behind a KMeansContext: the rows and the structures derived from them, the buffers of the
+ * last clustering and its outcome
+ */
+struct KMeansContext
+{
+    KMeansInput input;
+    KMeansParams params;
+    ThreadPlacement placement;
+    int numaPlacement;    // KMEANS_NUMA: rows first touched by their thread and centroid replicas per node
+    int pinned;           // KMEANS_PIN: threads bound to cores
+    float* ownedRows;     // rows allocated by the context, NULL when the caller owns them
+    int prepared;         // prepareInput and the blocked layout, built at the first clustering
+    int K;                // 0 until the first clustering
+    float* centroids;     // buffers of the caller given to the last clustering
+    int* labels;
+    KMeansRun run;
+    int tuneMode;         // KMEANS_AUTOTUNE
+    int tuneCached;
+    double tuneSeconds;
+    TuneChoice choice;    // settings of the last clustering
+    double* weights;      // online updates: points seen by each centroid, decayed; NULL until the first update
+    int* pointsPerClass;  // online updates: points and sum of the coordinates of each class in a batch
+    float* auxCentroids;
+    long updatedPoints;
+    int updates;
+    float decay;          // decay of the last update
+    KMeansLog log;        // progress of the iterations, only in debug mode
+    PhaseTrace trace;     // KMEANS_TRACE: phases of the last clustering, seconds is NULL otherwise
+    double prepareSeconds;
+    PerfCounters* perf;   // KMEANS_PERF: counters of every thread of the last clustering, NULL otherwise
+    int perfThreads;
+    KMeansLog counters;   // KMEANS_PERF: summary of perf
+    AoSoAData batch;      // predictions: the last batch in the blocked layout, block NULL until the first one
+    int batchCapacity;    // points that fit in batch.block
+};
+
+/*
+Function kmeansDefaultParams: Fills params with the default parameters.
+*/
+void kmeansDefaultParams(KMeansParams* params)
+{
+    // Get the number of threads that will be spawned
+    const char* RAW_OMP_NUM_THREADS = getenv("OMP_NUM_THREADS");
+    // Number of independent restarts, the one with the lowest inertia is kept
+    const char* RAW_KMEANS_N_INIT = getenv("KMEANS_N_INIT");
+
+    params->threads = (RAW_OMP_NUM_THREADS != NULL) ? (atoi(RAW_OMP_NUM_THREADS)) : omp_get_max_threads();
+    params->maxIterations = 100;
+    params->minChanges = 0;
+    params->maxThreshold = 0.0f;
+    params->restarts = (RAW_KMEANS_N_INIT != NULL && atoi(RAW_KMEANS_N_INIT) > 1) ? atoi(RAW_KMEANS_N_INIT) : 1;
+}
+
+/*
+Function kmeansContextCreate: Context on the lines x samples rows of data (not copied), or on rows
+allocated by the context when data is NULL. params may be NULL for the defaults.
+Returns NULL if the arguments are not valid or the memory could not be allocated.
+*/
+KMeansContext* kmeansContextCreate(const float* data, int lines, int samples, const KMeansParams* params)
+{
+    KMeansContext* context = calloc(1, sizeof(KMeansContext));
+    if (context == NULL || lines < 0 || (lines == 0 && data != NULL) || samples < 1)
+    {
+        free(context);
+        return NULL;
+    }
+    if (params != NULL)
+    {
+        context->params = *params;
+    }
+    else
+    {
+        kmeansDefaultParams(&context->params);
+    }
+    const int threads = context->params.threads;
+
+    // Optional NUMA-aware placement: threads bound to cores, rows first touched by their thread
+    const char* RAW_KMEANS_PIN = getenv("KMEANS_PIN");
+    const char* RAW_KMEANS_NUMA = getenv("KMEANS_NUMA");
+    context->numaPlacement = (RAW_KMEANS_NUMA != NULL) && (atoi(RAW_KMEANS_NUMA) != 0);
+    context->pinned = RAW_KMEANS_PIN != NULL;
+    context->placement = (ThreadPlacement){ 0, 1, NULL, NULL };
+    if ((context->numaPlacement || context->pinned) &&
+        planPlacement(&context->placement, threads, RAW_KMEANS_PIN) != 0)
+    {
+        kmeansContextFree(context);
+        return NULL;
+    }
+    if (context->pinned)
+    {
+        pinThreads(&context->placement);
+    }
+
+    if (data == NULL && lines > 0)
+    {
+        context->ownedRows = context->numaPlacement ? malloc((long)lines * samples * sizeof(float))
+                                                    : calloc((long)lines * samples, sizeof(float));
+        if (context->ownedRows == NULL)
+        {
+            kmeansContextFree(context);
+            return NULL;
+        }
+        if (context->numaPlacement)
+        {
+            firstTouchRows(context->ownedRows, lines, samples, threads);
+        }
+    }
+
+    context->input.data = data != NULL ? data : context->ownedRows;
+    context->input.lines = lines;
+    context->input.samples = samples;
+    context->input.placement = context->numaPlacement ? &context->placement : NULL;
+    context->input.layout = (AoSoAData){ NULL, 0, 0, 0, 0, 0 };
+    return context;
+}
+
+/*
+Function kmeansContextRows: Rows allocated by the context, NULL when the caller owns them.
+*/
+float* kmeansContextRows(KMeansContext* context)
+{
+    return context->ownedRows;
+}
+
+/*
+Function prepareContext: Builds the structures derived from the rows before the first clustering,
+when the rows are final.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int prepareContext(KMeansContext* context)
+{
+    KMeansInput* in = &context->input;
+    if (context->prepared)
+    {
+        return 0;
+    }
+    context->prepareSeconds = omp_get_wtime();
+
+    // Optional blocked copy of data: groups of points interleaved per dimension
+    const char* RAW_KMEANS_LAYOUT = getenv("KMEANS_LAYOUT");
+    in->aosoaLayout = (RAW_KMEANS_LAYOUT != NULL) && (strcmp(RAW_KMEANS_LAYOUT, "aosoa") == 0);
+    if (in->aosoaLayout && buildAoSoA(&in->layout, in->data, in->lines, in->samples, layoutWidth()) != 0)
+    {
+        return -4;
+    }
+    if (prepareInput(in) != 0)
+    {
+        return -4;
+    }
+    // KMEANS_AUTOTUNE: threads, schedule and block sizes from the tuning cache or from probe runs
+    context->tuneMode = autotuneMode();
+    context->prepared = 1;
+    context->prepareSeconds = omp_get_wtime() - context->prepareSeconds;
+    return 0;
+}
+
+/*
+Function resetUpdates: Forgets the online updates of the previous centroids.
+*/
+static void resetUpdates(KMeansContext* context)
+{
+    free(context->weights);
+    free(context->pointsPerClass);
+    free(context->auxCentroids);
+    context->weights = NULL;
+    context->pointsPerClass = NULL;
+    context->auxCentroids = NULL;
+    context->updatedPoints = 0;
+    context->updates = 0;
+}
+
+/*
+Function startClustering: Empties the log and the counters and, with KMEANS_PERF, prepares the
+counters of threads threads; with KMEANS_TRACE, the table of the phases, with the preparation of
+the rows and the autotuning as its init phase.
+Returns 0 on success and -4 if the memory could not be allocated.
+*/
+static int startClustering(KMeansContext* context, int threads)
+{
+    context->log.length = 0;
+    if (context->log.text != NULL)
+    {
+        context->log.text[0] = '\0';
+    }
+    context->counters.length = 0;
+    if (context->counters.text != NULL)
+    {
+        context->counters.text[0] = '\0';
+    }
+    free(context->perf);
+    context->perf = NULL;
+    context->perfThreads = threads;
+    if (perfRequested() && (context->perf = calloc(threads, sizeof(PerfCounters))) == NULL)
+    {
+        return -4;
+    }
+    freeTrace(&context->trace);
+    if (tracePath() == NULL)
+    {
+        return 0;
+    }
+    if (initTrace(&context->trace, context->params.maxIterations, threads) != 0)
+    {
+        return -4;
+    }
+    context->trace.seconds[PHASE_INIT] = context->prepareSeconds + context->tuneSeconds;
+    context->prepareSeconds = 0.0;
+    return 0;
+}
+
+/*
+Function compareLloyd: Runs the clustering of the context from the K centroids start (overwritten)
+with the exact assignment instead of the centroid index, and counts the labels that differ from
+labels in the outcome of the last clustering. Returns 0 on success and -4 if the memory could not
+be allocated.
+*/
+static int compareLloyd(KMeansContext* context, int K, float* start, const int* labels)
+{
+    const KMeansParams* params = &context->params;
+    const int lines = context->input.lines;
+    KMeansInput exact = context->input;
+    KMeansRun run;
+    int i, mismatches = 0;
+    int* exactLabels = calloc(lines, sizeof(int));
+
+    exact.indexAssign = 0;
+    if (exactLabels == NULL ||
+        fitRestarts(&exact, K, params->restarts, start, exactLabels, params->maxIterations, params->minChanges,
+                    params->maxThreshold, context->choice.threads, NULL, NULL, NULL, &run) != 0)
+    {
+        free(exactLabels);
+        return -4;
+    }
+    # pragma omp parallel for num_threads(context->choice.threads) reduction(+:mismatches)
+    for (i = 0; i < lines; i++)
+    {
+        mismatches += exactLabels[i] != labels[i];
+    }
+    context->run.lloydMismatches = mismatches;
+    free(exactLabels);
+    return 0;
+}
+
+/*
+Function kmeansContextFit: Clusters the rows in K classes. centroids (K x samples) holds the initial
+centroids and receives the final ones; labels (lines) receives the class of each row.
+*/
+int kmeansContextFit(KMeansContext* context, int K, float* centroids, int* labels)
+{
+    const KMeansParams* params = &context->params;
+    int error;
+
+    if (K < 1 || centroids == NULL || labels == NULL || context->input.lines == 0)
+    {
+        return -1;
+    }
+    if (prepareContext(context) != 0)
+    {
+        return -4;
+    }
+
+    context->choice = (TuneChoice){ params->threads, omp_sched_static, 0, 0, 0, 0.0 };
+    context->tuneCached = 0;
+    context->tuneSeconds = omp_get_wtime();
+    if (context->tuneMode != 0 && tuneSettings(&context->input, K, centroids, params->threads, context->tuneMode,
+                                               &context->choice, &context->tuneCached) != 0)
+    {
+        return -4;
+    }
+    context->tuneSeconds = omp_get_wtime() - context->tuneSeconds;
+
+    memset(labels, 0, context->input.lines * sizeof(int));
+    if (startClustering(context, context->choice.threads) != 0)
+    {
+        return -4;
+    }
+    // KMEANS_INDEX_REFERENCE: the initial centroids of the exact clustering the index is compared with
+    float* start = NULL;
+    if (context->input.indexAssign && indexReference())
+    {
+        if ((start = malloc((long)K * context->input.samples * sizeof(float))) == NULL)
+        {
+            return -4;
+        }
+        memcpy(start, centroids, (long)K * context->input.samples * sizeof(float));
+    }
+    error = fitRestarts(&context->input, K, params->restarts, centroids, labels, params->maxIterations,
+                        params->minChanges, params->maxThreshold, context->choice.threads, &context->log,
+                        context->trace.seconds != NULL ? &context->trace : NULL, context->perf, &context->run);
+    if (error == 0 && start != NULL)
+    {
+        error = compareLloyd(context, K, start, labels);
+    }
+    free(start);
+    if (error != 0 || (context->perf != NULL &&
+                       describePerf(context->perf, context->perfThreads, "thread", context->input.lines,
+                                    context->input.samples, K, &context->counters) != 0))
+    {
+        return error != 0 ? error : -4;
+    }
+    resetUpdates(context);
+    context->K = K;
+    context->centroids = centroids;
+    context->labels = labels;
+    return 0;
+}
+
+/*
+Function kmeansContextRefit: Clusters the rows again after new rows were appended, from the K
+centroids of a clustering of the first priorLines rows and their classes in labels (see
+kmeansRefit). centroids and labels receive the result as in kmeansContextFit.
+*/
+int kmeansContextRefit(KMeansContext* context, int K, float* centroids, int* labels, int priorLines)
+{
+    const KMeansParams* params = &context->params;
+    const int lines = context->input.lines;
+    int i, error;
+
+    if (K < 1 || centroids == NULL || labels == NULL || lines == 0 || priorLines < 0 || priorLines > lines)
+    {
+        return -1;
+    }
+    for (i = 0; i < priorLines; i++)
+    {
+        if (labels[i] < 1 || labels[i] > K)
+        {
+            return -1;
+        }
+    }
+    memset(&labels[priorLines], 0, (lines - priorLines) * sizeof(int));
+    context->prepareSeconds = 0.0;
+    context->tuneSeconds = 0.0;
+    if (startClustering(context, params->threads) != 0)
+    {
+        return -4;
+    }
+    error = kmeansRefit(&context->input, K, centroids, labels, priorLines, params->maxIterations, params->minChanges,
+                        params->maxThreshold, params->threads, &context->log,
+                        context->trace.seconds != NULL ? &context->trace : NULL, context->perf, &context->run);
+    if (error != 0 || (context->perf != NULL &&
+                       describePerf(context->perf, context->perfThreads, "thread", lines, context->input.samples, K,
+                                    &context->counters) != 0))
+    {
+        return error != 0 ? error : -4;
+    }
+    resetUpdates(context);
+    context->K = K;
+    context->centroids = centroids;
+    context->labels = labels;
+    return 0;
+}
+
+/*
+Function kmeansContextSetCentroids: Uses the K x samples centroids (not copied) as the result of a
+clustering, for kmeansContextPredict.
+*/
+int kmeansContextSetCentroids(KMeansContext* context, int K, float* centroids)
+{
+    if (K < 1 || centroids == NULL)
+    {
+        return -1;
+    }
+    resetUpdates(context);
+    context->K = K;
+    context->centroids = centroids;
+    context->labels = NULL;
+    memset(&context->run, 0, sizeof(KMeansRun));
+    return 0;
+}
+
+/*
+Function kmeansContextPredict: Class (1..K) of the nearest centroid of the last clustering for each
+of the count rows of points, written to labels. The points are copied to the blocked layout and
+each group is assigned with the vectorized kernel of KMEANS_LAYOUT=aosoa. The layout is kept in
+the context and only allocated again for a larger batch.
+*/
+int kmeansContextPredict(KMeansContext* context, const float* points, int count, int* labels)
+{
+    const int K = context->K, samples = context->input.samples, width = layoutWidth();
+    AoSoAData* batch = &context->batch;
+    int g;
+
+    if (K == 0 || count < 0 || (count > 0 && (points == NULL || labels == NULL)))
+    {
+        return -1;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    if (batch->block != NULL && count <= context->batchCapacity && batch->width == width &&
+        batch->samples == samples)
+    {
+        fillAoSoA(batch, points, count);
+    }
+    else
+    {
+        freeAoSoA(batch);
+        context->batchCapacity = 0;
+        if (buildAoSoA(batch, points, count, samples, width) != 0)
+        {
+            return -4;
+        }
+        context->batchCapacity = batch->groups * width;
+    }
+
+    # pragma omp parallel for num_threads(MAX(context->params.threads, 1)) schedule(static)
+    for (g = 0; g < batch->groups; g++)
+    {
+        int groupCluster[AOSOA_MAX_WIDTH];
+        assignAoSoA(batch, g, context->centroids, K, groupCluster);
+        memcpy(&labels[g * batch->width], groupCluster, groupSize(batch, g) * sizeof(int));
+    }
+    return 0;
+}
+
+/*
+Function kmeansContextUpdate: Online k-means step on a batch of count rows of points. The rows are
+labelled as in kmeansContextPredict, then each centroid moves to the mean of the points it has seen:
+its weight is multiplied by decay and the points of its class in the batch are added, and the
+centroid moves towards their mean by their share of the new weight. The weights start from the
+classes of the last clustering, or at 1 per centroid after kmeansContextSetCentroids.
+*/
+int kmeansContextUpdate(KMeansContext* context, const float* points, int count, float decay, int* labels)
+{
+    const int K = context->K, samples = context->input.samples;
+    const int auxCentroidsSize = K * samples;
+    float* centroids = context->centroids;
+    int i, j, error;
+
+    if (K == 0 || !(decay > 0.0f && decay <= 1.0f))
+    {
+        return -1;
+    }
+    if (context->weights == NULL)
+    {
+        context->weights = malloc(K * sizeof(double));
+        context->pointsPerClass = calloc(K, sizeof(int));
+        context->auxCentroids = calloc(auxCentroidsSize, sizeof(float));
+        if (context->weights == NULL || context->pointsPerClass == NULL || context->auxCentroids == NULL)
+        {
+            resetUpdates(context);
+            return -4;
+        }
+        for (i = 0; i < K; i++)
+        {
+            context->weights[i] = context->labels != NULL ? 0.0 : 1.0;
+        }
+        for (i = 0; context->labels != NULL && i < context->input.lines; i++)
+        {
+            context->weights[context->labels[i] - 1] += 1.0;
+        }
+    }
+
+    // 1. Assign each point of the batch to a class
+    error = kmeansContextPredict(context, points, count, labels);
+    if (error != 0 || count == 0)
+    {
+        return error;
+    }
+
+    // 2. Count the points of each class and add their coordinates
+    int* pointsPerClass = context->pointsPerClass;
+    float* auxCentroids = context->auxCentroids;
+    # pragma omp parallel for num_threads(MAX(context->params.threads, 1)) private(j) \
+        reduction(+:pointsPerClass[:K], auxCentroids[:auxCentroidsSize])
+    for (i = 0; i < count; i++)
+    {
+        const int cluster = labels[i] - 1;
+        pointsPerClass[cluster]++;
+        for (j = 0; j < samples; j++)
+        {
+            auxCentroids[cluster * samples + j] += points[(long)i * samples + j];
+        }
+    }
+
+    // 3. Move every centroid with points in the batch, and clean for the next one
+    for (i = 0; i < K; i++)
+    {
+        context->weights[i] = decay * context->weights[i] + pointsPerClass[i];
+        for (j = 0; pointsPerClass[i] > 0 && j < samples; j++)
+        {
+            float* centroid = &centroids[i * samples + j];
+            *centroid += (auxCentroids[i * samples + j] - pointsPerClass[i] * *centroid) / context->weights[i];
+        }
+        pointsPerClass[i] = 0;
+    }
+    memset(auxCentroids, 0, auxCentroidsSize * sizeof(float));
+    context->updatedPoints += count;
+    context->updates++;
+    context->decay = decay;
+    return 0;
+}
+
+/*
+Function kmeansContextCentroids: Centroids of the last clustering, and their number in K when it is
+not NULL. NULL before the first clustering.
+*/
+const float* kmeansContextCentroids(const KMeansContext* context, int* K)
+{
+    if (K != NULL)
+    {
+        *K = context->K;
+    }
+    return context->centroids;
+}
+
+/*
+Function kmeansContextLabels: Classes of the rows in the last clustering, NULL before the first one.
+*/
+const int* kmeansContextLabels(const KMeansContext* context)
+{
+    return context->labels;
+}
+
+/*
+Function kmeansContextResult: Outcome of the last clustering.
+*/
+int kmeansContextResult(const KMeansContext* context, KMeansResult* result)
+{
+    if (context->K == 0)
+    {
+        return -1;
+    }
+    result->K = context->K;
+    result->iterations = context->run.iterations;
+    result->changes = context->run.changes;
+    result->maxDist = context->run.maxDist;
+    result->inertia = context->run.inertia;
+    result->restart = context->run.restart;
+    return 0;
+}
+
+/*
+Function kmeansContextSweep: Clusters the rows once for each of the count numbers of clusters
+(see sweepClusters).
+*/
+int kmeansContextSweep(KMeansContext* context, const int* clusters, int count, const char* outputFile)
+{
+    const KMeansParams* params = &context->params;
+    if (count < 1 || clusters == NULL || outputFile == NULL || context->input.lines == 0)
+    {
+        return -1;
+    }
+    if (prepareContext(context) != 0)
+    {
+        return -4;
+    }
+    return sweepClusters(&context->input, clusters, count, params->restarts, params->maxIterations,
+                         params->minChanges, params->maxThreshold, params->threads, outputFile);
+}
+
+/*
+Function appendText: Appends a formatted text to the size bytes of text, of which used are taken.
+The text is truncated when it does not fit.
+*/
+static void appendText(char* text, int size, int* used, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    *used += vsnprintf(text + *used, size - *used, format, args);
+    *used = MIN(*used, size - 1);
+    va_end(args);
+}
+
+/*
+Function kmeansContextDescribe: Writes to text one line per statistic of the last clustering that
+applies to the chosen options.
+*/
+void kmeansContextDescribe(const KMeansContext* context, char* text, int size)
+{
+    const KMeansInput* in = &context->input;
+    const KMeansRun* run = &context->run;
+    const int lines = in->lines, samples = in->samples, K = context->K;
+    int used = 0;
+
+    text[0] = '\0';
+    if (context->placement.threads > 0)
+    {
+        appendText(text, size, &used, "\nNUMA nodes: %d, threads %s, centroid replicas %s", context->placement.nodes,
+                   context->pinned ? "bound" : "not bound",
+                   context->numaPlacement && context->placement.nodes > 1 ? "on" : "off");
+    }
+    if (K == 0)
+    {
+        return;
+    }
+    if (context->tuneMode != 0)
+    {
+        appendText(text, size, &used, "\nAutotune (%s, %f seconds): %d threads, %s schedule, chunk %d, tiles %d x %d",
+                   context->tuneCached ? "cached" : "probed", context->tuneSeconds, context->choice.threads,
+                   scheduleName(context->choice.schedule), context->choice.chunk, context->choice.pointTile,
+                   context->choice.centroidTile);
+    }
+    if (context->params.restarts > 1)
+    {
+        appendText(text, size, &used, "\nRestarts: %d, best %d with inertia %f", context->params.restarts,
+                   run->restart, run->inertia);
+    }
+    if (in->indexAssign)
+    {
+        appendText(text, size, &used, "\nCentroid index: %d lists, %d probes, final-assignment recall %.4f%%",
+                   run->indexLists, run->indexProbes, 100.0 - 100.0 * run->indexMismatches / lines);
+        if (run->lloydMismatches >= 0)
+        {
+            appendText(text, size, &used, ", %.4f%% of labels differ from exact Lloyd",
+                       100.0 * run->lloydMismatches / lines);
+        }
+    }
+    if (run->refitLines > 0 || run->boundEvaluated > 0)
+    {
+        appendText(text, size, &used, "\nIncremental: %d new rows, %.2f%% of distances avoided by the bounds",
+                   run->refitLines, 100.0 * (1.0 - (double)run->boundEvaluated / ((double)run->iterations * lines * K)));
+    }
+    if (run->gridPointBlocks > 0)
+    {
+        appendText(text, size, &used, "\nTask grid: %d blocks of points x %d blocks of centroids",
+                   run->gridPointBlocks, run->gridCentroidBlocks);
+    }
+    if (in->pdsAssign)
+    {
+        appendText(text, size, &used, "\nPartial distance search: %.2f%% of distance FLOPs avoided",
+                   100.0 * (1.0 - (double)run->pdsEvaluated / ((double)run->iterations * lines * K * samples)));
+    }
+    if (in->sketchAssign)
+    {
+        appendText(text, size, &used,
+                   "\nRandom projection: %.2f%% of exact distances avoided, %d labels fixed by verification",
+                   100.0 * (1.0 - (double)run->sketchEvaluated / ((double)run->iterations * lines * K)),
+                   run->sketchMismatches);
+    }
+    if (context->updates > 0)
+    {
+        appendText(text, size, &used, "\nOnline updates: %ld points in %d batches, decay %g", context->updatedPoints,
+                   context->updates, context->decay);
+    }
+}
+
+/*
+Function kmeansContextLog: Progress of each iteration of the last clustering (debug builds only).
+*/
+const char* kmeansContextLog(const KMeansContext* context)
+{
+    return logText(&context->log);
+}
+
+/*
+Function kmeansContextCounters: Summary of the hardware counters of the last clustering (see
+kmeans_perf.h), empty without KMEANS_PERF=1.
+*/
+const char* kmeansContextCounters(const KMeansContext* context)
+{
+    return logText(&context->counters);
+}
+
+/*
+Function kmeansContextWriteTrace: Writes the phases of the last clustering as CSV (see
+kmeans_trace.h), adding the load, init and write seconds measured by the caller.
+*/
+int kmeansContextWriteTrace(KMeansContext* context, const char* filename, double load, double init, double write)
+{
+    PhaseTrace* trace = &context->trace;
+    if (trace->seconds == NULL || filename == NULL)
+    {
+        return -1;
+    }
+    trace->seconds[PHASE_LOAD] += load;
+    trace->seconds[PHASE_INIT] += init;
+    trace->seconds[PHASE_WRITE] += write;
+    return writeTrace(trace, trace->seconds, 1, trace->recorded, filename);
+}
+
+/*
+Function kmeansContextFree: Releases the context and the rows it allocated.
+*/
+void kmeansContextFree(KMeansContext* context)
+{
+    if (context == NULL)
+    {
+        return;
+    }
+    freeInput(&context->input);
+    freePlacement(&context->placement);
+    resetUpdates(context);
+    free(context->ownedRows);
+    free(context->log.text);
+    freeTrace(&context->trace);
+    free(context->perf);
+    free(context->counters.text);
+    freeAoSoA(&context->batch);
+    free(context);
+}
@@ -0,0 +1,167 @@
+/*
+ * k-Means clustering algorithm
+ *
+ * libkmeans: C API of the OpenMP version
+ *
+ * Clusters rows that are already in memory, without the text files of the command-line versions.
+ * A context is created on lines x samples floats owned by the caller, which are not copied and
+ * must stay valid until the context is freed (or on rows allocated by the context, to be filled
+ * through kmeansContextRows). Each clustering writes the final centroids and the class of every
+ * row (1..K) to buffers of the caller, and those same buffers are returned by the getters and used
+ * by kmeansContextPredict. The KMEANS_* environment options of the OpenMP version (assignment
+ * kernel, layout, NUMA placement, autotuning...) apply to the library in the same way.
+ *
+ * Functions returning int return 0 on success, -1 if the arguments are not valid (or nothing was
+ * clustered yet), -3 if a file could not be written and -4 if the memory could not be allocated.
+ * A context must not be used by several threads at the same time.
+ */
+#ifndef LIBKMEANS_H
+#define LIBKMEANS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct KMeansContext KMeansContext;
+
+typedef struct
+{
+    int threads;          // OpenMP threads (default OMP_NUM_THREADS, or the OpenMP default)
+    int maxIterations;    // termination conditions: iterations (default 100),
+    int minChanges;       // class changes of an iteration, in rows (default 0),
+    float maxThreshold;   // and movement of the centroids (default 0)
+    int restarts;         // clusterings from other centroids, the lowest inertia is kept (default KMEANS_N_INIT or 1)
+} KMeansParams;
+
+typedef struct
+{
+    int K;
+    int iterations;
+    int changes;          // class changes of the last iteration
+    float maxDist;        // largest centroid movement of the last iteration
+    double inertia;       // sum of the squared distances of the rows to the centroid of their class
+    int restart;          // restart that produced the result
+} KMeansResult;
+
+/*
+Function kmeansDefaultParams: Fills params with the default parameters.
+*/
+void kmeansDefaultParams(KMeansParams* params);
+
+/*
+Function kmeansContextCreate: Context on the lines x samples rows of data (not copied), or on rows
+allocated by the context when data is NULL. A context without rows (data NULL and lines 0) only
+predicts, with the centroids of kmeansContextSetCentroids. params may be NULL for the defaults.
+Returns NULL if the arguments are not valid or the memory could not be allocated.
+*/
+KMeansContext* kmeansContextCreate(const float* data, int lines, int samples, const KMeansParams* params);
+
+/*
+Function kmeansContextRows: Rows allocated by the context, to be filled before the first
+clustering. NULL when the caller owns the rows.
+*/
+float* kmeansContextRows(KMeansContext* context);
+
+/*
+Function kmeansContextFit: Clusters the rows in K classes. centroids (K x samples) holds the initial
+centroids and receives the final ones; labels (lines) receives the class of each row.
+*/
+int kmeansContextFit(KMeansContext* context, int K, float* centroids, int* labels);
+
+/*
+Function kmeansContextRefit: Clusters the rows again after new rows were appended to rows that
+were already clustered. centroids holds the K centroids of that clustering and labels the classes
+(1..K) of its priorLines rows, which must be the first ones; both receive the result as in
+kmeansContextFit. Only the new rows are compared with every centroid at first, and the old ones
+only when triangle-inequality bounds say that they could change class; the classes are the same
+as those of Lloyd's iterations from these centroids. Uses the default assignment kernel.
+*/
+int kmeansContextRefit(KMeansContext* context, int K, float* centroids, int* labels, int priorLines);
+
+/*
+Function kmeansContextSetCentroids: Uses the K x samples centroids (not copied) as the result of a
+clustering, e.g. centroids trained by another run, for kmeansContextPredict.
+*/
+int kmeansContextSetCentroids(KMeansContext* context, int K, float* centroids);
+
+/*
+Function kmeansContextPredict: Class (1..K) of the nearest centroid of the last clustering for each
+of the count rows of points (samples floats each), written to labels. The points are copied to
+the blocked layout of KMEANS_LAYOUT=aosoa and assigned with its vectorized kernel, which gives the
+same classes as comparing one centroid at a time. The copy is kept in the context and reused by
+the next batches that fit in it.
+*/
+int kmeansContextPredict(KMeansContext* context, const float* points, int count, int* labels);
+
+/*
+Function kmeansContextUpdate: Online k-means step on count rows of points: they are labelled as in
+kmeansContextPredict (labels receives their classes) and every centroid moves to the running mean of
+the points it was given, weighting the previous ones by decay (0 < decay <= 1, 1 for no decay) once
+per batch. The centroids of the last clustering are updated in place; they start with the weight of
+their classes in that clustering, or of 1 point after kmeansContextSetCentroids.
+*/
+int kmeansContextUpdate(KMeansContext* context, const float* points, int count, float decay, int* labels);
+
+/*
+Function kmeansContextCentroids: Centroids of the last clustering (the buffer given to
+kmeansContextFit), and their number in K when it is not NULL. NULL before the first clustering.
+*/
+const float* kmeansContextCentroids(const KMeansContext* context, int* K);
+
+/*
+Function kmeansContextLabels: Classes of the rows in the last clustering (the buffer given to
+kmeansContextFit). NULL before the first clustering.
+*/
+const int* kmeansContextLabels(const KMeansContext* context);
+
+/*
+Function kmeansContextResult: Outcome of the last clustering.
+*/
+int kmeansContextResult(const KMeansContext* context, KMeansResult* result);
+
+/*
+Function kmeansContextSweep: Clusters the rows once for each of the count numbers of clusters,
+writing the classes to <outputFile>.k<K> and one CSV line per K to stdout (KMEANS_SWEEP_GROUPS
+clusterings at the same time).
+*/
+int kmeansContextSweep(KMeansContext* context, const int* clusters, int count, const char* outputFile);
+
+/*
+Function kmeansContextDescribe: Writes to text (size bytes at most) one line per statistic of the
+last clustering that applies to the chosen options: placement, autotuning, restarts and the
+assignment kernel.
+*/
+void kmeansContextDescribe(const KMeansContext* context, char* text, int size);
+
+/*
+Function kmeansContextLog: Progress of each iteration of the last clustering, only recorded in
+debug builds (empty otherwise).
+*/
+const char* kmeansContextLog(const KMeansContext* context);
+
+/*
+Function kmeansContextCounters: With KMEANS_PERF=1 the cycles, instructions and last-level cache
+misses of the assignment and the update of every thread of the last clustering are counted; this
+is their summary (IPC, bytes per point, GFLOP/s and, with KMEANS_PERF_PEAK, a roofline), one line
+per statistic. Empty otherwise.
+*/
+const char* kmeansContextCounters(const KMeansContext* context);
+
+/*
+Function kmeansContextWriteTrace: With KMEANS_TRACE set, the time of every phase of every
+iteration and thread of the last clustering is recorded; this writes it to a CSV file, one row
+per thread, iteration and phase, adding the load, init and write seconds measured by the caller.
+Returns -1 when nothing was recorded.
+*/
+int kmeansContextWriteTrace(KMeansContext* context, const char* filename, double load, double init, double write);
+
+/*
+Function kmeansContextFree: Releases the context and the rows it allocated.
+*/
+void kmeansContextFree(KMeansContext* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * Load generator for KMEANS_predict: sends batches of random points to its Unix-domain socket,
+ * one at a time, and reports the throughput and the latency of the batches seen by the client.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Function declarations */
+int transfer(int fd, void* buffer, size_t size, int writing);
+int compareSeconds(const void* a, const void* b);
+double now(void);
+
+
+int main(int argc, char** argv)
+{
+    struct sockaddr_un address;
+    int fd, samples, batches, count, i, end;
+    float* points;
+    int* labels;
+    double* latencies;
+    double start, total;
+
+    if (argc != 5 && argc != 6)
+    {
+        printf("Correct Input: [socket path] [dimensions] [batches] [points per batch] | Optional: stop\n");
+        exit(1);
+    }
+    samples = strtol(argv[2], NULL, 10);
+    batches = strtol(argv[3], NULL, 10);
+    count = strtol(argv[4], NULL, 10);
+    /* A batch of -1 points stops the server, 0 only closes this connection */
+    end = (argc == 6 && strcmp(argv[5], "stop") == 0) ? -1 : 0;
+
+    points = malloc((long)count * samples * sizeof(float));
+    labels = malloc(count * sizeof(int));
+    latencies = malloc(batches * sizeof(double));
+    if (samples < 1 || batches < 1 || count < 1 || points == NULL || labels == NULL || latencies == NULL)
+    {
+        printf("Error: wrong sizes or not enough memory.\n");
+        exit(1);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        printf("Unable to connect to %s.\n", argv[1]);
+        exit(1);
+    }
+
+    /* Same values range as test_generator */
+    srand(0);
+    total = now();
+    for (i = 0; i < batches; i++)
+    {
+        for (long j = 0; j < (long)count * samples; j++)
+        {
+            points[j] = -100 + rand() % 200;
+        }
+        start = now();
+        if (!transfer(fd, &count, sizeof(int), 1) || !transfer(fd, points, (long)count * samples * sizeof(float), 1) ||
+            !transfer(fd, labels, count * sizeof(int), 0))
+        {
+            printf("Connection lost after %d batches.\n", i);
+            exit(1);
+        }
+        latencies[i] = now() - start;
+    }
+    total = now() - total;
+    transfer(fd, &end, sizeof(int), 1);
+    close(fd);
+
+    qsort(latencies, batches, sizeof(double), compareSeconds);
+    printf("%d batches of %d points: %.0f points per second, batch latency p50 %f ms, p99 %f ms\n", batches, count,
+           (double)batches * count / total, 1000.0 * latencies[(batches - 1) / 2],
+           1000.0 * latencies[(99 * batches + 99) / 100 - 1]);
+
+    free(points);
+    free(labels);
+    free(latencies);
+    return 0;
+}
+
+/**
+ * Function to write (or read) exactly size bytes. Returns 1 on success, 0 otherwise.
+ */
+int transfer(int fd, void* buffer, size_t size, int writing)
+{
+    char* next = buffer;
+    ssize_t done;
+    while (size > 0)
+    {
+        done = writing ? write(fd, next, size) : read(fd, next, size);
+        if (done <= 0)
+        {
+            return 0;
+        }
+        next += done;
+        size -= done;
+    }
+    return 1;
+}
+
+/**
+ * Function to order two latencies for qsort.
+ */
+int compareSeconds(const void* a, const void* b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Function returning a monotonic time in seconds.
+ */
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}